@@ -8,6 +8,36 @@
 #include "ni_image_utils.h"
 #endif
 
+#ifndef NI_INCLUDE_SIMD
+#define NI_SIMD_IMPLEMENTATION
+#include "ni_image_simd.h"
+#endif
+
+#ifndef NI_INCLUDE_THREADPOOL
+#define NI_THREADPOOL_IMPLEMENTATION
+#include "ni_image_threadpool.h"
+#endif
+
+#ifndef NI_INCLUDE_CONVOLVE
+#define NI_CONVOLVE_IMPLEMENTATION
+#include "ni_image_convolve.h"
+#endif
+
+#ifndef NI_INCLUDE_KERNEL_CACHE
+#define NI_KERNEL_CACHE_IMPLEMENTATION
+#include "ni_image_kernel_cache.h"
+#endif
+
+#ifndef NI_INCLUDE_CONTEXT
+#define NI_CONTEXT_IMPLEMENTATION
+#include "ni_image_context.h"
+#endif
+
+#ifndef NI_INCLUDE_PLANAR
+#define NI_PLANAR_IMPLEMENTATION
+#include "ni_image_planar.h"
+#endif
+
 /**
  * Applies Gaussian blur to an image and returns the result on a new image, that
  * needs to be freed outside.
@@ -20,149 +50,1693 @@
  * convolution.
  * double sigma -> standard deviation of the gaussian distribution.
  *
+ * The kernel is separable, so the blur runs as a horizontal pass followed by a
+ * vertical pass with a 1-dimensional kernel (O(kernel_size) per pixel). Both
+ * passes are split in bands of rows that run in the default thread pool
+ * (see ni_image_threadpool.h), and the result does not depend on the number
+ * of threads. With NI_PRECISION_FLOAT both passes run on floats, which
+ * changes about 1 in 100000 output values by one level (never more) and
+ * roughly halves the time.
+ *
  * returns a new stbi_uc array which represents the blurred image or NULL on error.
  * 
  * Error conditions:
  *  -> kernel_size % 2 == 0
+ *  -> the image or its temporary buffers could not be allocated
  */
 stbi_uc *ni_image_blur_gaussian(const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma);
 
-#ifdef NI_BLUR_IMPLEMENTATION
+/**
+ * Same as ni_image_blur_gaussian, choosing how the pixels outside of the
+ * image are treated (ni_image_blur_gaussian uses NI_BORDER_ZERO, which
+ * darkens the edges). Use NI_BORDER_CLAMP, NI_BORDER_MIRROR or
+ * NI_BORDER_RENORMALIZE to keep the brightness of the edges.
+ *
+ * The padding is prepared once per row and column, so the convolution runs
+ * without bounds checks and only the border strips take extra work.
+ *
+ * const stbi_uc *img_data -> data of the original image
+ * int w -> original image width
+ * int h -> original image height
+ * int n_channels -> number of channels of the original image
+ * int kernel_size -> size of the gaussian kernel to be used for the
+ * convolution.
+ * double sigma -> standard deviation of the gaussian distribution.
+ * NI_IMAGE_BORDER border -> border mode (see ni_image_utils.h)
+ *
+ * returns a new stbi_uc array which represents the blurred image or NULL on error.
+ *
+ * Error conditions:
+ *  -> kernel_size % 2 == 0
+ *  -> the image or its temporary buffers could not be allocated
+ */
+stbi_uc *ni_image_blur_gaussian_border(const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma, NI_IMAGE_BORDER border);
 
 /**
- * Calculates the value of a specific coordinate in the Gaussian kernel, intended
- * only for internal usage.
- * 
- * int x -> x-coordinate inside of kernel
- * int y -> y-coordinate inside of kernel
- * double sigma -> standard deviation of the distribution
- * 
- * returns double containing the value
+ * Same as ni_image_blur_gaussian_border but the result is written to an
+ * image owned by the caller, and the temporary buffers are taken from a
+ * scratch owned by the caller too (see ni_scratch in ni_image_utils.h).
+ * With a scratch of ni_image_blur_gaussian_scratch_size bytes and a kernel
+ * that is already cached, nothing is allocated.
+ *
+ * stbi_uc *out -> output image of w * h * n_channels bytes, may be img_data
+ * void *scratch -> scratch memory, may be NULL
+ * size_t scratch_size -> size of the scratch memory in bytes
+ *
+ * returns out or NULL on error.
  */
-static inline double
-__ni_image_gaussian_kernel_value(int x, int y, double radius, double sigma)
-{
-	const double x_dist = ((double)x) - radius;
-	const double y_dist = ((double)y) - radius;
-	const double d_sigma_squared = 2 * sigma * sigma;
-	const double dist = (x_dist * x_dist) + (y_dist * y_dist);
-	const double factor = 1 / (M_PI * d_sigma_squared);
-	return factor * exp(-(dist / d_sigma_squared));
-}
+stbi_uc *ni_image_blur_gaussian_into(const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma, NI_IMAGE_BORDER border, stbi_uc *out, void *scratch, size_t scratch_size);
+
+/**
+ * Returns the number of bytes of scratch ni_image_blur_gaussian_into needs
+ * to not allocate anything, with the current size of the default thread
+ * pool.
+ *
+ * returns the size in bytes, or 0 if kernel_size % 2 == 0
+ */
+size_t ni_image_blur_gaussian_scratch_size(int w, int h, int n_channels, int kernel_size, NI_IMAGE_BORDER border);
+
+/**
+ * Same as ni_image_blur_gaussian_border but it runs with the thread pool,
+ * the kernel cache and the scratch of a context (see ni_image_context.h).
+ * Once the scratch of the context has grown to the size of the images and
+ * the kernel is cached, only the output is allocated.
+ *
+ * ni_context *ctx -> the context, NULL uses the defaults
+ * stbi_uc *out -> output image of w * h * n_channels bytes (may be
+ * img_data), or NULL to return a new one that needs to be freed outside
+ *
+ * returns out (or the new image) or NULL on error.
+ */
+stbi_uc *ni_image_blur_gaussian_ctx(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma, NI_IMAGE_BORDER border, stbi_uc *out);
+
+/**
+ * Same as ni_image_blur_gaussian_ctx but on image descriptors, so a region
+ * of a larger image can be blurred without copying it (see ni_image_view in
+ * ni_image_utils.h). The border mode applies at the edges of the region:
+ * the pixels around it are not read.
+ *
+ * ni_context *ctx -> the context, NULL uses the defaults
+ * const ni_image *src -> the original image, NI_PIXEL_U8
+ * ni_image *dst -> output image of the same size and channels, may be src
+ *
+ * returns dst or NULL on error.
+ *
+ * Error conditions:
+ *  -> kernel_size % 2 == 0
+ *  -> the images are not NI_PIXEL_U8 or their sizes do not match
+ *  -> the temporary buffers could not be allocated
+ */
+ni_image *ni_image_blur_gaussian_view(ni_context *ctx, const ni_image *src, ni_image *dst, int kernel_size, double sigma, NI_IMAGE_BORDER border);
+
+/**
+ * Same as ni_image_blur_gaussian_view on every plane of a planar image (see
+ * ni_image_planar.h), so both passes run over contiguous rows of a single
+ * channel.
+ *
+ * ni_context *ctx -> the context, NULL uses the defaults
+ * const ni_planes *src -> the original planar image, NI_PIXEL_U8
+ * ni_planes *dst -> output planar image of the same size, may be src
+ *
+ * returns dst or NULL on error.
+ *
+ * Error conditions:
+ *  -> the number of planes does not match
+ *  -> any of the ones of ni_image_blur_gaussian_view, on a plane
+ */
+ni_planes *ni_image_blur_gaussian_planes(ni_context *ctx, const ni_planes *src, ni_planes *dst, int kernel_size, double sigma, NI_IMAGE_BORDER border);
+
+/**
+ * Creates the kernels used by ni_image_blur_gaussian and
+ * ni_image_blur_gaussian_fixed for a pair of parameters and keeps them in the
+ * default kernel cache (see ni_image_kernel_cache.h), so that the first
+ * blurs that use them do not pay for it. Useful at startup when the
+ * parameters are known.
+ *
+ * int kernel_size -> size of the gaussian kernel
+ * double sigma -> standard deviation of the gaussian distribution.
+ *
+ * Error conditions (nothing is cached):
+ *  -> kernel_size % 2 == 0
+ */
+void ni_image_blur_gaussian_prewarm(int kernel_size, double sigma);
+
+/**
+ * Number of fractional bits of the kernel used by ni_image_blur_gaussian_fixed
+ */
+#define NI_BLUR_FIXED_KERNEL_BITS 14
+
+/**
+ * Number of fractional bits kept between the horizontal and the vertical
+ * pass of ni_image_blur_gaussian_fixed
+ */
+#define NI_BLUR_FIXED_DATA_BITS 7
+
+/**
+ * Applies Gaussian blur to an image using fixed point arithmetic and returns
+ * the result on a new image, that needs to be freed outside.
+ *
+ * The kernel is quantized to 16-bit integers that add up to exactly
+ * 1 << NI_BLUR_FIXED_KERNEL_BITS, the products are accumulated in 32-bit
+ * integers straight from the image bytes and the result is rounded to the
+ * nearest byte. The only intermediate is one int16_t per channel and pixel
+ * (instead of two doubles), and there is no floating point work besides
+ * building the kernel. The result differs by at most one level from
+ * ni_image_blur_gaussian.
+ *
+ * const stbi_uc *img_data -> data of the original image
+ * int w -> original image width
+ * int h -> original image height
+ * int n_channels -> number of channels of the original image
+ * int kernel_size -> size of the gaussian kernel to be used for the
+ * convolution.
+ * double sigma -> standard deviation of the gaussian distribution.
+ *
+ * returns a new stbi_uc array which represents the blurred image or NULL on error.
+ *
+ * Error conditions:
+ *  -> kernel_size % 2 == 0
+ *  -> the image or its temporary buffers could not be allocated
+ */
+stbi_uc *ni_image_blur_gaussian_fixed(const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma);
+
+/**
+ * Same as ni_image_blur_gaussian_fixed but with an output image and a
+ * scratch owned by the caller (see ni_image_blur_gaussian_into).
+ *
+ * stbi_uc *out -> output image of w * h * n_channels bytes, may be img_data
+ * void *scratch -> scratch memory, may be NULL
+ * size_t scratch_size -> size of the scratch memory in bytes
+ *
+ * returns out or NULL on error.
+ */
+stbi_uc *ni_image_blur_gaussian_fixed_into(const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma, stbi_uc *out, void *scratch, size_t scratch_size);
+
+/**
+ * Returns the number of bytes of scratch ni_image_blur_gaussian_fixed_into
+ * needs to not allocate anything, for any sigma.
+ *
+ * returns the size in bytes, or 0 if kernel_size % 2 == 0
+ */
+size_t ni_image_blur_gaussian_fixed_scratch_size(int w, int h, int n_channels, int kernel_size);
+
+/**
+ * Same as ni_image_blur_gaussian_fixed but with the kernel cache and the
+ * scratch of a context (see ni_image_blur_gaussian_ctx).
+ */
+stbi_uc *ni_image_blur_gaussian_fixed_ctx(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma, stbi_uc *out);
+
+/**
+ * Same as ni_image_blur_gaussian_fixed_ctx but on image descriptors (see
+ * ni_image_blur_gaussian_view). dst may be src.
+ */
+ni_image *ni_image_blur_gaussian_fixed_view(ni_context *ctx, const ni_image *src, ni_image *dst, int kernel_size, double sigma);
+
+/**
+ * Same as ni_image_blur_gaussian_fixed_view on every plane of a planar image
+ * (see ni_image_blur_gaussian_planes). dst may be src.
+ */
+ni_planes *ni_image_blur_gaussian_fixed_planes(ni_context *ctx, const ni_planes *src, ni_planes *dst, int kernel_size, double sigma);
+
+/**
+ * Number of box filter passes used by ni_image_blur_gaussian_fast.
+ */
+#define NI_BLUR_FAST_PASSES 3
+
+/**
+ * Applies an approximated Gaussian blur to an image and returns the result on
+ * a new image, that needs to be freed outside.
+ *
+ * The blur is done with NI_BLUR_FAST_PASSES running-sum box filters in each
+ * direction, so the cost per pixel is constant regardless of sigma. This is
+ * the speed side of the tradeoff, the accuracy side is:
+ *  -> the box widths are odd integers, so the standard deviation that is
+ *  really applied is only close to sigma. Use ni_image_blur_gaussian_fast_sigma
+ *  to know which one it is (for sigma >= 2 it is off by less than 0.2, which
+ *  is below 1% from sigma 20 on).
+ *  -> the result of three box filters is a piecewise quadratic curve, not a
+ *  true Gaussian, with the tails cut at about 3 sigma. Compared with
+ *  ni_image_blur_gaussian with a kernel of 6 * sigma + 1, pixels differ by
+ *  up to 6 levels from sigma 5 to 60, 9 at sigma 3 and 15 at sigma 2, where
+ *  the boxes are narrowest. These are the worst cases measured on flat,
+ *  smooth, noisy, step and checkerboard images, the checkerboards with cells
+ *  of about 2 sigma being the hardest; away from the edges, smooth content
+ *  stays within 1 level.
+ *  -> below sigma 0.58 every box would be one pixel wide, so nothing would
+ *  be blurred: the function returns NULL.
+ *
+ * The pixels outside of the image count as zero, as with NI_BORDER_ZERO in
+ * ni_image_blur_gaussian, and the box filters run on the image padded by
+ * their reach, so the edges darken the same way instead of once per pass.
+ *
+ * With NI_PRECISION_FLOAT the intermediate image is stored as floats (the
+ * running sums stay in double), so individual pixels can differ by one level
+ * from the NI_PRECISION_DOUBLE result.
+ *
+ * const stbi_uc *img_data -> data of the original image
+ * int w -> original image width
+ * int h -> original image height
+ * int n_channels -> number of channels of the original image
+ * double sigma -> standard deviation of the gaussian distribution.
+ *
+ * returns a new stbi_uc array which represents the blurred image or NULL on error.
+ *
+ * Error conditions:
+ *  -> sigma <= 0.577, too small for any box to be wider than one pixel
+ *  -> the image or its temporary buffers could not be allocated
+ */
+stbi_uc *ni_image_blur_gaussian_fast(const stbi_uc *img_data, int w, int h, int n_channels, double sigma);
 
 /**
- * Creates a Gaussian Kernel as an array of doubles. The kernel size needs to be
- * odd. This function is meant to be used only internally and the resulting
- * array needs to be freed outside.
+ * Same as ni_image_blur_gaussian_fast but with an output image and a
+ * scratch owned by the caller (see ni_image_blur_gaussian_into).
+ *
+ * stbi_uc *out -> output image of w * h * n_channels bytes, may be img_data
+ * void *scratch -> scratch memory, may be NULL
+ * size_t scratch_size -> size of the scratch memory in bytes
+ *
+ * returns out or NULL on error.
+ */
+stbi_uc *ni_image_blur_gaussian_fast_into(const stbi_uc *img_data, int w, int h, int n_channels, double sigma, stbi_uc *out, void *scratch, size_t scratch_size);
+
+/**
+ * Returns the number of bytes of scratch ni_image_blur_gaussian_fast_into
+ * needs to not allocate anything. It grows with sigma, as the image is
+ * padded by the reach of the box filters (about 3 * sigma on every side).
+ */
+size_t ni_image_blur_gaussian_fast_scratch_size(int w, int h, int n_channels, double sigma);
+
+/**
+ * Same as ni_image_blur_gaussian_fast but with the scratch of a context (see
+ * ni_image_blur_gaussian_ctx).
+ */
+stbi_uc *ni_image_blur_gaussian_fast_ctx(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, double sigma, stbi_uc *out);
+
+/**
+ * Same as ni_image_blur_gaussian_fast_ctx but on image descriptors (see
+ * ni_image_blur_gaussian_view). dst may be src. The images can be of any
+ * pixel type, as long as both have the same one.
+ */
+ni_image *ni_image_blur_gaussian_fast_view(ni_context *ctx, const ni_image *src, ni_image *dst, double sigma);
+
+/**
+ * Same as ni_image_blur_gaussian_fast_view on every plane of a planar image
+ * (see ni_image_blur_gaussian_planes). dst may be src.
+ */
+ni_planes *ni_image_blur_gaussian_fast_planes(ni_context *ctx, const ni_planes *src, ni_planes *dst, double sigma);
+
+/**
+ * Returns the standard deviation that ni_image_blur_gaussian_fast really
+ * applies when it is asked for sigma, which is the accuracy it trades for
+ * speed.
+ *
+ * double sigma -> requested standard deviation of the gaussian distribution.
+ *
+ * returns the effective standard deviation, or 0.0 if sigma is too small
+ * for any box to be wider than one pixel (sigma <= 0.577)
+ */
+double ni_image_blur_gaussian_fast_sigma(double sigma);
+
+/**
+ * Applies Gaussian blur to an image with a recursive (IIR) filter and returns
+ * the result on a new image, that needs to be freed outside.
+ *
+ * It uses the third order Young - van Vliet approximation of the Gaussian,
+ * applied as a causal and an anti-causal pass on every row and every column,
+ * with the poles scaled so the variance of the filter is exactly sigma^2.
+ * There is no kernel, so the cost per pixel is constant regardless of sigma.
+ * Away from the borders and for sigma >= 1.5, the result is within one
+ * level of ni_image_blur_gaussian (with a kernel of 10 * sigma + 1) on
+ * smooth images and within two on sharp steps and fine checkerboards. Below
+ * that the approximation gets coarser (up to 6 levels on noise at sigma
+ * 1). The image is extended with its edge pixels, using the Triggs - Sdika
+ * initialization for the anti-causal pass, so there is no darkening on the
+ * borders. The recursion always runs in double precision, whatever the
+ * NI_PRECISION: its poles are close to 1 for large sigmas, and in float the
+ * rounding errors of the feedback would build up along every row.
+ *
+ * const stbi_uc *img_data -> data of the original image
+ * int w -> original image width
+ * int h -> original image height
+ * int n_channels -> number of channels of the original image
+ * double sigma -> standard deviation of the gaussian distribution.
+ *
+ * returns a new stbi_uc array which represents the blurred image or NULL on error.
+ *
+ * Error conditions:
+ *  -> sigma < 0.5
+ *  -> w or h are not positive
+ *  -> the image or its temporary buffers could not be allocated
+ */
+stbi_uc *ni_image_blur_gaussian_recursive(const stbi_uc *img_data, int w, int h, int n_channels, double sigma);
+
+/**
+ * Same as ni_image_blur_gaussian_recursive but with an output image and a
+ * scratch owned by the caller (see ni_image_blur_gaussian_into).
+ *
+ * stbi_uc *out -> output image of w * h * n_channels bytes, may be img_data
+ * void *scratch -> scratch memory, may be NULL
+ * size_t scratch_size -> size of the scratch memory in bytes
+ *
+ * returns out or NULL on error.
+ */
+stbi_uc *ni_image_blur_gaussian_recursive_into(const stbi_uc *img_data, int w, int h, int n_channels, double sigma, stbi_uc *out, void *scratch, size_t scratch_size);
+
+/**
+ * Returns the number of bytes of scratch
+ * ni_image_blur_gaussian_recursive_into needs to not allocate anything, for
+ * any sigma.
+ */
+size_t ni_image_blur_gaussian_recursive_scratch_size(int w, int h, int n_channels);
+
+/**
+ * Same as ni_image_blur_gaussian_recursive but with the scratch of a context
+ * (see ni_image_blur_gaussian_ctx).
+ */
+stbi_uc *ni_image_blur_gaussian_recursive_ctx(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, double sigma, stbi_uc *out);
+
+/**
+ * Same as ni_image_blur_gaussian_recursive_ctx but on image descriptors (see
+ * ni_image_blur_gaussian_view). dst may be src. The images can be of any
+ * pixel type, as long as both have the same one.
+ */
+ni_image *ni_image_blur_gaussian_recursive_view(ni_context *ctx, const ni_image *src, ni_image *dst, double sigma);
+
+/**
+ * Same as ni_image_blur_gaussian_recursive_view on every plane of a planar image
+ * (see ni_image_blur_gaussian_planes). dst may be src.
+ */
+ni_planes *ni_image_blur_gaussian_recursive_planes(ni_context *ctx, const ni_planes *src, ni_planes *dst, double sigma);
+
+#ifdef NI_BLUR_IMPLEMENTATION
+
+/**
+ * Creates a 1-dimensional Gaussian kernel as an array of doubles. The 2D
+ * Gaussian kernel is the outer product of this kernel with itself, which is
+ * what allows the blur to be applied as a horizontal pass followed by a
+ * vertical pass. This function is meant to be used only internally and the
+ * resulting array needs to be freed outside.
  *
  * int kernel_size -> size of the kernel to be generated. Needs to be odd.
  * double sigma -> standard deviation of the gaussian distribution.
  *
- * returns a double array of the right size for the kernel. It is always
- * 1-dimensional, and the coordinates can be accessed the same way you would
- * access the coordinates of an image. Returns NULL on error.
+ * returns a double array of kernel_size elements that adds up to 1. Returns
+ * NULL on error.
  *
  * Error conditions:
  *  -> kernel_size % 2 == 0
  */
 double *
-__ni_image_get_gaussian_blur_kernel(int kernel_size, double sigma)
+__ni_image_get_gaussian_blur_kernel_1d(int kernel_size, double sigma)
 {
 	// ERROR: the kernel size is even
 	if(kernel_size % 2 == 0)
 		return NULL;
 
 	double radius = floor(((double)kernel_size) / 2.0);
-	//double sigma = radius / 2.0;
-	//double sigma = 0.84089642;
-
-	double *kernel = ni_data_create(kernel_size, kernel_size, 1);
+	double *kernel = ni_data_create(kernel_size, 1, 1);
+	// ERROR: out of memory
+	if(kernel == NULL)
+		return NULL;
 
 	double sum = 0.0;
-	int idx;
+	double dist;
+	const double d_sigma_squared = 2 * sigma * sigma;
 
-	// Calculate values
-	BEGIN_FOREACH_PIXEL(kernel_size, kernel_size)
-	idx = PX_IDX(__x, __y, kernel_size, 1);
-	kernel[idx] = __ni_image_gaussian_kernel_value(__x, __y, radius, sigma);
-	sum += kernel[idx];
-	END_FOREACH_PIXEL
+	// Calculate values, the constant factor goes away with the normalization
+	for(int i = 0; i < kernel_size; i++) {
+		dist = ((double)i) - radius;
+		kernel[i] = exp(-((dist * dist) / d_sigma_squared));
+		sum += kernel[i];
+	}
 
 	// Normalize in the range [0, 1]
-	BEGIN_FOREACH_PIXEL(kernel_size, kernel_size)
-	idx = PX_IDX(__x, __y, kernel_size, 1);
-	kernel[idx] /= sum;
-	END_FOREACH_PIXEL
+	for(int i = 0; i < kernel_size; i++)
+		kernel[i] /= sum;
 
 	return kernel;
 }
 
-stbi_uc *
-ni_image_blur_gaussian(const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma)
+// clang-format off
+/**
+ * Generates the conversions between the rows of an image of element type
+ * PIX_T and packed normalized data of type DATA_T, that the blurs of
+ * NI_PIXEL_U16 and NI_PIXEL_F32 images use. The loads divide by MAX, and
+ * the stores clamp the values to the [0, 1] interval, multiply them by MAX
+ * and add BIAS before the conversion (0.5 rounds to the nearest integer).
+ * Only intended for internal usage.
+ *
+ * D -> suffix of the data type
+ * DATA_T -> type of the data (double or float)
+ * P -> suffix of the pixel type
+ * PIX_T -> type of the elements of the image
+ * MAX -> value of PIX_T that maps to 1.0
+ * BIAS -> added to the stored values
+ */
+#define __NI_IMAGE_BLUR_CONVERT(D, DATA_T, P, PIX_T, MAX, BIAS) \
+	static void \
+	__ni_image_blur_load_##D##_##P(const ni_image *img, DATA_T *data) \
+	{ \
+		const size_t row_len = (size_t)img->w * img->n_channels; \
+		const PIX_T *in; \
+		for(int y = 0; y < img->h; y++, data += row_len) { \
+			in = ni_image_row(img, y); \
+			for(size_t i = 0; i < row_len; i++) \
+				data[i] = (DATA_T)in[i] / (DATA_T)(MAX); \
+		} \
+	} \
+	static void \
+	__ni_image_blur_store_##D##_##P(const DATA_T *data, ni_image *img) \
+	{ \
+		const size_t row_len = (size_t)img->w * img->n_channels; \
+		PIX_T *out; \
+		DATA_T v; \
+		for(int y = 0; y < img->h; y++, data += row_len) { \
+			out = ni_image_row(img, y); \
+			for(size_t i = 0; i < row_len; i++) { \
+				v = (data[i] < 0) ? 0 : (data[i] > 1) ? 1 : data[i]; \
+				out[i] = (PIX_T)(v * (DATA_T)(MAX) + (DATA_T)(BIAS)); \
+			} \
+		} \
+	}
+// clang-format on
+
+__NI_IMAGE_BLUR_CONVERT(f64, double, u16, uint16_t, UINT16_MAX, 0.5)
+__NI_IMAGE_BLUR_CONVERT(f64, double, f32, float, 1, 0)
+__NI_IMAGE_BLUR_CONVERT(f32, float, u16, uint16_t, UINT16_MAX, 0.5)
+__NI_IMAGE_BLUR_CONVERT(f32, float, f32, float, 1, 0)
+
+/**
+ * Converts image data into normalized floating point data, packing the
+ * rows. Only intended for internal usage.
+ *
+ * const ni_image *img -> the original image, of any pixel type
+ * double *data -> destination data array, w * h * n_channels doubles
+ */
+static void
+__ni_image_blur_load(const ni_image *img, double *data)
 {
-	// ERROR: the kernel size is even
-	if(kernel_size % 2 == 0)
-		return NULL;
+	const size_t row_len = (size_t)img->w * img->n_channels;
+	switch(img->type) {
+	case(NI_PIXEL_U16):
+		__ni_image_blur_load_f64_u16(img, data);
+		break;
+	case(NI_PIXEL_F32):
+		__ni_image_blur_load_f64_f32(img, data);
+		break;
+	default:
+		for(int y = 0; y < img->h; y++)
+			ni_simd_u8_to_data(ni_image_row(img, y), data + y * row_len, row_len);
+		break;
+	}
+}
 
-	double *kernel = __ni_image_get_gaussian_blur_kernel(kernel_size, sigma);
-	// Kernel could not be created
+/**
+ * Converts packed normalized floating point data back into image data,
+ * clamping the values to the [0, 1] interval. Only intended for internal
+ * usage.
+ *
+ * const double *data -> source data array, w * h * n_channels doubles
+ * ni_image *img -> destination image, of any pixel type
+ */
+static void
+__ni_image_blur_store(const double *data, ni_image *img)
+{
+	const size_t row_len = (size_t)img->w * img->n_channels;
+	switch(img->type) {
+	case(NI_PIXEL_U16):
+		__ni_image_blur_store_f64_u16(data, img);
+		break;
+	case(NI_PIXEL_F32):
+		__ni_image_blur_store_f64_f32(data, img);
+		break;
+	default:
+		for(int y = 0; y < img->h; y++)
+			ni_simd_data_to_u8(data + y * row_len, ni_image_row(img, y), row_len);
+		break;
+	}
+}
+
+/**
+ * Same as __ni_image_blur_load in single precision. Only intended for
+ * internal usage.
+ */
+static void
+__ni_image_blur_load_f32(const ni_image *img, float *data)
+{
+	const size_t row_len = (size_t)img->w * img->n_channels;
+	switch(img->type) {
+	case(NI_PIXEL_U16):
+		__ni_image_blur_load_f32_u16(img, data);
+		break;
+	case(NI_PIXEL_F32):
+		__ni_image_blur_load_f32_f32(img, data);
+		break;
+	default:
+		for(int y = 0; y < img->h; y++)
+			ni_simd_u8_to_f32(ni_image_row(img, y), data + y * row_len, row_len);
+		break;
+	}
+}
+
+/**
+ * Same as __ni_image_blur_store in single precision. Only intended for
+ * internal usage.
+ */
+static void
+__ni_image_blur_store_f32(const float *data, ni_image *img)
+{
+	const size_t row_len = (size_t)img->w * img->n_channels;
+	switch(img->type) {
+	case(NI_PIXEL_U16):
+		__ni_image_blur_store_f32_u16(data, img);
+		break;
+	case(NI_PIXEL_F32):
+		__ni_image_blur_store_f32_f32(data, img);
+		break;
+	default:
+		for(int y = 0; y < img->h; y++)
+			ni_simd_f32_to_u8(data + y * row_len, ni_image_row(img, y), row_len);
+		break;
+	}
+}
+
+/**
+ * Creates a 1-dimensional Gaussian kernel quantized to fixed point with
+ * NI_BLUR_FIXED_KERNEL_BITS fractional bits. The rounding error is moved to
+ * the central tap so the kernel adds up to exactly one. This function is
+ * meant to be used only internally and the resulting array needs to be freed
+ * outside.
+ *
+ * int kernel_size -> size of the kernel to be generated. Needs to be odd.
+ * double sigma -> standard deviation of the gaussian distribution.
+ *
+ * returns an int16_t array of kernel_size elements or NULL on error.
+ *
+ * Error conditions:
+ *  -> kernel_size % 2 == 0
+ */
+int16_t *
+__ni_image_get_gaussian_blur_kernel_fixed(int kernel_size, double sigma)
+{
+	double *kernel = __ni_image_get_gaussian_blur_kernel_1d(kernel_size, sigma);
 	if(kernel == NULL)
 		return NULL;
 
-#ifdef NI_BLUR_DEBUG
-	fprintf(stdout, "[DEBUG] - ni_image_blur_gaussian kernel\n");
-	printad(kernel, kernel_size, kernel_size, 1);
-#endif
+	const int one = 1 << NI_BLUR_FIXED_KERNEL_BITS;
+	int16_t *fixed = ni_alloc(kernel_size * sizeof(int16_t));
+	// ERROR: out of memory
+	if(fixed == NULL) {
+		ni_free(kernel);
+		return NULL;
+	}
+	int sum = 0;
+	for(int i = 0; i < kernel_size; i++) {
+		fixed[i] = (int16_t)round(kernel[i] * one);
+		sum += fixed[i];
+	}
+	fixed[kernel_size / 2] += one - sum;
 
-	int convolution_radius = (int)floor(((double)kernel_size) / 2.0);
+	ni_free(kernel);
+	return fixed;
+}
 
-	// -- CONVERT TO DATA --
-	double *data = ni_data_create(w, h, n_channels);
-	int idx;
-	double nd_val;
-	BEGIN_FOREACH_CHANNEL(n_channels)
-	BEGIN_FOREACH_PIXEL(w, h)
-	idx = PX_IDX(__x, __y, w, n_channels);
-	nd_val = ni_stbi_uc_normalize(img_data[idx + __c]);
-	data[idx + __c] = nd_val;
-	END_FOREACH_PIXEL
-	END_FOREACH_CHANNEL
-
-	// -- CONVOLVE --
-	double *new_data = ni_data_create(w, h, n_channels);
-	int kernel_idx, c_idx;
-	double sum, n_value;
-	BEGIN_FOREACH_CHANNEL(n_channels)
-	BEGIN_FOREACH_PIXEL(w, h)
-	idx = PX_IDX(__x, __y, w, n_channels);
-	sum = 0.0;
-	BEGIN_FOREACH_STEP(convolution_radius)
-	if(PX_VALID(__x + __sx, __y + __sy, w, h)) {
-		c_idx = PX_IDX(__x + __sx, __y + __sy, w, n_channels);
-		kernel_idx = PX_IDX(convolution_radius + __sx, convolution_radius + __sy, kernel_size, 1);
-		n_value = data[c_idx + __c] * kernel[kernel_idx];
-		sum += n_value;
-	}
-	END_FOREACH_STEP
-	new_data[idx + __c] = ni_image_data_clamp(sum);
-	END_FOREACH_PIXEL
-	END_FOREACH_CHANNEL
+/**
+ * Kernel cache constructors for the Gaussian kernels. Only intended for
+ * internal usage.
+ */
+static void *
+__ni_image_gaussian_kernel_create(int kernel_size, double sigma)
+{
+	return __ni_image_get_gaussian_blur_kernel_1d(kernel_size, sigma);
+}
 
-	// -- CONVERT BACK TO IMAGE --
-	stbi_uc *img = ni_image_create(w, h, n_channels);
-	stbi_uc nuc_val;
-	BEGIN_FOREACH_CHANNEL(n_channels)
-	BEGIN_FOREACH_PIXEL(w, h)
-	idx = PX_IDX(__x, __y, w, n_channels);
-	nuc_val = ni_stbi_uc_unnormalize(new_data[idx + __c]);
-	img[idx + __c] = nuc_val;
-	END_FOREACH_PIXEL
-	END_FOREACH_CHANNEL
-
-	free(kernel);
-	free(data);
-	free(new_data);
-	return img;
+static void *
+__ni_image_gaussian_kernel_fixed_create(int kernel_size, double sigma)
+{
+	return __ni_image_get_gaussian_blur_kernel_fixed(kernel_size, sigma);
+}
+
+void
+ni_image_blur_gaussian_prewarm(int kernel_size, double sigma)
+{
+	// ERROR: the kernel size is even
+	if(kernel_size % 2 == 0)
+		return;
+
+	ni_kernel_cache *cache = ni_kernel_cache_default();
+	ni_kernel_cache_release(cache, ni_kernel_cache_acquire(cache, NI_KERNEL_GAUSSIAN, kernel_size, sigma, __ni_image_gaussian_kernel_create));
+	ni_kernel_cache_release(cache, ni_kernel_cache_acquire(cache, NI_KERNEL_GAUSSIAN_FIXED, kernel_size, sigma, __ni_image_gaussian_kernel_fixed_create));
+}
+
+stbi_uc *
+ni_image_blur_gaussian(const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma)
+{
+	return ni_image_blur_gaussian_border(img_data, w, h, n_channels, kernel_size, sigma, NI_BORDER_ZERO);
+}
+
+stbi_uc *
+ni_image_blur_gaussian_border(const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma, NI_IMAGE_BORDER border)
+{
+	stbi_uc *img = ni_image_create(w, h, n_channels);
+	if(ni_image_blur_gaussian_into(img_data, w, h, n_channels, kernel_size, sigma, border, img, NULL, 0) == NULL) {
+		ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+/**
+ * Gaussian blur with the thread pool and the kernel cache of a context,
+ * that ni_image_blur_gaussian_into and ni_image_blur_gaussian_ctx share.
+ * Only intended for internal usage.
+ *
+ * ni_context *ctx -> the context, NULL uses the defaults
+ * const ni_image *src -> the original image (8 bits)
+ * ni_image *dst -> output image of the same size
+ * ni_scratch *scratch -> scratch for the temporary buffers
+ *
+ * returns dst or NULL on error.
+ */
+static ni_image *
+__ni_image_blur_gaussian_apply(ni_context *ctx, const ni_image *src, ni_image *dst, int kernel_size, double sigma, NI_IMAGE_BORDER border, ni_scratch *scratch)
+{
+	// ERROR: the kernel size is even
+	if(kernel_size % 2 == 0)
+		return NULL;
+
+	// The Gaussian kernel is separable, so the k x k convolution is done as
+	// a horizontal pass followed by a vertical pass: O(k) per pixel.
+	ni_kernel_cache *cache = ni_context_kernel_cache(ctx);
+	const double *kernel = ni_kernel_cache_acquire(cache, NI_KERNEL_GAUSSIAN, kernel_size, sigma, __ni_image_gaussian_kernel_create);
+	// Kernel could not be created
+	if(kernel == NULL)
+		return NULL;
+
+#ifdef NI_BLUR_DEBUG
+	fprintf(stdout, "[DEBUG] - ni_image_blur_gaussian kernel\n");
+	printad(kernel, kernel_size, 1, 1);
+#endif
+
+	// The Gaussian kernel is its own row and column factor
+	const int ok = __ni_image_convolve_separable(ni_context_threadpool(ctx), src, dst, kernel, kernel_size, kernel, kernel_size, border, ni_context_precision(ctx), scratch);
+
+	ni_kernel_cache_release(cache, kernel);
+	// ERROR: out of memory
+	return ok ? dst : NULL;
+}
+
+size_t
+ni_image_blur_gaussian_scratch_size(int w, int h, int n_channels, int kernel_size, NI_IMAGE_BORDER border)
+{
+	// ERROR: the kernel size is even
+	if(kernel_size % 2 == 0)
+		return 0;
+	return NI_SCRATCH_ALIGNMENT + __ni_image_convolve_separable_scratch(ni_threadpool_default(), w, h, n_channels, kernel_size, kernel_size, border, NI_DEFAULT_PRECISION);
+}
+
+stbi_uc *
+ni_image_blur_gaussian_into(const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma, NI_IMAGE_BORDER border, stbi_uc *out, void *scratch, size_t scratch_size)
+{
+	// ERROR: no output
+	if(out == NULL)
+		return NULL;
+
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(out, w, h, n_channels, NI_PIXEL_U8);
+	ni_scratch s = ni_scratch_init(scratch, scratch_size);
+	if(__ni_image_blur_gaussian_apply(NULL, &src, &dst, kernel_size, sigma, border, &s) == NULL)
+		return NULL;
+	return out;
+}
+
+stbi_uc *
+ni_image_blur_gaussian_ctx(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma, NI_IMAGE_BORDER border, stbi_uc *out)
+{
+	stbi_uc *img = (out == NULL) ? ni_image_create(w, h, n_channels) : out;
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(img, w, h, n_channels, NI_PIXEL_U8);
+	if(ni_image_blur_gaussian_view(ctx, &src, &dst, kernel_size, sigma, border) == NULL) {
+		if(out == NULL)
+			ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+ni_image *
+ni_image_blur_gaussian_view(ni_context *ctx, const ni_image *src, ni_image *dst, int kernel_size, double sigma, NI_IMAGE_BORDER border)
+{
+	// ERROR: the kernel size is even
+	if(kernel_size % 2 == 0)
+		return NULL;
+	// ERROR: the images do not match
+	if(!__ni_image_views_match(src, dst, src->n_channels))
+		return NULL;
+
+	ni_scratch s = ni_context_scratch_begin(ctx, NI_SCRATCH_ALIGNMENT + __ni_image_convolve_separable_scratch(ni_context_threadpool(ctx), src->w, src->h, src->n_channels, kernel_size, kernel_size, border, ni_context_precision(ctx)));
+	ni_image *res = __ni_image_blur_gaussian_apply(ctx, src, dst, kernel_size, sigma, border, &s);
+	ni_context_scratch_end(ctx, &s);
+	return res;
+}
+
+ni_planes *
+ni_image_blur_gaussian_planes(ni_context *ctx, const ni_planes *src, ni_planes *dst, int kernel_size, double sigma, NI_IMAGE_BORDER border)
+{
+	// ERROR: the number of planes does not match
+	if(src->n_planes != dst->n_planes)
+		return NULL;
+
+	for(int c = 0; c < src->n_planes; c++)
+		if(ni_image_blur_gaussian_view(ctx, &src->plane[c], &dst->plane[c], kernel_size, sigma, border) == NULL)
+			return NULL;
+	return dst;
+}
+
+stbi_uc *
+ni_image_blur_gaussian_fixed(const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma)
+{
+	stbi_uc *img = ni_image_create(w, h, n_channels);
+	if(ni_image_blur_gaussian_fixed_into(img_data, w, h, n_channels, kernel_size, sigma, img, NULL, 0) == NULL) {
+		ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+size_t
+ni_image_blur_gaussian_fixed_scratch_size(int w, int h, int n_channels, int kernel_size)
+{
+	// ERROR: the kernel size is even
+	if(kernel_size % 2 == 0)
+		return 0;
+	// Enough for the kernel before the zero taps are trimmed
+	const size_t row_len = (size_t)w * n_channels;
+	return NI_SCRATCH_ALIGNMENT + ni_scratch_reserve(row_len * h * sizeof(int16_t)) + ni_scratch_reserve((row_len + (size_t)(kernel_size - 1) * n_channels) * sizeof(int16_t));
+}
+
+/**
+ * Fixed point Gaussian blur with the kernel cache of a context, that
+ * ni_image_blur_gaussian_fixed_into and ni_image_blur_gaussian_fixed_ctx
+ * share. Only intended for internal usage.
+ *
+ * ni_context *ctx -> the context, NULL uses the defaults
+ * const ni_image *src -> the original image (8 bits)
+ * ni_image *dst -> output image of the same size
+ * ni_scratch *scratch -> scratch for the temporary buffers
+ *
+ * returns dst or NULL on error.
+ */
+static ni_image *
+__ni_image_blur_gaussian_fixed_apply(ni_context *ctx, const ni_image *src, ni_image *dst, int kernel_size, double sigma, ni_scratch *scratch)
+{
+	// ERROR: the kernel size is even
+	if(kernel_size % 2 == 0)
+		return NULL;
+
+	const int w = src->w;
+	const int h = src->h;
+	const int n_channels = src->n_channels;
+
+	ni_kernel_cache *cache = ni_context_kernel_cache(ctx);
+	const int16_t *kernel = ni_kernel_cache_acquire(cache, NI_KERNEL_GAUSSIAN_FIXED, kernel_size, sigma, __ni_image_gaussian_kernel_fixed_create);
+	// Kernel could not be created
+	if(kernel == NULL)
+		return NULL;
+
+	// The kernel is symmetric and the taps that quantize to zero do nothing,
+	// so they are trimmed from both ends
+	int radius = kernel_size / 2;
+	const int16_t *taps = kernel;
+	while(radius > 0 && taps[0] == 0) {
+		taps++;
+		radius--;
+	}
+	const int n_taps = 2 * radius + 1;
+
+	const int pad = radius * n_channels;
+	const int row_len = w * n_channels;
+	int16_t *data = ni_scratch_alloc(scratch, (size_t)row_len * h * sizeof(int16_t));
+	int16_t *line = ni_scratch_alloc(scratch, (size_t)(row_len + 2 * pad) * sizeof(int16_t));
+	const stbi_uc *in;
+	int from, to;
+
+	// ERROR: out of memory
+	if(data == NULL || line == NULL) {
+		ni_kernel_cache_release(cache, kernel);
+		ni_scratch_free(scratch, data);
+		ni_scratch_free(scratch, line);
+		return NULL;
+	}
+
+	// -- HORIZONTAL --
+	// Bytes in, NI_BLUR_FIXED_DATA_BITS fractional bits out
+	for(int i = 0; i < pad; i++) {
+		line[i] = 0;
+		line[pad + row_len + i] = 0;
+	}
+	for(int __y = 0; __y < h; __y++) {
+		in = ni_image_row(src, __y);
+		for(int i = 0; i < row_len; i++)
+			line[pad + i] = in[i];
+		ni_simd_convolve_i16(line, data + PX_IDX(0, __y, w, n_channels), row_len, n_channels, taps, n_taps, NI_BLUR_FIXED_KERNEL_BITS - NI_BLUR_FIXED_DATA_BITS);
+	}
+
+	// -- VERTICAL --
+	// All the fractional bits go away here, rounding to the nearest byte
+	for(int __y = 0; __y < h; __y++) {
+		from = (__y < radius) ? -__y : -radius;
+		to = (__y + radius >= h) ? h - 1 - __y : radius;
+		ni_simd_convolve_i16_u8(data + PX_IDX(0, __y + from, w, n_channels), ni_image_row(dst, __y), row_len, row_len, taps + radius + from, to - from + 1, NI_BLUR_FIXED_KERNEL_BITS + NI_BLUR_FIXED_DATA_BITS);
+	}
+
+	ni_kernel_cache_release(cache, kernel);
+	ni_scratch_free(scratch, data);
+	ni_scratch_free(scratch, line);
+	return dst;
+}
+
+stbi_uc *
+ni_image_blur_gaussian_fixed_into(const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma, stbi_uc *out, void *scratch, size_t scratch_size)
+{
+	// ERROR: no output
+	if(out == NULL)
+		return NULL;
+
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(out, w, h, n_channels, NI_PIXEL_U8);
+	ni_scratch s = ni_scratch_init(scratch, scratch_size);
+	if(__ni_image_blur_gaussian_fixed_apply(NULL, &src, &dst, kernel_size, sigma, &s) == NULL)
+		return NULL;
+	return out;
+}
+
+stbi_uc *
+ni_image_blur_gaussian_fixed_ctx(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, int kernel_size, double sigma, stbi_uc *out)
+{
+	stbi_uc *img = (out == NULL) ? ni_image_create(w, h, n_channels) : out;
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(img, w, h, n_channels, NI_PIXEL_U8);
+	if(ni_image_blur_gaussian_fixed_view(ctx, &src, &dst, kernel_size, sigma) == NULL) {
+		if(out == NULL)
+			ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+ni_image *
+ni_image_blur_gaussian_fixed_view(ni_context *ctx, const ni_image *src, ni_image *dst, int kernel_size, double sigma)
+{
+	// ERROR: the kernel size is even
+	if(kernel_size % 2 == 0)
+		return NULL;
+	// ERROR: the images do not match
+	if(!__ni_image_views_match(src, dst, src->n_channels))
+		return NULL;
+
+	ni_scratch s = ni_context_scratch_begin(ctx, ni_image_blur_gaussian_fixed_scratch_size(src->w, src->h, src->n_channels, kernel_size));
+	ni_image *res = __ni_image_blur_gaussian_fixed_apply(ctx, src, dst, kernel_size, sigma, &s);
+	ni_context_scratch_end(ctx, &s);
+	return res;
+}
+
+ni_planes *
+ni_image_blur_gaussian_fixed_planes(ni_context *ctx, const ni_planes *src, ni_planes *dst, int kernel_size, double sigma)
+{
+	// ERROR: the number of planes does not match
+	if(src->n_planes != dst->n_planes)
+		return NULL;
+
+	for(int c = 0; c < src->n_planes; c++)
+		if(ni_image_blur_gaussian_fixed_view(ctx, &src->plane[c], &dst->plane[c], kernel_size, sigma) == NULL)
+			return NULL;
+	return dst;
+}
+
+/**
+ * Calculates the widths of the box filters that approximate a Gaussian
+ * distribution of the given standard deviation. Only intended for internal
+ * usage.
+ *
+ * double sigma -> standard deviation of the gaussian distribution.
+ * int *sizes -> output array of NI_BLUR_FAST_PASSES odd widths
+ */
+static void
+__ni_image_blur_box_sizes(double sigma, int *sizes)
+{
+	const int n = NI_BLUR_FAST_PASSES;
+	// n boxes of width wd have a variance of n * (wd^2 - 1) / 12
+	const double w_ideal = sqrt((12.0 * sigma * sigma / n) + 1.0);
+	int wl = (int)floor(w_ideal);
+	if(wl % 2 == 0)
+		wl--;
+	const int wu = wl + 2;
+	// Number of passes that use the lower width
+	const double m_ideal = ((12.0 * sigma * sigma) - (n * wl * wl) - (4.0 * n * wl) - (3.0 * n)) / ((-4.0 * wl) - 4.0);
+	const int m = (int)round(m_ideal);
+
+	for(int i = 0; i < n; i++)
+		sizes[i] = (i < m) ? wl : wu;
+}
+
+// clang-format off
+/**
+ * Generates a box filter on the rows of a data array of element type T,
+ * with a running sum per channel. The values outside of the image count as
+ * zero, like in the convolution, and the sums are kept in double precision
+ * so they do not drift along the row. NAME##_kernel walks every row once
+ * for up to four channels at a time, and NAME specialises it for 1 to 4
+ * channels so the channel loops are unrolled. Only intended for internal
+ * usage.
+ *
+ * NAME -> name of the generated function
+ * T -> type of the data (double or float)
+ *
+ * The generated function takes:
+ * const T *src -> source data array
+ * T *dst -> destination data array, same size as src
+ * int w -> width of the data
+ * int h -> height of the data
+ * int n_channels -> number of channels of the data
+ * int box_size -> width of the box (odd)
+ */
+#define __NI_IMAGE_BOX_ROWS(NAME, T) \
+	NI_SPECIALIZED void \
+	NAME##_kernel(const T *src, T *dst, int w, int h, int box_size, int n_channels) \
+	{ \
+		const int radius = box_size / 2; \
+		const double scale = 1.0 / box_size; \
+		const T *in; \
+		T *out; \
+		double sum[4]; \
+		int n, x; \
+		for(int __y = 0; __y < h; __y++) { \
+			for(int c0 = 0; c0 < n_channels; c0 += 4) { \
+				n = (n_channels - c0 < 4) ? n_channels - c0 : 4; \
+				in = src + PX_IDX(0, __y, w, n_channels) + c0; \
+				out = dst + PX_IDX(0, __y, w, n_channels) + c0; \
+				for(int c = 0; c < n; c++) \
+					sum[c] = 0.0; \
+				for(x = 0; x < radius && x < w; x++) \
+					for(int c = 0; c < n; c++) \
+						sum[c] += in[x * n_channels + c]; \
+				/* The row is split where the box enters and leaves it, */ \
+				/* so the loop over the middle has no branches */ \
+				x = 0; \
+				for(; x < w && x < radius; x++) { \
+					if(x + radius < w) \
+						for(int c = 0; c < n; c++) \
+							sum[c] += in[(x + radius) * n_channels + c]; \
+					for(int c = 0; c < n; c++) \
+						out[x * n_channels + c] = (T)(sum[c] * scale); \
+				} \
+				for(; x + radius < w; x++) { \
+					for(int c = 0; c < n; c++) { \
+						sum[c] += in[(x + radius) * n_channels + c]; \
+						out[x * n_channels + c] = (T)(sum[c] * scale); \
+						sum[c] -= in[(x - radius) * n_channels + c]; \
+					} \
+				} \
+				for(; x < w; x++) { \
+					for(int c = 0; c < n; c++) { \
+						out[x * n_channels + c] = (T)(sum[c] * scale); \
+						sum[c] -= in[(x - radius) * n_channels + c]; \
+					} \
+				} \
+			} \
+		} \
+	} \
+	static void \
+	NAME(const T *src, T *dst, int w, int h, int n_channels, int box_size) \
+	{ \
+		NI_SWITCH_CHANNELS(n_channels, NAME##_kernel, src, dst, w, h, box_size) \
+	}
+// clang-format on
+
+__NI_IMAGE_BOX_ROWS(__ni_image_box_rows, double)
+__NI_IMAGE_BOX_ROWS(__ni_image_box_rows_f32, float)
+
+/**
+ * Applies a box filter to every column of a data array with a running sum.
+ * The values outside of the image count as zero, like in the convolution.
+ * Only intended for internal usage.
+ *
+ * const double *src -> source data array
+ * double *dst -> destination data array, same size as src
+ * double *acc -> scratch array of w * n_channels elements
+ * int w -> width of the data
+ * int h -> height of the data
+ * int n_channels -> number of channels of the data
+ * int box_size -> width of the box (odd)
+ */
+static void
+__ni_image_box_cols(const double *src, double *dst, double *acc, int w, int h, int n_channels, int box_size)
+{
+	const int radius = box_size / 2;
+	const int row_len = w * n_channels;
+	const double scale = 1.0 / box_size;
+	const double *in;
+	double *out;
+
+	// The running sums of all the columns are kept in acc, so the image is
+	// walked one row at a time
+	for(int i = 0; i < row_len; i++)
+		acc[i] = 0.0;
+	for(int y = 0; y < radius && y < h; y++) {
+		in = src + PX_IDX(0, y, w, n_channels);
+		for(int i = 0; i < row_len; i++)
+			acc[i] += in[i];
+	}
+	for(int __y = 0; __y < h; __y++) {
+		if(__y + radius < h) {
+			in = src + PX_IDX(0, __y + radius, w, n_channels);
+			for(int i = 0; i < row_len; i++)
+				acc[i] += in[i];
+		}
+		out = dst + PX_IDX(0, __y, w, n_channels);
+		for(int i = 0; i < row_len; i++)
+			out[i] = acc[i] * scale;
+		if(__y - radius >= 0) {
+			in = src + PX_IDX(0, __y - radius, w, n_channels);
+			for(int i = 0; i < row_len; i++)
+				acc[i] -= in[i];
+		}
+	}
+}
+
+/**
+ * Same as __ni_image_box_cols on single precision data, with the running
+ * sums in double precision. Only intended for internal usage.
+ */
+static void
+__ni_image_box_cols_f32(const float *src, float *dst, double *acc, int w, int h, int n_channels, int box_size)
+{
+	const int radius = box_size / 2;
+	const int row_len = w * n_channels;
+	const double scale = 1.0 / box_size;
+	const float *in;
+	float *out;
+
+	for(int i = 0; i < row_len; i++)
+		acc[i] = 0.0;
+	for(int y = 0; y < radius && y < h; y++) {
+		in = src + PX_IDX(0, y, w, n_channels);
+		for(int i = 0; i < row_len; i++)
+			acc[i] += in[i];
+	}
+	for(int __y = 0; __y < h; __y++) {
+		if(__y + radius < h) {
+			in = src + PX_IDX(0, __y + radius, w, n_channels);
+			for(int i = 0; i < row_len; i++)
+				acc[i] += in[i];
+		}
+		out = dst + PX_IDX(0, __y, w, n_channels);
+		for(int i = 0; i < row_len; i++)
+			out[i] = (float)(acc[i] * scale);
+		if(__y - radius >= 0) {
+			in = src + PX_IDX(0, __y - radius, w, n_channels);
+			for(int i = 0; i < row_len; i++)
+				acc[i] -= in[i];
+		}
+	}
+}
+
+double
+ni_image_blur_gaussian_fast_sigma(double sigma)
+{
+	if(sigma <= 0)
+		return 0.0;
+
+	int sizes[NI_BLUR_FAST_PASSES];
+	__ni_image_blur_box_sizes(sigma, sizes);
+
+	// The variances of the passes add up
+	double variance = 0.0;
+	for(int i = 0; i < NI_BLUR_FAST_PASSES; i++)
+		variance += ((double)sizes[i] * sizes[i] - 1.0) / 12.0;
+	return sqrt(variance);
+}
+
+stbi_uc *
+ni_image_blur_gaussian_fast(const stbi_uc *img_data, int w, int h, int n_channels, double sigma)
+{
+	stbi_uc *img = ni_image_create(w, h, n_channels);
+	if(ni_image_blur_gaussian_fast_into(img_data, w, h, n_channels, sigma, img, NULL, 0) == NULL) {
+		ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+/**
+ * Returns the number of pixels the box filters of a sigma reach past a
+ * pixel, the sum of their radii. Only intended for internal usage.
+ */
+static int
+__ni_image_blur_box_reach(const int *sizes)
+{
+	int reach = 0;
+	for(int i = 0; i < NI_BLUR_FAST_PASSES; i++)
+		reach += sizes[i] / 2;
+	return reach;
+}
+
+/**
+ * Returns the number of bytes of scratch __ni_image_blur_gaussian_fast_apply
+ * takes with a precision. Only intended for internal usage.
+ */
+static size_t
+__ni_image_blur_gaussian_fast_scratch(int w, int h, int n_channels, double sigma, NI_PRECISION precision)
+{
+	if(sigma <= 0)
+		return 0;
+
+	int sizes[NI_BLUR_FAST_PASSES];
+	__ni_image_blur_box_sizes(sigma, sizes);
+	const size_t reach = __ni_image_blur_box_reach(sizes);
+	const size_t elem_size = (precision == NI_PRECISION_FLOAT) ? sizeof(float) : sizeof(double);
+	const size_t data_size = elem_size * w * (h + 2 * reach) * n_channels;
+	const size_t line_size = elem_size * (w + 2 * reach) * n_channels;
+	return NI_SCRATCH_ALIGNMENT + 2 * ni_scratch_reserve(data_size) + 2 * ni_scratch_reserve(line_size) + ni_scratch_reserve(sizeof(double) * w * n_channels);
+}
+
+size_t
+ni_image_blur_gaussian_fast_scratch_size(int w, int h, int n_channels, double sigma)
+{
+	return __ni_image_blur_gaussian_fast_scratch(w, h, n_channels, sigma, NI_DEFAULT_PRECISION);
+}
+
+// clang-format off
+/**
+ * Generates the box filters of the fast blur on data of element type T.
+ * The pixels outside of the image are zero before the first pass, but the
+ * passes spread the image into them, so every pass runs on the image
+ * extended by the reach of the filters (reach pixels on every side): the
+ * rows are filtered in a padded line, and the columns in data with reach
+ * rows of padding above and below. That gives the same result as blurring
+ * an image surrounded by zeros, like ni_image_blur_gaussian with
+ * NI_BORDER_ZERO. Only intended for internal usage.
+ *
+ * NAME -> name of the generated function
+ * T -> type of the data (double or float)
+ * ROWS -> box filter of the rows of T data
+ * COLS -> box filter of the columns of T data
+ *
+ * The generated function takes:
+ * T *data -> the image in rows reach to reach + h - 1, h + 2 * reach rows
+ * T *tmp -> data array of the same size
+ * T *lines -> scratch array of 2 * (w + 2 * reach) * n_channels elements
+ * double *acc -> scratch array of w * n_channels elements
+ * int w -> width of the image
+ * int h -> height of the image
+ * int n_channels -> number of channels of the image
+ * const int *sizes -> the widths of the boxes
+ * int reach -> the sum of the radii of the boxes
+ *
+ * and returns the array that has the result (data or tmp)
+ */
+#define __NI_IMAGE_BOX_BLUR(NAME, T, ROWS, COLS) \
+	static T * \
+	NAME(T *data, T *tmp, T *lines, double *acc, int w, int h, int n_channels, const int *sizes, int reach) \
+	{ \
+		const size_t row_len = (size_t)w * n_channels; \
+		const size_t pad_len = (size_t)reach * n_channels; \
+		const size_t line_len = row_len + 2 * pad_len; \
+		T *line = lines, *other = lines + line_len, *swap; \
+		T *row; \
+		for(int __y = 0; __y < h; __y++) { \
+			row = data + (__y + reach) * row_len; \
+			memset(line, 0, sizeof(T) * pad_len); \
+			memcpy(line + pad_len, row, sizeof(T) * row_len); \
+			memset(line + pad_len + row_len, 0, sizeof(T) * pad_len); \
+			for(int i = 0; i < NI_BLUR_FAST_PASSES; i++) { \
+				ROWS(line, other, w + 2 * reach, 1, n_channels, sizes[i]); \
+				swap = line; \
+				line = other; \
+				other = swap; \
+			} \
+			memcpy(row, line + pad_len, sizeof(T) * row_len); \
+		} \
+		memset(data, 0, sizeof(T) * reach * row_len); \
+		memset(data + (h + reach) * row_len, 0, sizeof(T) * reach * row_len); \
+		for(int i = 0; i < NI_BLUR_FAST_PASSES; i++) { \
+			COLS(data, tmp, acc, w, h + 2 * reach, n_channels, sizes[i]); \
+			swap = data; \
+			data = tmp; \
+			tmp = swap; \
+		} \
+		return data; \
+	}
+// clang-format on
+
+__NI_IMAGE_BOX_BLUR(__ni_image_box_blur, double, __ni_image_box_rows, __ni_image_box_cols)
+__NI_IMAGE_BOX_BLUR(__ni_image_box_blur_f32, float, __ni_image_box_rows_f32, __ni_image_box_cols_f32)
+
+/**
+ * Box filter blur on a scratch, that ni_image_blur_gaussian_fast_into and
+ * ni_image_blur_gaussian_fast_ctx share. Only intended for internal usage.
+ *
+ * const ni_image *src -> the original image (8 bits)
+ * ni_image *dst -> output image of the same size
+ * NI_PRECISION precision -> precision of the intermediate data
+ * ni_scratch *scratch -> scratch for the temporary buffers
+ *
+ * returns dst or NULL on error.
+ */
+static ni_image *
+__ni_image_blur_gaussian_fast_apply(const ni_image *src, ni_image *dst, double sigma, NI_PRECISION precision, ni_scratch *scratch)
+{
+	// ERROR: sigma is not positive
+	if(sigma <= 0)
+		return NULL;
+
+	const int w = src->w;
+	const int h = src->h;
+	const int n_channels = src->n_channels;
+
+	int sizes[NI_BLUR_FAST_PASSES];
+	__ni_image_blur_box_sizes(sigma, sizes);
+	const int reach = __ni_image_blur_box_reach(sizes);
+	// ERROR: every box is one pixel wide, nothing would be blurred
+	if(reach == 0)
+		return NULL;
+
+	const int f32 = (precision == NI_PRECISION_FLOAT);
+	const size_t elem_size = f32 ? sizeof(float) : sizeof(double);
+	const size_t row_len = (size_t)w * n_channels;
+	const size_t data_size = elem_size * row_len * (h + 2 * (size_t)reach);
+	const size_t lines_size = elem_size * 2 * (row_len + 2 * (size_t)reach * n_channels);
+	void *data = ni_scratch_alloc(scratch, data_size);
+	void *tmp = ni_scratch_alloc(scratch, data_size);
+	void *lines = ni_scratch_alloc(scratch, lines_size);
+	double *acc = ni_scratch_alloc(scratch, sizeof(double) * row_len);
+	// ERROR: out of memory
+	if(data == NULL || tmp == NULL || lines == NULL || acc == NULL) {
+		ni_scratch_free(scratch, data);
+		ni_scratch_free(scratch, tmp);
+		ni_scratch_free(scratch, lines);
+		ni_scratch_free(scratch, acc);
+		return NULL;
+	}
+
+	if(f32) {
+		float *res = (float *)data + reach * row_len;
+		__ni_image_blur_load_f32(src, res);
+		res = __ni_image_box_blur_f32(data, tmp, lines, acc, w, h, n_channels, sizes, reach);
+		__ni_image_blur_store_f32(res + reach * row_len, dst);
+	} else {
+		// -- CONVERT TO DATA --
+		double *res = (double *)data + reach * row_len;
+		__ni_image_blur_load(src, res);
+
+		// -- BOX FILTERS --
+		res = __ni_image_box_blur(data, tmp, lines, acc, w, h, n_channels, sizes, reach);
+
+		// -- CONVERT BACK TO IMAGE --
+		__ni_image_blur_store(res + reach * row_len, dst);
+	}
+
+	ni_scratch_free(scratch, data);
+	ni_scratch_free(scratch, tmp);
+	ni_scratch_free(scratch, lines);
+	ni_scratch_free(scratch, acc);
+	return dst;
+}
+
+stbi_uc *
+ni_image_blur_gaussian_fast_into(const stbi_uc *img_data, int w, int h, int n_channels, double sigma, stbi_uc *out, void *scratch, size_t scratch_size)
+{
+	// ERROR: no output
+	if(out == NULL)
+		return NULL;
+
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(out, w, h, n_channels, NI_PIXEL_U8);
+	ni_scratch s = ni_scratch_init(scratch, scratch_size);
+	if(__ni_image_blur_gaussian_fast_apply(&src, &dst, sigma, NI_DEFAULT_PRECISION, &s) == NULL)
+		return NULL;
+	return out;
+}
+
+stbi_uc *
+ni_image_blur_gaussian_fast_ctx(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, double sigma, stbi_uc *out)
+{
+	stbi_uc *img = (out == NULL) ? ni_image_create(w, h, n_channels) : out;
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(img, w, h, n_channels, NI_PIXEL_U8);
+	if(ni_image_blur_gaussian_fast_view(ctx, &src, &dst, sigma) == NULL) {
+		if(out == NULL)
+			ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+ni_image *
+ni_image_blur_gaussian_fast_view(ni_context *ctx, const ni_image *src, ni_image *dst, double sigma)
+{
+	// ERROR: the images do not match
+	if(!__ni_image_views_same(src, dst, src->n_channels))
+		return NULL;
+
+	const NI_PRECISION precision = ni_context_precision(ctx);
+	ni_scratch s = ni_context_scratch_begin(ctx, __ni_image_blur_gaussian_fast_scratch(src->w, src->h, src->n_channels, sigma, precision));
+	ni_image *res = __ni_image_blur_gaussian_fast_apply(src, dst, sigma, precision, &s);
+	ni_context_scratch_end(ctx, &s);
+	return res;
+}
+
+ni_planes *
+ni_image_blur_gaussian_fast_planes(ni_context *ctx, const ni_planes *src, ni_planes *dst, double sigma)
+{
+	// ERROR: the number of planes does not match
+	if(src->n_planes != dst->n_planes)
+		return NULL;
+
+	for(int c = 0; c < src->n_planes; c++)
+		if(ni_image_blur_gaussian_fast_view(ctx, &src->plane[c], &dst->plane[c], sigma) == NULL)
+			return NULL;
+	return dst;
+}
+
+/**
+ * Coefficients of the recursive Gaussian filter. Only intended for internal
+ * usage.
+ *
+ * The causal pass is y[i] = b * x[i] + a[0] * y[i - 1] + a[1] * y[i - 2] +
+ * a[2] * y[i - 3], and the anti-causal one is the same running backwards.
+ * m is the Triggs - Sdika matrix used to initialize the anti-causal pass.
+ */
+typedef struct __ni_image_iir_coefs {
+	double b;
+	double a[3];
+	double m[3][3];
+} __ni_image_iir_coefs;
+
+/**
+ * Returns the variance of the recursive Gaussian filter with a scale q,
+ * which is the sum of d / (1 - d)^2 over the poles d of the causal pass
+ * (the variances of its first order factors), twice for the anti-causal
+ * pass. Only intended for internal usage.
+ *
+ * double q -> scale of the poles
+ * double *a -> if not NULL, the 3 feedback coefficients for the poles
+ */
+static double
+__ni_image_iir_variance(double q, double *a)
+{
+	// Poles of Young, van Vliet and van Ginkel, "Recursive Gabor filtering",
+	// IEEE Trans. Signal Processing, 2002: d^(-1 / q) for d = 1.41650 +-
+	// 1.00829i and 1.86543
+	const double r = pow(sqrt(1.41650 * 1.41650 + 1.00829 * 1.00829), -1.0 / q);
+	const double theta = atan2(1.00829, 1.41650) / q;
+	const double re = r * cos(theta), im = r * sin(theta);
+	const double d = pow(1.86543, -1.0 / q);
+
+	if(a != NULL) {
+		// (1 - p z^-1) (1 - conj(p) z^-1) (1 - d z^-1)
+		a[0] = 2.0 * re + d;
+		a[1] = -(r * r + 2.0 * re * d);
+		a[2] = r * r * d;
+	}
+
+	// The complex pair gives 2 * Re(p / (1 - p)^2)
+	const double ure = 1.0 - re, uim = -im;
+	const double den_re = ure * ure - uim * uim, den_im = 2.0 * ure * uim;
+	const double den = den_re * den_re + den_im * den_im;
+	const double pair = 2.0 * (re * den_re + im * den_im) / den;
+	return 2.0 * (pair + d / ((1.0 - d) * (1.0 - d)));
+}
+
+/**
+ * Calculates the coefficients of the Young - van Vliet recursive Gaussian
+ * filter. The poles are scaled so the variance of the filter is exactly
+ * sigma^2, instead of using the fitted formula of the scale, which leaves
+ * the filter a bit narrower or wider than the Gaussian. Only intended for
+ * internal usage.
+ *
+ * double sigma -> standard deviation of the gaussian distribution (>= 0.5)
+ * __ni_image_iir_coefs *cf -> the calculated coefficients
+ */
+static void
+__ni_image_iir_coefs_create(double sigma, __ni_image_iir_coefs *cf)
+{
+	// The variance grows with q, so it is found by bisection
+	double lo = 0.1, hi = 2.0 * sigma + 2.0, q;
+	for(int i = 0; i < 100; i++) {
+		q = 0.5 * (lo + hi);
+		if(__ni_image_iir_variance(q, NULL) < sigma * sigma)
+			lo = q;
+		else
+			hi = q;
+	}
+	q = 0.5 * (lo + hi);
+
+	double a[3];
+	__ni_image_iir_variance(q, a);
+	const double a1 = a[0], a2 = a[1], a3 = a[2];
+
+	cf->b = 1.0 - (a1 + a2 + a3);
+	cf->a[0] = a1;
+	cf->a[1] = a2;
+	cf->a[2] = a3;
+
+	// Triggs & Sdika, "Boundary conditions for Young - van Vliet recursive
+	// filtering", IEEE Trans. Signal Processing, 2006
+	const double scale = 1.0 / ((1.0 + a1 - a2 + a3) * (1.0 - a1 - a2 - a3) * (1.0 + a2 + (a1 - a3) * a3));
+	cf->m[0][0] = scale * (-a3 * a1 + 1.0 - a3 * a3 - a2);
+	cf->m[0][1] = scale * (a3 + a1) * (a2 + a3 * a1);
+	cf->m[0][2] = scale * a3 * (a1 + a3 * a2);
+	cf->m[1][0] = scale * (a1 + a3 * a2);
+	cf->m[1][1] = -scale * (a2 - 1.0) * (a2 + a3 * a1);
+	cf->m[1][2] = -scale * a3 * (a3 * a1 + a3 * a3 + a2 - 1.0);
+	cf->m[2][0] = scale * (a3 * a1 + a2 + a1 * a1 - a2 * a2);
+	cf->m[2][1] = scale * (a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 - a3 * a2 + a3);
+	cf->m[2][2] = scale * a3 * (a1 + a3 * a2);
+}
+
+/**
+ * Applies the recursive Gaussian filter in place along one direction of a
+ * data array. The array is seen as len positions of lanes contiguous values
+ * each, separated by step elements, and every lane is filtered on its own.
+ * For rows that is w positions of n_channels lanes, and for columns h
+ * positions of w * n_channels lanes, which keeps the memory access
+ * sequential. It is specialised on the number of lanes for the rows (see
+ * __ni_image_iir_rows). Only intended for internal usage.
+ *
+ * double *data -> data to be filtered in place
+ * int len -> number of positions along the filtered direction
+ * ptrdiff_t step -> distance between two consecutive positions
+ * const __ni_image_iir_coefs *cf -> coefficients of the filter
+ * double *scratch -> scratch array of 4 * lanes elements
+ * int lanes -> number of values filtered in parallel at each position
+ */
+NI_SPECIALIZED void
+__ni_image_iir_pass(double *data, int len, ptrdiff_t step, const __ni_image_iir_coefs *cf, double *scratch, int lanes)
+{
+	const double b = cf->b;
+	const double a1 = cf->a[0], a2 = cf->a[1], a3 = cf->a[2];
+	double *first = scratch;
+	double *last = scratch + lanes;
+	double *z1 = scratch + 2 * lanes; // virtual position len
+	double *z2 = scratch + 3 * lanes; // virtual position len + 1
+	const double *p1, *p2, *p3;
+	double *cur;
+	double u0, u1, u2;
+
+	for(int l = 0; l < lanes; l++) {
+		first[l] = data[l];
+		last[l] = data[(len - 1) * step + l];
+	}
+
+	// -- CAUSAL --
+	// Before the start the signal is constant, so the filter is steady
+	for(int i = 0; i < len; i++) {
+		cur = data + i * step;
+		p1 = (i >= 1) ? cur - step : first;
+		p2 = (i >= 2) ? cur - 2 * step : first;
+		p3 = (i >= 3) ? cur - 3 * step : first;
+		for(int l = 0; l < lanes; l++)
+			cur[l] = b * cur[l] + a1 * p1[l] + a2 * p2[l] + a3 * p3[l];
+	}
+
+	// -- ANTI-CAUSAL --
+	// Past the end the signal is constant too, the Triggs - Sdika matrix gives
+	// the exact state of the anti-causal filter from the last causal outputs
+	cur = data + (len - 1) * step;
+	p1 = (len >= 2) ? cur - step : first;
+	p2 = (len >= 3) ? cur - 2 * step : first;
+	for(int l = 0; l < lanes; l++) {
+		u0 = cur[l] - last[l];
+		u1 = p1[l] - last[l];
+		u2 = p2[l] - last[l];
+		cur[l] = b * (cf->m[0][0] * u0 + cf->m[0][1] * u1 + cf->m[0][2] * u2) + last[l];
+		z1[l] = b * (cf->m[1][0] * u0 + cf->m[1][1] * u1 + cf->m[1][2] * u2) + last[l];
+		z2[l] = b * (cf->m[2][0] * u0 + cf->m[2][1] * u1 + cf->m[2][2] * u2) + last[l];
+	}
+	for(int i = len - 2; i >= 0; i--) {
+		cur = data + i * step;
+		p1 = cur + step;
+		p2 = (i + 2 < len) ? cur + 2 * step : (i + 2 == len) ? z1 : z2;
+		p3 = (i + 3 < len) ? cur + 3 * step : (i + 3 == len) ? z1 : z2;
+		for(int l = 0; l < lanes; l++)
+			cur[l] = b * cur[l] + a1 * p1[l] + a2 * p2[l] + a3 * p3[l];
+	}
+}
+
+/**
+ * Applies the recursive Gaussian filter in place to every row of a data
+ * array. Only intended for internal usage.
+ *
+ * double *data -> data to be filtered in place
+ * int w -> width of the data
+ * int h -> height of the data
+ * const __ni_image_iir_coefs *cf -> coefficients of the filter
+ * double *scratch -> scratch array of 4 * n_channels elements
+ * int n_channels -> number of channels of the data
+ */
+NI_SPECIALIZED void
+__ni_image_iir_rows_kernel(double *data, int w, int h, const __ni_image_iir_coefs *cf, double *scratch, int n_channels)
+{
+	for(int y = 0; y < h; y++)
+		__ni_image_iir_pass(data + PX_IDX(0, y, w, n_channels), w, n_channels, cf, scratch, n_channels);
+}
+
+/**
+ * Same as __ni_image_iir_rows_kernel, specialised for 1 to 4 channels.
+ * Only intended for internal usage.
+ */
+static void
+__ni_image_iir_rows(double *data, int w, int h, int n_channels, const __ni_image_iir_coefs *cf, double *scratch)
+{
+	NI_SWITCH_CHANNELS(n_channels, __ni_image_iir_rows_kernel, data, w, h, cf, scratch)
+}
+
+stbi_uc *
+ni_image_blur_gaussian_recursive(const stbi_uc *img_data, int w, int h, int n_channels, double sigma)
+{
+	stbi_uc *img = ni_image_create(w, h, n_channels);
+	if(ni_image_blur_gaussian_recursive_into(img_data, w, h, n_channels, sigma, img, NULL, 0) == NULL) {
+		ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+size_t
+ni_image_blur_gaussian_recursive_scratch_size(int w, int h, int n_channels)
+{
+	return NI_SCRATCH_ALIGNMENT + ni_scratch_reserve(sizeof(double) * w * h * n_channels) + ni_scratch_reserve(sizeof(double) * w * n_channels * 4);
+}
+
+/**
+ * Recursive Gaussian blur on a scratch, that
+ * ni_image_blur_gaussian_recursive_into and
+ * ni_image_blur_gaussian_recursive_ctx share. Only intended for internal
+ * usage.
+ *
+ * const ni_image *src -> the original image (8 bits)
+ * ni_image *dst -> output image of the same size
+ * ni_scratch *scratch -> scratch for the temporary buffers
+ *
+ * returns dst or NULL on error.
+ */
+static ni_image *
+__ni_image_blur_gaussian_recursive_apply(const ni_image *src, ni_image *dst, double sigma, ni_scratch *scratch)
+{
+	// ERROR: sigma is out of the range of the approximation
+	if(sigma < 0.5)
+		return NULL;
+	// ERROR: empty image, the filters start from the pixels at both ends
+	if(src->w <= 0 || src->h <= 0)
+		return NULL;
+
+	const int w = src->w;
+	const int h = src->h;
+	const int n_channels = src->n_channels;
+
+	__ni_image_iir_coefs cf;
+	__ni_image_iir_coefs_create(sigma, &cf);
+
+	const int row_len = w * n_channels;
+	double *data = ni_scratch_alloc(scratch, sizeof(double) * w * h * n_channels);
+	double *lanes = ni_scratch_alloc(scratch, sizeof(double) * row_len * 4);
+	// ERROR: out of memory
+	if(data == NULL || lanes == NULL) {
+		ni_scratch_free(scratch, data);
+		ni_scratch_free(scratch, lanes);
+		return NULL;
+	}
+
+	// -- CONVERT TO DATA --
+	__ni_image_blur_load(src, data);
+
+	// -- FILTER --
+	__ni_image_iir_rows(data, w, h, n_channels, &cf, lanes);
+	__ni_image_iir_pass(data, h, row_len, &cf, lanes, row_len);
+
+	// -- CONVERT BACK TO IMAGE --
+	__ni_image_blur_store(data, dst);
+
+	ni_scratch_free(scratch, data);
+	ni_scratch_free(scratch, lanes);
+	return dst;
+}
+
+stbi_uc *
+ni_image_blur_gaussian_recursive_into(const stbi_uc *img_data, int w, int h, int n_channels, double sigma, stbi_uc *out, void *scratch, size_t scratch_size)
+{
+	// ERROR: no output
+	if(out == NULL)
+		return NULL;
+
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(out, w, h, n_channels, NI_PIXEL_U8);
+	ni_scratch s = ni_scratch_init(scratch, scratch_size);
+	if(__ni_image_blur_gaussian_recursive_apply(&src, &dst, sigma, &s) == NULL)
+		return NULL;
+	return out;
+}
+
+stbi_uc *
+ni_image_blur_gaussian_recursive_ctx(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, double sigma, stbi_uc *out)
+{
+	stbi_uc *img = (out == NULL) ? ni_image_create(w, h, n_channels) : out;
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(img, w, h, n_channels, NI_PIXEL_U8);
+	if(ni_image_blur_gaussian_recursive_view(ctx, &src, &dst, sigma) == NULL) {
+		if(out == NULL)
+			ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+ni_image *
+ni_image_blur_gaussian_recursive_view(ni_context *ctx, const ni_image *src, ni_image *dst, double sigma)
+{
+	// ERROR: the images do not match
+	if(!__ni_image_views_same(src, dst, src->n_channels))
+		return NULL;
+
+	ni_scratch s = ni_context_scratch_begin(ctx, ni_image_blur_gaussian_recursive_scratch_size(src->w, src->h, src->n_channels));
+	ni_image *res = __ni_image_blur_gaussian_recursive_apply(src, dst, sigma, &s);
+	ni_context_scratch_end(ctx, &s);
+	return res;
+}
+
+ni_planes *
+ni_image_blur_gaussian_recursive_planes(ni_context *ctx, const ni_planes *src, ni_planes *dst, double sigma)
+{
+	// ERROR: the number of planes does not match
+	if(src->n_planes != dst->n_planes)
+		return NULL;
+
+	for(int c = 0; c < src->n_planes; c++)
+		if(ni_image_blur_gaussian_recursive_view(ctx, &src->plane[c], &dst->plane[c], sigma) == NULL)
+			return NULL;
+	return dst;
 }
 
 #endif // NI_BLUR_IMPLEMENTATION
@@ -0,0 +1,242 @@
+#ifndef NI_INCLUDE_CONTEXT
+#define NI_INCLUDE_CONTEXT
+
+#ifndef NI_INCLUDE_IMAGE_UTILS
+#define NI_IMAGE_UTILS_IMPLEMENTATION
+#include "ni_image_utils.h"
+#endif
+
+#ifndef NI_INCLUDE_THREADPOOL
+#define NI_THREADPOOL_IMPLEMENTATION
+#include "ni_image_threadpool.h"
+#endif
+
+#ifndef NI_INCLUDE_KERNEL_CACHE
+#define NI_KERNEL_CACHE_IMPLEMENTATION
+#include "ni_image_kernel_cache.h"
+#endif
+
+// = DECLARATION =
+
+/**
+ * State shared by a series of niimg operations: the scratch memory they take
+ * their temporary buffers from, the thread pool they run in, the kernel
+ * cache they use and the precision they work with. The operations that take
+ * a context (the _ctx functions) reuse its scratch from one call to the
+ * next, so after the first call on images of a given size nothing is
+ * allocated but the output.
+ *
+ * The scratch grows to the largest size an operation needed and is kept
+ * until the context is destroyed. A context must not be used by two
+ * threads at the same time: threads that run operations on their own
+ * (instead of through the pool) need one context each.
+ */
+typedef struct ni_context ni_context;
+
+/**
+ * Creates a new context, that needs to be destroyed with ni_context_destroy.
+ * It starts with no scratch, the default thread pool, the default kernel
+ * cache and NI_DEFAULT_PRECISION.
+ *
+ * returns a pointer to the new context or NULL on error.
+ */
+ni_context *ni_context_create(void);
+
+/**
+ * Frees the context and its scratch. The thread pool and the kernel cache
+ * are not destroyed, they belong to whoever created them.
+ *
+ * ni_context *ctx -> the context to destroy
+ */
+void ni_context_destroy(ni_context *ctx);
+
+/**
+ * Changes the thread pool the operations of a context run in.
+ *
+ * ni_context *ctx -> the context
+ * ni_threadpool *pool -> the pool, NULL runs everything on the calling thread
+ */
+void ni_context_set_threadpool(ni_context *ctx, ni_threadpool *pool);
+
+/**
+ * Changes the kernel cache the operations of a context use.
+ *
+ * ni_context *ctx -> the context
+ * ni_kernel_cache *cache -> the cache, NULL creates the kernels every time
+ */
+void ni_context_set_kernel_cache(ni_context *ctx, ni_kernel_cache *cache);
+
+/**
+ * Changes the precision the operations of a context work with (see
+ * NI_PRECISION in ni_image_utils.h).
+ *
+ * ni_context *ctx -> the context
+ * NI_PRECISION precision -> the precision
+ */
+void ni_context_set_precision(ni_context *ctx, NI_PRECISION precision);
+
+/**
+ * Returns the thread pool of a context.
+ *
+ * const ni_context *ctx -> the context, NULL gives the default pool
+ */
+ni_threadpool *ni_context_threadpool(const ni_context *ctx);
+
+/**
+ * Returns the kernel cache of a context.
+ *
+ * const ni_context *ctx -> the context, NULL gives the default cache
+ */
+ni_kernel_cache *ni_context_kernel_cache(const ni_context *ctx);
+
+/**
+ * Returns the precision of a context.
+ *
+ * const ni_context *ctx -> the context, NULL gives NI_DEFAULT_PRECISION
+ */
+NI_PRECISION ni_context_precision(const ni_context *ctx);
+
+/**
+ * Returns the largest number of bytes of scratch that an operation of the
+ * context has used. With NI_SCRATCH_ALIGNMENT more bytes, for the alignment
+ * of the first buffer, it is enough scratch for the _into functions to run
+ * the same operations without allocating.
+ *
+ * const ni_context *ctx -> the context
+ */
+size_t ni_context_peak_scratch(const ni_context *ctx);
+
+/**
+ * Returns the scratch of a context for an operation, making it at least
+ * size bytes long. Meant for the operations of niimg, that hand it back
+ * with ni_context_scratch_end.
+ *
+ * ni_context *ctx -> the context, if NULL the scratch is empty and every
+ * buffer is allocated
+ * size_t size -> bytes of scratch the operation needs
+ *
+ * returns the scratch
+ */
+ni_scratch ni_context_scratch_begin(ni_context *ctx, size_t size);
+
+/**
+ * Hands back the scratch of a context after an operation, keeping track of
+ * the peak use.
+ *
+ * ni_context *ctx -> the context
+ * const ni_scratch *scratch -> the scratch returned by ni_context_scratch_begin
+ */
+void ni_context_scratch_end(ni_context *ctx, const ni_scratch *scratch);
+
+// = IMPLEMENTATION =
+#ifdef NI_CONTEXT_IMPLEMENTATION
+
+struct ni_context {
+	ni_threadpool *pool;
+	int default_pool; // The default pool can be replaced, so it is not kept
+	ni_kernel_cache *cache;
+	NI_PRECISION precision;
+	unsigned char *scratch;
+	size_t scratch_size;
+	size_t peak;
+};
+
+ni_context *
+ni_context_create(void)
+{
+	ni_context *ctx = ni_alloc(sizeof(ni_context));
+	if(ctx == NULL)
+		return NULL;
+	ctx->pool = NULL;
+	ctx->default_pool = 1;
+	ctx->cache = ni_kernel_cache_default();
+	ctx->precision = NI_DEFAULT_PRECISION;
+	ctx->scratch = NULL;
+	ctx->scratch_size = 0;
+	ctx->peak = 0;
+	return ctx;
+}
+
+void
+ni_context_destroy(ni_context *ctx)
+{
+	if(ctx == NULL)
+		return;
+	ni_free(ctx->scratch);
+	ni_free(ctx);
+}
+
+void
+ni_context_set_threadpool(ni_context *ctx, ni_threadpool *pool)
+{
+	ctx->pool = pool;
+	ctx->default_pool = 0;
+}
+
+void
+ni_context_set_kernel_cache(ni_context *ctx, ni_kernel_cache *cache)
+{
+	ctx->cache = cache;
+}
+
+void
+ni_context_set_precision(ni_context *ctx, NI_PRECISION precision)
+{
+	ctx->precision = precision;
+}
+
+ni_threadpool *
+ni_context_threadpool(const ni_context *ctx)
+{
+	if(ctx == NULL || ctx->default_pool)
+		return ni_threadpool_default();
+	return ctx->pool;
+}
+
+ni_kernel_cache *
+ni_context_kernel_cache(const ni_context *ctx)
+{
+	if(ctx == NULL)
+		return ni_kernel_cache_default();
+	return ctx->cache;
+}
+
+NI_PRECISION
+ni_context_precision(const ni_context *ctx)
+{
+	if(ctx == NULL)
+		return NI_DEFAULT_PRECISION;
+	return ctx->precision;
+}
+
+size_t
+ni_context_peak_scratch(const ni_context *ctx)
+{
+	return ctx->peak;
+}
+
+ni_scratch
+ni_context_scratch_begin(ni_context *ctx, size_t size)
+{
+	if(ctx == NULL)
+		return ni_scratch_init(NULL, 0);
+
+	if(size > ctx->scratch_size) {
+		// Nothing in it needs to be kept, so there is no need to copy it
+		ni_free(ctx->scratch);
+		ctx->scratch = ni_alloc(size);
+		ctx->scratch_size = (ctx->scratch == NULL) ? 0 : size;
+	}
+	return ni_scratch_init(ctx->scratch, ctx->scratch_size);
+}
+
+void
+ni_context_scratch_end(ni_context *ctx, const ni_scratch *scratch)
+{
+	if(ctx != NULL && scratch->used > ctx->peak)
+		ctx->peak = scratch->used;
+}
+
+#endif // NI_CONTEXT_IMPLEMENTATION
+
+#endif // NI_INCLUDE_CONTEXT
@@ -0,0 +1,1389 @@
+#ifndef NI_INCLUDE_CONVOLVE
+#define NI_INCLUDE_CONVOLVE
+
+#include "math.h"
+
+#ifndef NI_INCLUDE_IMAGE_UTILS
+#define NI_IMAGE_UTILS_IMPLEMENTATION
+#include "ni_image_utils.h"
+#endif
+
+#ifndef NI_INCLUDE_SIMD
+#define NI_SIMD_IMPLEMENTATION
+#include "ni_image_simd.h"
+#endif
+
+#ifndef NI_INCLUDE_THREADPOOL
+#define NI_THREADPOOL_IMPLEMENTATION
+#include "ni_image_threadpool.h"
+#endif
+
+#ifndef NI_INCLUDE_FFT
+#define NI_FFT_IMPLEMENTATION
+#include "ni_image_fft.h"
+#endif
+
+#ifndef NI_INCLUDE_CONTEXT
+#define NI_CONTEXT_IMPLEMENTATION
+#include "ni_image_context.h"
+#endif
+
+// = DECLARATION =
+
+/**
+ * Relative tolerance used to decide that a kernel is separable: every
+ * element must be within this fraction of the largest element from the
+ * product of its row and column factors.
+ */
+#define NI_CONVOLVE_SEPARABLE_EPSILON 1e-9
+
+/**
+ * Largest FFT size used for the tiles of the FFT method, unless the kernel
+ * needs more. It bounds the scratch memory of every thread to a few times
+ * NI_CONVOLVE_FFT_MAX_SIZE^2 doubles, whatever the size of the image.
+ */
+#define NI_CONVOLVE_FFT_MAX_SIZE 512
+
+/**
+ * Cost of every element of an FFT tile and every level of the transform,
+ * relative to the cost of one tap of the direct method. It is what the cost
+ * model weighs both methods with. With the vectorised direct method the
+ * FFT starts to pay off for kernels of about 30x30 non-zero taps.
+ */
+#define NI_CONVOLVE_FFT_COST 20.0
+
+/**
+ * Methods to apply a kernel with.
+ */
+typedef enum __NI_CONVOLVE_METHOD {
+	NI_CONVOLVE_AUTO, // Cheapest method according to the cost model
+	NI_CONVOLVE_DIRECT, // Separable passes or direct 2D convolution
+	NI_CONVOLVE_FFT, // Tiled FFT convolution
+} NI_CONVOLVE_METHOD;
+
+/**
+ * Convolves an image with a kernel and returns the result on a new image,
+ * that needs to be freed outside.
+ *
+ * The kernel is centered on every pixel and applied as it is (it is not
+ * flipped), the same way the blurs apply theirs. If it is separable (rank 1)
+ * it is split at setup and applied as a horizontal and a vertical pass, so
+ * the cost per pixel is O(kw + kh) instead of O(kw * kh). Otherwise a cost
+ * model picks between the direct 2D convolution, that skips the taps that
+ * are zero, and the FFT convolution, that is cheaper for large kernels.
+ * Both run in the default thread pool (see ni_image_threadpool.h).
+ *
+ * Only the separable passes follow the NI_PRECISION, and with
+ * NI_PRECISION_FLOAT an output value can differ by one level from the
+ * NI_PRECISION_DOUBLE result. The direct and FFT convolutions always work in
+ * double precision.
+ *
+ * const stbi_uc *img_data -> data of the original image
+ * int w -> original image width
+ * int h -> original image height
+ * int n_channels -> number of channels of the original image
+ * const double *kernel -> kh rows of kw elements, accessed as
+ * kernel[PX_IDX(x, y, kw, 1)]
+ * int kw -> width of the kernel (odd)
+ * int kh -> height of the kernel (odd)
+ * NI_IMAGE_BORDER border -> border mode (see ni_image_utils.h).
+ * NI_BORDER_RENORMALIZE is meant for kernels without negative elements.
+ *
+ * returns a new stbi_uc array which represents the convolved image or NULL on error.
+ *
+ * Error conditions:
+ *  -> kw % 2 == 0 or kh % 2 == 0
+ *  -> kw <= 0 or kh <= 0
+ *  -> the image or its temporary buffers could not be allocated
+ */
+stbi_uc *ni_image_convolve(const stbi_uc *img_data, int w, int h, int n_channels, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border);
+
+/**
+ * Checks if a kernel is separable (rank 1), and if it is, splits it in a row
+ * and a column factor so that kernel[y][x] = col[y] * row[x].
+ *
+ * const double *kernel -> kh rows of kw elements
+ * int kw -> width of the kernel
+ * int kh -> height of the kernel
+ * double *row -> output array of kw elements, may be NULL
+ * double *col -> output array of kh elements, may be NULL
+ *
+ * returns 1 if the kernel is separable, 0 otherwise
+ */
+int ni_image_kernel_separate(const double *kernel, int kw, int kh, double *row, double *col);
+
+/**
+ * Same as ni_image_convolve but the method is chosen by the caller.
+ *
+ * The FFT method splits the output in tiles, so memory stays bounded by
+ * NI_CONVOLVE_FFT_MAX_SIZE. Every tile reads its input with a margin of the
+ * kernel size, convolves it with a single FFT of the tile size and keeps
+ * the part of the result that does not wrap around (overlap-save). The
+ * result matches the direct method within one level.
+ *
+ * NI_CONVOLVE_METHOD method -> method to use
+ *
+ * returns a new stbi_uc array which represents the convolved image or NULL on error.
+ */
+stbi_uc *ni_image_convolve_method(const stbi_uc *img_data, int w, int h, int n_channels, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, NI_CONVOLVE_METHOD method);
+
+/**
+ * Same as ni_image_convolve_method but the result is written to an image
+ * owned by the caller, and the temporary buffers are taken from a scratch
+ * owned by the caller too (see ni_scratch in ni_image_utils.h). With a
+ * scratch of ni_image_convolve_scratch_size bytes, nothing is allocated.
+ *
+ * stbi_uc *out -> output image of w * h * n_channels bytes. It can be
+ * img_data, then the direct method is used whatever the method asked for.
+ * void *scratch -> scratch memory, may be NULL
+ * size_t scratch_size -> size of the scratch memory in bytes
+ *
+ * returns out or NULL on error.
+ */
+stbi_uc *ni_image_convolve_into(const stbi_uc *img_data, int w, int h, int n_channels, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, NI_CONVOLVE_METHOD method, stbi_uc *out, void *scratch, size_t scratch_size);
+
+/**
+ * Returns the number of bytes of scratch ni_image_convolve_into needs to not
+ * allocate anything, with the current size of the default thread pool.
+ *
+ * Same arguments as ni_image_convolve_into.
+ *
+ * returns the size in bytes, or 0 on error.
+ */
+size_t ni_image_convolve_scratch_size(int w, int h, int n_channels, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, NI_CONVOLVE_METHOD method);
+
+/**
+ * Same as ni_image_convolve_method but it runs in the thread pool of a
+ * context, and the temporary buffers are taken from its scratch (see
+ * ni_image_context.h).
+ *
+ * ni_context *ctx -> the context, NULL uses the defaults
+ * stbi_uc *out -> output image of w * h * n_channels bytes, or NULL to
+ * return a new one that needs to be freed outside. It can be img_data,
+ * then the direct method is used whatever the method asked for.
+ *
+ * returns out (or the new image) or NULL on error.
+ */
+stbi_uc *ni_image_convolve_ctx(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, NI_CONVOLVE_METHOD method, stbi_uc *out);
+
+/**
+ * Same as ni_image_convolve_ctx but on image descriptors, so the images can
+ * be regions of larger ones (see ni_image_view in ni_image_utils.h). The
+ * border mode applies at the edges of the region: the pixels around it are
+ * not read.
+ *
+ * ni_context *ctx -> the context, NULL uses the defaults
+ * const ni_image *src -> the original image, NI_PIXEL_U8
+ * ni_image *dst -> output image of the same size and channels. It can be
+ * src to convolve a region in place, then the direct method is used
+ * whatever the method asked for.
+ *
+ * returns dst or NULL on error.
+ *
+ * Error conditions:
+ *  -> kw or kh are not odd and positive
+ *  -> the images are not NI_PIXEL_U8 or their sizes do not match
+ *  -> the temporary buffers could not be allocated
+ */
+ni_image *ni_image_convolve_view(ni_context *ctx, const ni_image *src, ni_image *dst, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, NI_CONVOLVE_METHOD method);
+
+// = IMPLEMENTATION =
+#ifdef NI_CONVOLVE_IMPLEMENTATION
+
+/**
+ * Calculates, for every position of a line, the sum of the kernel taps that
+ * land inside of it relative to the sum of the whole kernel. That is what
+ * NI_BORDER_RENORMALIZE divides by on the first and last kernel_size / 2
+ * positions, so they keep the gain of the interior. Only intended for
+ * internal usage.
+ *
+ * const double *kernel -> 1-dimensional kernel
+ * int kernel_size -> number of elements of the kernel (odd)
+ * int len -> length of the line
+ * double *norm -> output array of len elements
+ */
+static void
+__ni_image_border_norm(const double *kernel, int kernel_size, int len, double *norm)
+{
+	const int radius = kernel_size / 2;
+	double sum = 0.0;
+	for(int j = 0; j < kernel_size; j++)
+		sum += kernel[j];
+	for(int i = 0; i < len; i++) {
+		norm[i] = 0.0;
+		for(int j = -radius; j <= radius; j++)
+			if(i + j >= 0 && i + j < len)
+				norm[i] += kernel[radius + j];
+		norm[i] /= sum;
+	}
+}
+
+/**
+ * Arguments of a convolution that is split in bands of rows. Only intended
+ * for internal usage.
+ *
+ * The first pass writes h + kh - 1 rows to data: the rows of the image with
+ * kh / 2 rows of border above and below, so the second pass never leaves the
+ * array. For separable kernels the first pass is the horizontal convolution,
+ * otherwise it only pads every row with kw / 2 pixels of border on each side.
+ */
+typedef struct __ni_image_convolve_job {
+	const stbi_uc *img_data;
+	stbi_uc *img;
+	ptrdiff_t src_stride; // bytes between two rows of img_data
+	ptrdiff_t dst_stride; // bytes between two rows of img
+	double *data;
+	int w;
+	int h;
+	int n_channels;
+	int kw;
+	int kh;
+	NI_IMAGE_BORDER border;
+	// Separable kernels
+	const double *h_kernel; // kw elements
+	const double *v_kernel; // kh elements
+	const double *h_norm; // NI_BORDER_RENORMALIZE only, w elements
+	const double *v_norm; // NI_BORDER_RENORMALIZE only, h elements
+	// Other kernels
+	const double *taps; // non-zero elements of the kernel
+	const ptrdiff_t *offsets; // offset of every tap in data
+	int n_taps;
+	const double *sat; // NI_BORDER_RENORMALIZE only, summed area table of the kernel
+	// FFT method
+	const ni_fft_plan *plan_x;
+	const ni_fft_plan *plan_y;
+	int fft_w;
+	int fft_h;
+	const double *spectrum; // fft_h rows of fft_w / 2 + 1 complex numbers
+	// Scratch of the tasks
+	double *lines; // line_len elements for every task
+	size_t line_len;
+	// NI_PRECISION_FLOAT, separable kernels only: these replace data, lines
+	// and the kernels
+	float *data_f32;
+	float *lines_f32;
+	const float *h_kernel_f32;
+	const float *v_kernel_f32;
+} __ni_image_convolve_job;
+
+/**
+ * Converts a row of an image to normalized data and pads it with kw / 2
+ * pixels on each side according to the border mode. Only intended for
+ * internal usage.
+ *
+ * const __ni_image_convolve_job *job -> the convolution being run
+ * int p -> padded row (row p - kh / 2 of the image)
+ * double *line -> output array of (w + kw - 1) * n_channels elements
+ *
+ * returns 0 if the row is outside of the image and has no pixels to read,
+ * 1 otherwise
+ */
+static int
+__ni_image_convolve_load_row(const __ni_image_convolve_job *job, int p, double *line)
+{
+	const int w = job->w;
+	const int n_channels = job->n_channels;
+	const int radius = job->kw / 2;
+	const int pad = radius * n_channels;
+	const int row_len = w * n_channels;
+	int src, x;
+
+	src = ni_image_border_index(p - job->kh / 2, job->h, job->border);
+	if(src < 0)
+		return 0;
+	ni_simd_u8_to_data(job->img_data + src * job->src_stride, line + pad, row_len);
+
+	for(int i = 0; i < radius; i++) {
+		x = ni_image_border_index(i - radius, w, job->border);
+		BEGIN_FOREACH_CHANNEL(n_channels)
+		line[i * n_channels + __c] = (x < 0) ? 0.0 : line[pad + x * n_channels + __c];
+		END_FOREACH_CHANNEL
+		x = ni_image_border_index(w + i, w, job->border);
+		BEGIN_FOREACH_CHANNEL(n_channels)
+		line[pad + row_len + i * n_channels + __c] = (x < 0) ? 0.0 : line[pad + x * n_channels + __c];
+		END_FOREACH_CHANNEL
+	}
+	return 1;
+}
+
+/**
+ * Horizontal pass of a separable convolution. Every row is padded according
+ * to the border mode so the vectorised kernel runs over the whole row
+ * without any bounds check, and only the border strips get extra work
+ * afterwards. Only intended for internal usage.
+ *
+ * const __ni_image_convolve_job *job -> the convolution being run
+ * double *line -> scratch array of (w + kw - 1) * n_channels elements
+ * int p0 -> first padded row to convolve
+ * int p1 -> padded row after the last one to convolve
+ */
+static void
+__ni_image_convolve_rows(const __ni_image_convolve_job *job, double *line, int p0, int p1)
+{
+	const int w = job->w;
+	const int n_channels = job->n_channels;
+	const int radius = job->kw / 2;
+	const int row_len = w * n_channels;
+	double *out;
+
+	for(int p = p0; p < p1; p++) {
+		out = job->data + PX_IDX(0, p, w, n_channels);
+		if(!__ni_image_convolve_load_row(job, p, line)) {
+			memset(out, 0, row_len * sizeof(double));
+			continue;
+		}
+
+		ni_simd_convolve(line, out, row_len, n_channels, job->h_kernel, job->kw);
+
+		if(job->border == NI_BORDER_RENORMALIZE) {
+			for(int __x = 0; __x < w; __x++) {
+				// Skip the interior
+				if(__x == radius && w - radius > radius)
+					__x = w - radius;
+				BEGIN_FOREACH_CHANNEL(n_channels)
+				out[__x * n_channels + __c] /= job->h_norm[__x];
+				END_FOREACH_CHANNEL
+			}
+		}
+	}
+}
+
+/**
+ * Vertical pass of a separable convolution, that writes the result as image
+ * rows. The border rows are already in the data, so every row runs the same
+ * vectorised kernel. Only intended for internal usage.
+ *
+ * const __ni_image_convolve_job *job -> the convolution being run
+ * double *line -> scratch array of w * n_channels elements
+ * int y0 -> first row to convolve
+ * int y1 -> row after the last one to convolve
+ */
+static void
+__ni_image_convolve_cols(const __ni_image_convolve_job *job, double *line, int y0, int y1)
+{
+	const int w = job->w;
+	const int h = job->h;
+	const int n_channels = job->n_channels;
+	const int radius = job->kh / 2;
+	const int row_len = w * n_channels;
+	double scale;
+
+	// Whole rows are the taps, so the vectorised kernel walks contiguous
+	// memory. Padded row y is the first tap of image row y, and the band
+	// reads kh - 1 rows (the halo) past its end.
+	for(int __y = y0; __y < y1; __y++) {
+		ni_simd_convolve(job->data + PX_IDX(0, __y, w, n_channels), line, row_len, row_len, job->v_kernel, job->kh);
+		if(job->border == NI_BORDER_RENORMALIZE && (__y < radius || __y >= h - radius)) {
+			scale = job->v_norm[__y];
+			for(int i = 0; i < row_len; i++)
+				line[i] /= scale;
+		}
+		ni_simd_data_to_u8(line, job->img + __y * job->dst_stride, row_len);
+	}
+}
+
+/**
+ * Same as __ni_image_convolve_load_row in single precision. Only intended
+ * for internal usage.
+ */
+static int
+__ni_image_convolve_load_row_f32(const __ni_image_convolve_job *job, int p, float *line)
+{
+	const int w = job->w;
+	const int n_channels = job->n_channels;
+	const int radius = job->kw / 2;
+	const int pad = radius * n_channels;
+	const int row_len = w * n_channels;
+	int src, x;
+
+	src = ni_image_border_index(p - job->kh / 2, job->h, job->border);
+	if(src < 0)
+		return 0;
+	ni_simd_u8_to_f32(job->img_data + src * job->src_stride, line + pad, row_len);
+
+	for(int i = 0; i < radius; i++) {
+		x = ni_image_border_index(i - radius, w, job->border);
+		BEGIN_FOREACH_CHANNEL(n_channels)
+		line[i * n_channels + __c] = (x < 0) ? 0.0f : line[pad + x * n_channels + __c];
+		END_FOREACH_CHANNEL
+		x = ni_image_border_index(w + i, w, job->border);
+		BEGIN_FOREACH_CHANNEL(n_channels)
+		line[pad + row_len + i * n_channels + __c] = (x < 0) ? 0.0f : line[pad + x * n_channels + __c];
+		END_FOREACH_CHANNEL
+	}
+	return 1;
+}
+
+/**
+ * Same as __ni_image_convolve_rows in single precision. Only intended for
+ * internal usage.
+ */
+static void
+__ni_image_convolve_rows_f32(const __ni_image_convolve_job *job, float *line, int p0, int p1)
+{
+	const int w = job->w;
+	const int n_channels = job->n_channels;
+	const int radius = job->kw / 2;
+	const int row_len = w * n_channels;
+	float *out;
+
+	for(int p = p0; p < p1; p++) {
+		out = job->data_f32 + PX_IDX(0, p, w, n_channels);
+		if(!__ni_image_convolve_load_row_f32(job, p, line)) {
+			memset(out, 0, row_len * sizeof(float));
+			continue;
+		}
+
+		ni_simd_convolve_f32(line, out, row_len, n_channels, job->h_kernel_f32, job->kw);
+
+		if(job->border == NI_BORDER_RENORMALIZE) {
+			for(int __x = 0; __x < w; __x++) {
+				// Skip the interior
+				if(__x == radius && w - radius > radius)
+					__x = w - radius;
+				BEGIN_FOREACH_CHANNEL(n_channels)
+				out[__x * n_channels + __c] /= (float)job->h_norm[__x];
+				END_FOREACH_CHANNEL
+			}
+		}
+	}
+}
+
+/**
+ * Same as __ni_image_convolve_cols in single precision. Only intended for
+ * internal usage.
+ */
+static void
+__ni_image_convolve_cols_f32(const __ni_image_convolve_job *job, float *line, int y0, int y1)
+{
+	const int w = job->w;
+	const int h = job->h;
+	const int n_channels = job->n_channels;
+	const int radius = job->kh / 2;
+	const int row_len = w * n_channels;
+	float scale;
+
+	for(int __y = y0; __y < y1; __y++) {
+		ni_simd_convolve_f32(job->data_f32 + PX_IDX(0, __y, w, n_channels), line, row_len, row_len, job->v_kernel_f32, job->kh);
+		if(job->border == NI_BORDER_RENORMALIZE && (__y < radius || __y >= h - radius)) {
+			scale = (float)job->v_norm[__y];
+			for(int i = 0; i < row_len; i++)
+				line[i] /= scale;
+		}
+		ni_simd_f32_to_u8(line, job->img + __y * job->dst_stride, row_len);
+	}
+}
+
+/**
+ * First pass of a non-separable convolution: converts and pads the rows.
+ * Only intended for internal usage.
+ *
+ * const __ni_image_convolve_job *job -> the convolution being run
+ * int p0 -> first padded row
+ * int p1 -> padded row after the last one
+ */
+static void
+__ni_image_convolve_pad_rows(const __ni_image_convolve_job *job, int p0, int p1)
+{
+	const size_t padded_len = (size_t)(job->w + job->kw - 1) * job->n_channels;
+	double *out;
+
+	for(int p = p0; p < p1; p++) {
+		out = job->data + p * padded_len;
+		if(!__ni_image_convolve_load_row(job, p, out))
+			memset(out, 0, padded_len * sizeof(double));
+	}
+}
+
+/**
+ * Divides a segment of an output row of a non-separable convolution by the
+ * share of the kernel sum that lands inside of the image, for
+ * NI_BORDER_RENORMALIZE. Only intended for internal usage.
+ *
+ * const __ni_image_convolve_job *job -> the convolution being run
+ * double *line -> pixels x0 to x1 of the row
+ * int x0 -> first pixel of the segment
+ * int x1 -> pixel after the last one of the segment
+ * int y -> row of the segment
+ */
+static void
+__ni_image_convolve_renormalize(const __ni_image_convolve_job *job, double *line, int x0, int x1, int y)
+{
+	const int w = job->w;
+	const int h = job->h;
+	const int n_channels = job->n_channels;
+	const int rx = job->kw / 2;
+	const int ry = job->kh / 2;
+	const int sat_w = job->kw + 1;
+	int ax, bx, ay, by;
+	double scale;
+
+	// The taps inside of the image form a rectangle of the kernel, and its
+	// sum comes from the summed area table. The last element of the table
+	// is the sum of the whole kernel
+	ay = (y < ry) ? ry - y : 0;
+	by = (y + ry >= h) ? h - 1 - y + ry : job->kh - 1;
+	for(int __x = x0; __x < x1; __x++) {
+		// Skip the interior
+		if(__x >= rx && __x < w - rx && y >= ry && y < h - ry) {
+			__x = (x1 < w - rx ? x1 : w - rx) - 1;
+			continue;
+		}
+		ax = (__x < rx) ? rx - __x : 0;
+		bx = (__x + rx >= w) ? w - 1 - __x + rx : job->kw - 1;
+		scale = job->sat[(by + 1) * sat_w + bx + 1] - job->sat[ay * sat_w + bx + 1] - job->sat[(by + 1) * sat_w + ax] + job->sat[ay * sat_w + ax];
+		scale /= job->sat[job->kh * sat_w + job->kw];
+		BEGIN_FOREACH_CHANNEL(n_channels)
+		line[(__x - x0) * n_channels + __c] /= scale;
+		END_FOREACH_CHANNEL
+	}
+}
+
+/**
+ * Second pass of a non-separable convolution, that writes the result as
+ * image rows. Only intended for internal usage.
+ *
+ * const __ni_image_convolve_job *job -> the convolution being run
+ * double *line -> scratch array of w * n_channels elements
+ * int y0 -> first row to convolve
+ * int y1 -> row after the last one to convolve
+ */
+static void
+__ni_image_convolve_direct_rows(const __ni_image_convolve_job *job, double *line, int y0, int y1)
+{
+	const int w = job->w;
+	const int n_channels = job->n_channels;
+	const size_t padded_len = (size_t)(w + job->kw - 1) * n_channels;
+
+	for(int __y = y0; __y < y1; __y++) {
+		ni_simd_convolve_offsets(job->data + __y * padded_len, line, (size_t)w * n_channels, job->offsets, job->taps, job->n_taps);
+		if(job->border == NI_BORDER_RENORMALIZE)
+			__ni_image_convolve_renormalize(job, line, 0, w, __y);
+		ni_simd_data_to_u8(line, job->img + __y * job->dst_stride, (size_t)w * n_channels);
+	}
+}
+
+/**
+ * Returns the number of bands to split rows in, a few per thread of the
+ * pool so the load stays balanced. Only intended for internal usage.
+ *
+ * ni_threadpool *pool -> the pool that runs the bands
+ * int rows -> number of rows
+ */
+static int
+__ni_image_convolve_bands(ni_threadpool *pool, int rows)
+{
+	const int bands = 4 * ni_threadpool_size(pool);
+	if(bands > rows)
+		return (rows > 0) ? rows : 1;
+	return bands;
+}
+
+/**
+ * Thread pool task for the first pass of one band, including the border
+ * rows. Only intended for internal usage.
+ */
+static void
+__ni_image_convolve_first_task(void *arg, int index, int n_tasks)
+{
+	const __ni_image_convolve_job *job = arg;
+	const int rows = job->h + job->kh - 1;
+	const int p0 = (int)((long long)rows * index / n_tasks);
+	const int p1 = (int)((long long)rows * (index + 1) / n_tasks);
+	if(job->h_kernel == NULL)
+		__ni_image_convolve_pad_rows(job, p0, p1);
+	else if(job->data_f32 != NULL)
+		__ni_image_convolve_rows_f32(job, job->lines_f32 + index * job->line_len, p0, p1);
+	else
+		__ni_image_convolve_rows(job, job->lines + index * job->line_len, p0, p1);
+}
+
+/**
+ * Thread pool task for the second pass of one band. Only intended for
+ * internal usage.
+ */
+static void
+__ni_image_convolve_second_task(void *arg, int index, int n_tasks)
+{
+	const __ni_image_convolve_job *job = arg;
+	const int y0 = (int)((long long)job->h * index / n_tasks);
+	const int y1 = (int)((long long)job->h * (index + 1) / n_tasks);
+	if(job->h_kernel == NULL)
+		__ni_image_convolve_direct_rows(job, job->lines + index * job->line_len, y0, y1);
+	else if(job->data_f32 != NULL)
+		__ni_image_convolve_cols_f32(job, job->lines_f32 + index * job->line_len, y0, y1);
+	else
+		__ni_image_convolve_cols(job, job->lines + index * job->line_len, y0, y1);
+}
+
+/**
+ * Returns the number of scratch lines the passes of a convolution job need,
+ * one for every task. Only intended for internal usage.
+ *
+ * ni_threadpool *pool -> the pool that runs the job
+ * int h -> image height
+ * int kh -> height of the kernel
+ */
+static int
+__ni_image_convolve_lines(ni_threadpool *pool, int h, int kh)
+{
+	// The first pass has the most bands
+	return __ni_image_convolve_bands(pool, h + kh - 1);
+}
+
+/**
+ * Runs the two passes of a convolution job in a thread pool. Only intended
+ * for internal usage.
+ *
+ * ni_threadpool *pool -> the pool that runs the job
+ * __ni_image_convolve_job *job -> the convolution, its data and lines need
+ * to be allocated already (see __ni_image_convolve_lines)
+ */
+static void
+__ni_image_convolve_run(ni_threadpool *pool, __ni_image_convolve_job *job)
+{
+	// The second pass of a band needs the first pass of the rows around it,
+	// so all the bands finish the first pass before the second
+	ni_threadpool_run(pool, __ni_image_convolve_first_task, job, __ni_image_convolve_bands(pool, job->h + job->kh - 1));
+	ni_threadpool_run(pool, __ni_image_convolve_second_task, job, __ni_image_convolve_bands(pool, job->h));
+}
+
+/**
+ * Returns the number of bytes of scratch __ni_image_convolve_separable
+ * takes. Only intended for internal usage.
+ */
+static size_t
+__ni_image_convolve_separable_scratch(ni_threadpool *pool, int w, int h, int n_channels, int kw, int kh, NI_IMAGE_BORDER border, NI_PRECISION precision)
+{
+	const size_t elem_size = (precision == NI_PRECISION_FLOAT) ? sizeof(float) : sizeof(double);
+	size_t size = ni_scratch_reserve(elem_size * w * (h + kh - 1) * n_channels);
+	size += ni_scratch_reserve(__ni_image_convolve_lines(pool, h, kh) * ni_scratch_reserve(elem_size * (w + kw - 1) * n_channels));
+	if(border == NI_BORDER_RENORMALIZE)
+		size += ni_scratch_reserve(sizeof(double) * w) + ni_scratch_reserve(sizeof(double) * h);
+	if(precision == NI_PRECISION_FLOAT)
+		size += ni_scratch_reserve(sizeof(float) * (kw + kh));
+	return size;
+}
+
+/**
+ * Convolves an image with a separable kernel, given as its row and column
+ * factors. Only intended for internal usage.
+ *
+ * ni_threadpool *pool -> the pool that runs the passes
+ * const ni_image *src -> the original image (8 bits)
+ * ni_image *dst -> output image of the same size, may be src
+ * const double *h_kernel -> row factor, kw elements
+ * int kw -> width of the kernel (odd)
+ * const double *v_kernel -> column factor, kh elements
+ * int kh -> height of the kernel (odd)
+ * NI_IMAGE_BORDER border -> border mode
+ * NI_PRECISION precision -> precision of the intermediate data
+ * ni_scratch *scratch -> scratch for the temporary buffers, may be NULL
+ *
+ * returns 1 on success, 0 if the temporary buffers could not be allocated
+ */
+static int
+__ni_image_convolve_separable(ni_threadpool *pool, const ni_image *src, ni_image *dst, const double *h_kernel, int kw, const double *v_kernel, int kh, NI_IMAGE_BORDER border, NI_PRECISION precision, ni_scratch *scratch)
+{
+	const int w = src->w;
+	const int h = src->h;
+	const int n_channels = src->n_channels;
+	const int f32 = (precision == NI_PRECISION_FLOAT);
+	const size_t elem_size = f32 ? sizeof(float) : sizeof(double);
+	const size_t data_size = elem_size * w * ((size_t)h + kh - 1) * n_channels;
+	// Every line starts aligned
+	const int n_lines = __ni_image_convolve_lines(pool, h, kh);
+	const size_t line_len = ni_scratch_reserve(elem_size * (w + kw - 1) * n_channels) / elem_size;
+	double *h_norm = NULL;
+	double *v_norm = NULL;
+	float *kernels = NULL;
+	int ok;
+	if(border == NI_BORDER_RENORMALIZE) {
+		h_norm = ni_scratch_alloc(scratch, sizeof(double) * w);
+		v_norm = ni_scratch_alloc(scratch, sizeof(double) * h);
+	}
+	if(f32)
+		kernels = ni_scratch_alloc(scratch, sizeof(float) * (kw + kh));
+
+	__ni_image_convolve_job job = {
+		.img_data = src->data,
+		.img = dst->data,
+		.src_stride = src->stride,
+		.dst_stride = dst->stride,
+		.data = f32 ? NULL : ni_scratch_alloc(scratch, data_size),
+		.w = w,
+		.h = h,
+		.n_channels = n_channels,
+		.kw = kw,
+		.kh = kh,
+		.border = border,
+		.h_kernel = h_kernel,
+		.v_kernel = v_kernel,
+		.h_norm = h_norm,
+		.v_norm = v_norm,
+		.lines = f32 ? NULL : ni_scratch_alloc(scratch, sizeof(double) * line_len * n_lines),
+		.line_len = line_len,
+		.data_f32 = f32 ? ni_scratch_alloc(scratch, data_size) : NULL,
+		.lines_f32 = f32 ? ni_scratch_alloc(scratch, sizeof(float) * line_len * n_lines) : NULL,
+		.h_kernel_f32 = kernels,
+		.v_kernel_f32 = (kernels == NULL) ? NULL : kernels + kw,
+	};
+
+	if(f32)
+		ok = job.data_f32 != NULL && job.lines_f32 != NULL && kernels != NULL;
+	else
+		ok = job.data != NULL && job.lines != NULL;
+	ok = ok && (border != NI_BORDER_RENORMALIZE || (h_norm != NULL && v_norm != NULL));
+	if(ok) {
+		if(border == NI_BORDER_RENORMALIZE) {
+			__ni_image_border_norm(h_kernel, kw, w, h_norm);
+			__ni_image_border_norm(v_kernel, kh, h, v_norm);
+		}
+		if(f32) {
+			for(int i = 0; i < kw; i++)
+				kernels[i] = (float)h_kernel[i];
+			for(int i = 0; i < kh; i++)
+				kernels[kw + i] = (float)v_kernel[i];
+		}
+		__ni_image_convolve_run(pool, &job);
+	}
+
+	ni_scratch_free(scratch, job.lines);
+	ni_scratch_free(scratch, job.data);
+	ni_scratch_free(scratch, job.lines_f32);
+	ni_scratch_free(scratch, job.data_f32);
+	ni_scratch_free(scratch, kernels);
+	ni_scratch_free(scratch, h_norm);
+	ni_scratch_free(scratch, v_norm);
+	return ok;
+}
+
+/**
+ * Calculates the summed area table of a kernel: element (x, y) of the table
+ * is the sum of the elements of the kernel above and to the left of (x, y).
+ * Only intended for internal usage.
+ *
+ * const double *kernel -> kh rows of kw elements
+ * int kw -> width of the kernel
+ * int kh -> height of the kernel
+ * double *sat -> output array of kh + 1 rows of kw + 1 elements
+ */
+static void
+__ni_image_kernel_sat(const double *kernel, int kw, int kh, double *sat)
+{
+	for(int i = 0; i <= kw; i++)
+		sat[i] = 0.0;
+	for(int y = 0; y < kh; y++) {
+		sat[(y + 1) * (kw + 1)] = 0.0;
+		for(int x = 0; x < kw; x++)
+			sat[(y + 1) * (kw + 1) + x + 1] = kernel[PX_IDX(x, y, kw, 1)] + sat[y * (kw + 1) + x + 1] + sat[(y + 1) * (kw + 1) + x] - sat[y * (kw + 1) + x];
+	}
+}
+
+/**
+ * Returns the number of bytes of scratch __ni_image_convolve_direct takes.
+ * Only intended for internal usage.
+ */
+static size_t
+__ni_image_convolve_direct_scratch(ni_threadpool *pool, int w, int h, int n_channels, int kw, int kh, NI_IMAGE_BORDER border)
+{
+	size_t size = ni_scratch_reserve(sizeof(double) * kw * kh) + ni_scratch_reserve(sizeof(ptrdiff_t) * kw * kh);
+	if(border == NI_BORDER_RENORMALIZE)
+		size += ni_scratch_reserve(sizeof(double) * (kw + 1) * (kh + 1));
+	size += ni_scratch_reserve(sizeof(double) * (w + kw - 1) * (h + kh - 1) * n_channels);
+	size += ni_scratch_reserve(__ni_image_convolve_lines(pool, h, kh) * ni_scratch_reserve(sizeof(double) * w * n_channels));
+	return size;
+}
+
+/**
+ * Convolves an image with a kernel that is not separable, visiting only the
+ * taps that are not zero. Only intended for internal usage.
+ *
+ * ni_threadpool *pool -> the pool that runs the passes
+ * const ni_image *src -> the original image (8 bits)
+ * ni_image *dst -> output image of the same size, may be src
+ * const double *kernel -> kh rows of kw elements
+ * int kw -> width of the kernel (odd)
+ * int kh -> height of the kernel (odd)
+ * NI_IMAGE_BORDER border -> border mode
+ * ni_scratch *scratch -> scratch for the temporary buffers, may be NULL
+ *
+ * returns 1 on success, 0 if the temporary buffers could not be allocated
+ */
+static int
+__ni_image_convolve_direct(ni_threadpool *pool, const ni_image *src, ni_image *dst, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, ni_scratch *scratch)
+{
+	const int w = src->w;
+	const int h = src->h;
+	const int n_channels = src->n_channels;
+	const ptrdiff_t padded_len = (ptrdiff_t)(w + kw - 1) * n_channels;
+	const int n_lines = __ni_image_convolve_lines(pool, h, kh);
+	const size_t line_len = ni_scratch_reserve(sizeof(double) * w * n_channels) / sizeof(double);
+	double *taps = ni_scratch_alloc(scratch, sizeof(double) * kw * kh);
+	ptrdiff_t *offsets = ni_scratch_alloc(scratch, sizeof(ptrdiff_t) * kw * kh);
+	double *sat = NULL;
+	double *data = ni_scratch_alloc(scratch, sizeof(double) * padded_len * ((size_t)h + kh - 1));
+	double *lines = ni_scratch_alloc(scratch, sizeof(double) * line_len * n_lines);
+	int n_taps = 0;
+	int idx;
+
+	if(border == NI_BORDER_RENORMALIZE)
+		sat = ni_scratch_alloc(scratch, sizeof(double) * (kw + 1) * (kh + 1));
+	if(taps == NULL || offsets == NULL || data == NULL || lines == NULL || (border == NI_BORDER_RENORMALIZE && sat == NULL)) {
+		ni_scratch_free(scratch, lines);
+		ni_scratch_free(scratch, data);
+		ni_scratch_free(scratch, taps);
+		ni_scratch_free(scratch, offsets);
+		ni_scratch_free(scratch, sat);
+		return 0;
+	}
+
+	BEGIN_FOREACH_PIXEL(kw, kh)
+	idx = PX_IDX(__x, __y, kw, 1);
+	if(kernel[idx] != 0.0) {
+		taps[n_taps] = kernel[idx];
+		offsets[n_taps] = __y * padded_len + __x * n_channels;
+		n_taps++;
+	}
+	END_FOREACH_PIXEL
+
+	if(border == NI_BORDER_RENORMALIZE)
+		__ni_image_kernel_sat(kernel, kw, kh, sat);
+
+	__ni_image_convolve_job job = {
+		.img_data = src->data,
+		.img = dst->data,
+		.src_stride = src->stride,
+		.dst_stride = dst->stride,
+		.data = data,
+		.w = w,
+		.h = h,
+		.n_channels = n_channels,
+		.kw = kw,
+		.kh = kh,
+		.border = border,
+		.taps = taps,
+		.offsets = offsets,
+		.n_taps = n_taps,
+		.sat = sat,
+		.lines = lines,
+		.line_len = line_len,
+	};
+	__ni_image_convolve_run(pool, &job);
+
+	ni_scratch_free(scratch, lines);
+	ni_scratch_free(scratch, data);
+	ni_scratch_free(scratch, taps);
+	ni_scratch_free(scratch, offsets);
+	ni_scratch_free(scratch, sat);
+	return 1;
+}
+
+/**
+ * Estimates the cost of the FFT method and finds the FFT size of the tiles
+ * that makes it the cheapest. Only intended for internal usage.
+ *
+ * int w -> image width
+ * int h -> image height
+ * int n_channels -> number of channels of the image
+ * int kw -> width of the kernel
+ * int kh -> height of the kernel
+ * int *fft_w -> output, width of the FFT of the tiles
+ * int *fft_h -> output, height of the FFT of the tiles
+ *
+ * returns the cost, in taps of the direct method
+ */
+static double
+__ni_image_convolve_fft_cost(int w, int h, int n_channels, int kw, int kh, int *fft_w, int *fft_h)
+{
+	const int max_w = ni_fft_size(kw) > NI_CONVOLVE_FFT_MAX_SIZE ? ni_fft_size(kw) : NI_CONVOLVE_FFT_MAX_SIZE;
+	const int max_h = ni_fft_size(kh) > NI_CONVOLVE_FFT_MAX_SIZE ? ni_fft_size(kh) : NI_CONVOLVE_FFT_MAX_SIZE;
+	double best = -1.0;
+	double tiles, cost;
+
+	*fft_w = ni_fft_size(kw < 2 ? 2 : kw);
+	*fft_h = ni_fft_size(kh < 2 ? 2 : kh);
+	// Larger tiles waste less of every FFT on the margin, but every element
+	// costs more. Sizes past the one that fits the image in a single tile
+	// only add work
+	for(int fw = ni_fft_size(kw < 2 ? 2 : kw); fw <= max_w; fw <<= 1) {
+		for(int fh = ni_fft_size(kh < 2 ? 2 : kh); fh <= max_h; fh <<= 1) {
+			tiles = ceil((double)w / (fw - kw + 1)) * ceil((double)h / (fh - kh + 1));
+			cost = NI_CONVOLVE_FFT_COST * tiles * n_channels * fw * fh * (log2((double)fw * fh) + 1.0);
+			if(best < 0.0 || cost < best) {
+				best = cost;
+				*fft_w = fw;
+				*fft_h = fh;
+			}
+			if(fh - kh + 1 >= h)
+				break;
+		}
+		if(fw - kw + 1 >= w)
+			break;
+	}
+	return best;
+}
+
+/**
+ * Thread pool task for a band of tiles of the FFT method. Only intended for
+ * internal usage.
+ *
+ * Every channel of a tile is read with the border around it, transformed
+ * by rows (real) and then by columns (complex), multiplied by the spectrum
+ * of the kernel, and transformed back. The columns are transformed back and
+ * forth while they are gathered, and only the rows that do not wrap around
+ * are transformed back.
+ */
+static void
+__ni_image_convolve_fft_task(void *arg, int index, int n_tasks)
+{
+	const __ni_image_convolve_job *job = arg;
+	const int w = job->w;
+	const int h = job->h;
+	const int n_channels = job->n_channels;
+	const int fft_w = job->fft_w;
+	const int fft_h = job->fft_h;
+	const int tile_w = fft_w - job->kw + 1;
+	const int tile_h = fft_h - job->kh + 1;
+	const int tiles_x = (w + tile_w - 1) / tile_w;
+	const int n_tiles = tiles_x * ((h + tile_h - 1) / tile_h);
+	const int t0 = (int)((long long)n_tiles * index / n_tasks);
+	const int t1 = (int)((long long)n_tiles * (index + 1) / n_tasks);
+	const int row_len = fft_w + 2;
+
+	// The line of the task holds the block, a column, the output tile and
+	// the source column of every element of the block
+	double *block = job->lines + index * job->line_len;
+	double *col = block + row_len * fft_h;
+	double *out = col + 2 * fft_h;
+	int *xs = (int *)(out + tile_w * tile_h * n_channels);
+	const stbi_uc *src;
+	const double *k;
+	double *row, *z, re;
+	int x0, y0, tw, th, ys;
+
+	for(int t = t0; t < t1; t++) {
+		x0 = (t % tiles_x) * tile_w;
+		y0 = (t / tiles_x) * tile_h;
+		tw = (w - x0 < tile_w) ? w - x0 : tile_w;
+		th = (h - y0 < tile_h) ? h - y0 : tile_h;
+		for(int q = 0; q < fft_w; q++)
+			xs[q] = ni_image_border_index(x0 + q - job->kw / 2, w, job->border);
+
+		BEGIN_FOREACH_CHANNEL(n_channels)
+		// -- ROWS --
+		for(int p = 0; p < fft_h; p++) {
+			row = block + p * row_len;
+			ys = ni_image_border_index(y0 + p - job->kh / 2, h, job->border);
+			if(ys < 0) {
+				memset(row, 0, row_len * sizeof(double));
+				continue;
+			}
+			src = job->img_data + ys * job->src_stride + __c;
+			for(int q = 0; q < fft_w; q++)
+				row[q] = (xs[q] < 0) ? 0.0 : src[xs[q] * n_channels];
+			ni_fft_forward_real(job->plan_x, row);
+		}
+
+		// -- COLUMNS --
+		for(int i = 0; i <= fft_w / 2; i++) {
+			for(int p = 0; p < fft_h; p++) {
+				col[2 * p] = block[p * row_len + 2 * i];
+				col[2 * p + 1] = block[p * row_len + 2 * i + 1];
+			}
+			ni_fft_complex(job->plan_y, col, fft_h, 0);
+			for(int p = 0; p < fft_h; p++) {
+				k = job->spectrum + p * row_len + 2 * i;
+				z = col + 2 * p;
+				re = z[0] * k[0] - z[1] * k[1];
+				z[1] = z[0] * k[1] + z[1] * k[0];
+				z[0] = re;
+			}
+			ni_fft_complex(job->plan_y, col, fft_h, 1);
+			for(int p = job->kh - 1; p < job->kh - 1 + th; p++) {
+				block[p * row_len + 2 * i] = col[2 * p];
+				block[p * row_len + 2 * i + 1] = col[2 * p + 1];
+			}
+		}
+
+		// -- INVERSE ROWS --
+		for(int p = 0; p < th; p++) {
+			row = block + (job->kh - 1 + p) * row_len;
+			ni_fft_inverse_real(job->plan_x, row);
+			for(int q = 0; q < tw; q++)
+				out[(p * tw + q) * n_channels + __c] = row[job->kw - 1 + q];
+		}
+		END_FOREACH_CHANNEL
+
+		for(int p = 0; p < th; p++) {
+			if(job->border == NI_BORDER_RENORMALIZE)
+				__ni_image_convolve_renormalize(job, out + p * tw * n_channels, x0, x0 + tw, y0 + p);
+			ni_simd_data_to_u8(out + p * tw * n_channels, job->img + (y0 + p) * job->dst_stride + (ptrdiff_t)x0 * n_channels, (size_t)tw * n_channels);
+		}
+	}
+
+}
+
+/**
+ * Returns the number of doubles of scratch every task of the FFT method
+ * takes. Only intended for internal usage.
+ */
+static size_t
+__ni_image_convolve_fft_line_len(int n_channels, int kw, int kh, int fft_w, int fft_h)
+{
+	// Block, column, output tile and source columns (as ints)
+	const size_t len = (size_t)(fft_w + 2) * fft_h + 2 * fft_h + (size_t)(fft_w - kw + 1) * (fft_h - kh + 1) * n_channels + fft_w;
+	return ni_scratch_reserve(sizeof(double) * len) / sizeof(double);
+}
+
+/**
+ * Returns the number of FFT tiles of an image. Only intended for internal
+ * usage.
+ */
+static int
+__ni_image_convolve_fft_tiles(int w, int h, int kw, int kh, int fft_w, int fft_h)
+{
+	const int tile_w = fft_w - kw + 1;
+	const int tile_h = fft_h - kh + 1;
+	return ((w + tile_w - 1) / tile_w) * ((h + tile_h - 1) / tile_h);
+}
+
+/**
+ * Returns the number of bytes of scratch __ni_image_convolve_fft takes.
+ * Only intended for internal usage.
+ */
+static size_t
+__ni_image_convolve_fft_scratch(ni_threadpool *pool, int w, int h, int n_channels, int kw, int kh, NI_IMAGE_BORDER border, int fft_w, int fft_h)
+{
+	const int n_tasks = __ni_image_convolve_bands(pool, __ni_image_convolve_fft_tiles(w, h, kw, kh, fft_w, fft_h));
+	size_t size = ni_scratch_reserve(ni_fft_plan_bytes(fft_w)) + ni_scratch_reserve(ni_fft_plan_bytes(fft_h));
+	size += ni_scratch_reserve(sizeof(double) * (fft_w + 2) * fft_h) + ni_scratch_reserve(sizeof(double) * 2 * fft_h);
+	if(border == NI_BORDER_RENORMALIZE)
+		size += ni_scratch_reserve(sizeof(double) * (kw + 1) * (kh + 1));
+	size += ni_scratch_reserve(sizeof(double) * n_tasks * __ni_image_convolve_fft_line_len(n_channels, kw, kh, fft_w, fft_h));
+	return size;
+}
+
+/**
+ * Convolves an image with a kernel using the FFT method. Only intended for
+ * internal usage.
+ *
+ * ni_threadpool *pool -> the pool that runs the tiles
+ * const ni_image *src -> the original image (8 bits)
+ * ni_image *dst -> output image of the same size, it can not share memory
+ * with src
+ * const double *kernel -> kh rows of kw elements
+ * int kw -> width of the kernel (odd)
+ * int kh -> height of the kernel (odd)
+ * NI_IMAGE_BORDER border -> border mode
+ * int fft_w -> width of the FFT of the tiles, a power of two >= kw
+ * int fft_h -> height of the FFT of the tiles, a power of two >= kh
+ * ni_scratch *scratch -> scratch for the temporary buffers, may be NULL
+ *
+ * returns 1 on success, 0 if the temporary buffers could not be allocated
+ */
+static int
+__ni_image_convolve_fft(ni_threadpool *pool, const ni_image *src, ni_image *dst, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, int fft_w, int fft_h, ni_scratch *scratch)
+{
+	const int w = src->w;
+	const int h = src->h;
+	const int n_channels = src->n_channels;
+	const int row_len = fft_w + 2;
+	const int n_tasks = __ni_image_convolve_bands(pool, __ni_image_convolve_fft_tiles(w, h, kw, kh, fft_w, fft_h));
+	const size_t line_len = __ni_image_convolve_fft_line_len(n_channels, kw, kh, fft_w, fft_h);
+	void *plan_x_mem = ni_scratch_alloc(scratch, ni_fft_plan_bytes(fft_w));
+	void *plan_y_mem = ni_scratch_alloc(scratch, ni_fft_plan_bytes(fft_h));
+	ni_fft_plan *plan_x = ni_fft_plan_init(plan_x_mem, fft_w);
+	ni_fft_plan *plan_y = ni_fft_plan_init(plan_y_mem, fft_h);
+	double *spectrum = ni_scratch_alloc(scratch, sizeof(double) * row_len * fft_h);
+	double *col = ni_scratch_alloc(scratch, sizeof(double) * 2 * fft_h);
+	double *lines = ni_scratch_alloc(scratch, sizeof(double) * n_tasks * line_len);
+	double *sat = NULL;
+	// Pixels are not normalized when they are read, and the transforms are
+	// not normalized either: both scales go into the kernel
+	const double scale = 1.0 / (255.0 * fft_w * fft_h);
+
+	if(border == NI_BORDER_RENORMALIZE)
+		sat = ni_scratch_alloc(scratch, sizeof(double) * (kw + 1) * (kh + 1));
+	if(plan_x == NULL || plan_y == NULL || spectrum == NULL || col == NULL || lines == NULL || (border == NI_BORDER_RENORMALIZE && sat == NULL)) {
+		ni_scratch_free(scratch, lines);
+		ni_scratch_free(scratch, sat);
+		ni_scratch_free(scratch, spectrum);
+		ni_scratch_free(scratch, col);
+		ni_scratch_free(scratch, plan_x_mem);
+		ni_scratch_free(scratch, plan_y_mem);
+		return 0;
+	}
+
+	// -- KERNEL SPECTRUM --
+	// The kernel is applied without flipping it, which is a convolution
+	// with the flipped kernel
+	memset(spectrum, 0, sizeof(double) * row_len * fft_h);
+	BEGIN_FOREACH_PIXEL(kw, kh)
+	spectrum[__y * row_len + __x] = kernel[PX_IDX(kw - 1 - __x, kh - 1 - __y, kw, 1)] * scale;
+	END_FOREACH_PIXEL
+	for(int p = 0; p < fft_h; p++)
+		ni_fft_forward_real(plan_x, spectrum + p * row_len);
+	for(int i = 0; i <= fft_w / 2; i++) {
+		for(int p = 0; p < fft_h; p++) {
+			col[2 * p] = spectrum[p * row_len + 2 * i];
+			col[2 * p + 1] = spectrum[p * row_len + 2 * i + 1];
+		}
+		ni_fft_complex(plan_y, col, fft_h, 0);
+		for(int p = 0; p < fft_h; p++) {
+			spectrum[p * row_len + 2 * i] = col[2 * p];
+			spectrum[p * row_len + 2 * i + 1] = col[2 * p + 1];
+		}
+	}
+
+	if(border == NI_BORDER_RENORMALIZE)
+		__ni_image_kernel_sat(kernel, kw, kh, sat);
+
+	__ni_image_convolve_job job = {
+		.img_data = src->data,
+		.img = dst->data,
+		.src_stride = src->stride,
+		.dst_stride = dst->stride,
+		.w = w,
+		.h = h,
+		.n_channels = n_channels,
+		.kw = kw,
+		.kh = kh,
+		.border = border,
+		.sat = sat,
+		.plan_x = plan_x,
+		.plan_y = plan_y,
+		.fft_w = fft_w,
+		.fft_h = fft_h,
+		.spectrum = spectrum,
+		.lines = lines,
+		.line_len = line_len,
+	};
+
+	ni_threadpool_run(pool, __ni_image_convolve_fft_task, &job, n_tasks);
+
+	ni_scratch_free(scratch, lines);
+	ni_scratch_free(scratch, sat);
+	ni_scratch_free(scratch, spectrum);
+	ni_scratch_free(scratch, col);
+	ni_scratch_free(scratch, plan_x_mem);
+	ni_scratch_free(scratch, plan_y_mem);
+	return 1;
+}
+
+int
+ni_image_kernel_separate(const double *kernel, int kw, int kh, double *row, double *col)
+{
+	// The largest element is the pivot: its row and its column are the
+	// factors, scaled so that their product gives back the pivot
+	int px = 0, py = 0;
+	double max = 0.0;
+	BEGIN_FOREACH_PIXEL(kw, kh)
+	if(fabs(kernel[PX_IDX(__x, __y, kw, 1)]) > max) {
+		max = fabs(kernel[PX_IDX(__x, __y, kw, 1)]);
+		px = __x;
+		py = __y;
+	}
+	END_FOREACH_PIXEL
+	if(max == 0.0)
+		return 0;
+
+	const double pivot = kernel[PX_IDX(px, py, kw, 1)];
+	const double tolerance = max * NI_CONVOLVE_SEPARABLE_EPSILON;
+	double r, c;
+	BEGIN_FOREACH_PIXEL(kw, kh)
+	r = kernel[PX_IDX(__x, py, kw, 1)] / pivot;
+	c = kernel[PX_IDX(px, __y, kw, 1)];
+	if(fabs(kernel[PX_IDX(__x, __y, kw, 1)] - (r * c)) > tolerance)
+		return 0;
+	END_FOREACH_PIXEL
+
+	if(row != NULL)
+		for(int x = 0; x < kw; x++)
+			row[x] = kernel[PX_IDX(x, py, kw, 1)] / pivot;
+	if(col != NULL)
+		for(int y = 0; y < kh; y++)
+			col[y] = kernel[PX_IDX(px, y, kw, 1)];
+	return 1;
+}
+
+/**
+ * Picks the method a kernel is applied with. Only intended for internal
+ * usage.
+ *
+ * int separable -> if the kernel is separable
+ * NI_CONVOLVE_METHOD method -> method asked for
+ * int in_place -> if the output shares memory with the input. The FFT tiles
+ * write their result while the next ones still read their margins, so
+ * this always picks NI_CONVOLVE_DIRECT
+ * int *fft_w -> output, width of the FFT of the tiles
+ * int *fft_h -> output, height of the FFT of the tiles
+ *
+ * returns NI_CONVOLVE_DIRECT or NI_CONVOLVE_FFT
+ */
+static NI_CONVOLVE_METHOD
+__ni_image_convolve_choose(int w, int h, int n_channels, const double *kernel, int kw, int kh, int separable, NI_CONVOLVE_METHOD method, int in_place, int *fft_w, int *fft_h)
+{
+	const double fft_cost = __ni_image_convolve_fft_cost(w, h, n_channels, kw, kh, fft_w, fft_h);
+	int n_taps = 0;
+
+	if(in_place)
+		return NI_CONVOLVE_DIRECT;
+	if(method != NI_CONVOLVE_AUTO)
+		return method;
+	// Separable kernels are always cheaper as two passes
+	if(separable)
+		return NI_CONVOLVE_DIRECT;
+	for(int i = 0; i < kw * kh; i++)
+		n_taps += (kernel[i] != 0.0);
+	if(fft_cost < (double)w * h * n_channels * n_taps)
+		return NI_CONVOLVE_FFT;
+	return NI_CONVOLVE_DIRECT;
+}
+
+stbi_uc *
+ni_image_convolve(const stbi_uc *img_data, int w, int h, int n_channels, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border)
+{
+	return ni_image_convolve_method(img_data, w, h, n_channels, kernel, kw, kh, border, NI_CONVOLVE_AUTO);
+}
+
+stbi_uc *
+ni_image_convolve_method(const stbi_uc *img_data, int w, int h, int n_channels, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, NI_CONVOLVE_METHOD method)
+{
+	stbi_uc *img = ni_image_create(w, h, n_channels);
+	if(ni_image_convolve_into(img_data, w, h, n_channels, kernel, kw, kh, border, method, img, NULL, 0) == NULL) {
+		ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+/**
+ * Returns the number of bytes of scratch __ni_image_convolve_apply takes,
+ * in_place tells if the output shares memory with the input. Only intended
+ * for internal usage.
+ */
+static size_t
+__ni_image_convolve_scratch(ni_threadpool *pool, int w, int h, int n_channels, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, NI_CONVOLVE_METHOD method, NI_PRECISION precision, int in_place)
+{
+	const int separable = ni_image_kernel_separate(kernel, kw, kh, NULL, NULL);
+	size_t size = NI_SCRATCH_ALIGNMENT + ni_scratch_reserve(sizeof(double) * kw) + ni_scratch_reserve(sizeof(double) * kh);
+	int fft_w = 0, fft_h = 0;
+
+	if(__ni_image_convolve_choose(w, h, n_channels, kernel, kw, kh, separable, method, in_place, &fft_w, &fft_h) == NI_CONVOLVE_FFT)
+		size += __ni_image_convolve_fft_scratch(pool, w, h, n_channels, kw, kh, border, fft_w, fft_h);
+	else if(separable)
+		size += __ni_image_convolve_separable_scratch(pool, w, h, n_channels, kw, kh, border, precision);
+	else
+		size += __ni_image_convolve_direct_scratch(pool, w, h, n_channels, kw, kh, border);
+	return size;
+}
+
+/**
+ * Convolves an image with a kernel, with the method asked for or the one
+ * the cost model picks. Only intended for internal usage.
+ *
+ * ni_threadpool *pool -> the pool that runs the convolution
+ * const ni_image *src -> the original image (8 bits)
+ * ni_image *dst -> output image of the same size
+ * NI_PRECISION precision -> precision of the separable passes
+ * ni_scratch *scratch -> scratch for the temporary buffers
+ *
+ * The rest of the arguments are the ones of ni_image_convolve_method.
+ *
+ * returns 1 on success, 0 if the temporary buffers could not be allocated
+ */
+static int
+__ni_image_convolve_apply(ni_threadpool *pool, const ni_image *src, ni_image *dst, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, NI_CONVOLVE_METHOD method, NI_PRECISION precision, ni_scratch *scratch)
+{
+	double *row = ni_scratch_alloc(scratch, sizeof(double) * kw);
+	double *col = ni_scratch_alloc(scratch, sizeof(double) * kh);
+	int separable, fft_w = 0, fft_h = 0, ok;
+
+	if(row == NULL || col == NULL) {
+		ni_scratch_free(scratch, row);
+		ni_scratch_free(scratch, col);
+		return 0;
+	}
+
+	separable = ni_image_kernel_separate(kernel, kw, kh, row, col);
+	if(__ni_image_convolve_choose(src->w, src->h, src->n_channels, kernel, kw, kh, separable, method, __ni_image_views_overlap(src, dst), &fft_w, &fft_h) == NI_CONVOLVE_FFT)
+		ok = __ni_image_convolve_fft(pool, src, dst, kernel, kw, kh, border, fft_w, fft_h, scratch);
+	else if(separable)
+		ok = __ni_image_convolve_separable(pool, src, dst, row, kw, col, kh, border, precision, scratch);
+	else
+		ok = __ni_image_convolve_direct(pool, src, dst, kernel, kw, kh, border, scratch);
+
+	ni_scratch_free(scratch, row);
+	ni_scratch_free(scratch, col);
+	return ok;
+}
+
+size_t
+ni_image_convolve_scratch_size(int w, int h, int n_channels, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, NI_CONVOLVE_METHOD method)
+{
+	// ERROR: the kernel has no center
+	if(kw <= 0 || kh <= 0 || kw % 2 == 0 || kh % 2 == 0)
+		return 0;
+
+	// Enough for both methods, the output can be the input
+	const size_t size = __ni_image_convolve_scratch(ni_threadpool_default(), w, h, n_channels, kernel, kw, kh, border, method, NI_DEFAULT_PRECISION, 0);
+	const size_t in_place_size = __ni_image_convolve_scratch(ni_threadpool_default(), w, h, n_channels, kernel, kw, kh, border, method, NI_DEFAULT_PRECISION, 1);
+	return (size > in_place_size) ? size : in_place_size;
+}
+
+stbi_uc *
+ni_image_convolve_into(const stbi_uc *img_data, int w, int h, int n_channels, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, NI_CONVOLVE_METHOD method, stbi_uc *out, void *scratch, size_t scratch_size)
+{
+	// ERROR: the kernel has no center
+	if(kw <= 0 || kh <= 0 || kw % 2 == 0 || kh % 2 == 0)
+		return NULL;
+	// ERROR: no output
+	if(out == NULL)
+		return NULL;
+
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(out, w, h, n_channels, NI_PIXEL_U8);
+	ni_scratch s = ni_scratch_init(scratch, scratch_size);
+	// ERROR: out of memory
+	if(!__ni_image_convolve_apply(ni_threadpool_default(), &src, &dst, kernel, kw, kh, border, method, NI_DEFAULT_PRECISION, &s))
+		return NULL;
+	return out;
+}
+
+stbi_uc *
+ni_image_convolve_ctx(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, NI_CONVOLVE_METHOD method, stbi_uc *out)
+{
+	stbi_uc *img = (out == NULL) ? ni_image_create(w, h, n_channels) : out;
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(img, w, h, n_channels, NI_PIXEL_U8);
+	if(ni_image_convolve_view(ctx, &src, &dst, kernel, kw, kh, border, method) == NULL) {
+		if(out == NULL)
+			ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+ni_image *
+ni_image_convolve_view(ni_context *ctx, const ni_image *src, ni_image *dst, const double *kernel, int kw, int kh, NI_IMAGE_BORDER border, NI_CONVOLVE_METHOD method)
+{
+	// ERROR: the kernel has no center
+	if(kw <= 0 || kh <= 0 || kw % 2 == 0 || kh % 2 == 0)
+		return NULL;
+	// ERROR: the images do not match
+	if(!__ni_image_views_match(src, dst, src->n_channels))
+		return NULL;
+
+	ni_threadpool *pool = ni_context_threadpool(ctx);
+	const NI_PRECISION precision = ni_context_precision(ctx);
+	ni_scratch s = ni_context_scratch_begin(ctx, __ni_image_convolve_scratch(pool, src->w, src->h, src->n_channels, kernel, kw, kh, border, method, precision, __ni_image_views_overlap(src, dst)));
+	const int ok = __ni_image_convolve_apply(pool, src, dst, kernel, kw, kh, border, method, precision, &s);
+	ni_context_scratch_end(ctx, &s);
+	// ERROR: out of memory
+	return ok ? dst : NULL;
+}
+
+#endif // NI_CONVOLVE_IMPLEMENTATION
+
+#endif // NI_INCLUDE_CONVOLVE
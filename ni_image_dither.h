@@ -8,6 +8,26 @@
 #include "ni_image_utils.h"
 #endif
 
+#ifndef NI_INCLUDE_SIMD
+#define NI_SIMD_IMPLEMENTATION
+#include "ni_image_simd.h"
+#endif
+
+#ifndef NI_INCLUDE_THREADPOOL
+#define NI_THREADPOOL_IMPLEMENTATION
+#include "ni_image_threadpool.h"
+#endif
+
+#ifndef NI_INCLUDE_CONTEXT
+#define NI_CONTEXT_IMPLEMENTATION
+#include "ni_image_context.h"
+#endif
+
+#ifndef NI_INCLUDE_GRAYSCALE
+#define NI_GRAYSCALE_IMPLEMENTATION
+#include "ni_image_grayscale.h"
+#endif
+
 // = DECLARATION =
 
 /**
@@ -19,12 +39,466 @@
  * w -> width of the original image
  * h -> height of the original image
  *
+ * With NI_PRECISION_FLOAT the error is diffused in single precision. The
+ * amount of white stays the same, but a value that lands on the 0.5
+ * threshold can go the other way and the difference moves the dots after
+ * it: some pixels (0.2% of a smooth gradient) can be black instead of white
+ * or the other way around compared to NI_PRECISION_DOUBLE.
+ *
+ * The image is dithered a row at a time and the error is only kept for the
+ * row being dithered and the next one, so the temporary buffer is 2 * w
+ * values.
+ *
  * returns a new, dithered image which needs to be freed separately.
  */
 stbi_uc *ni_image_dither_floydsteinberg_gray2mono(const stbi_uc *img_data,
 	int w,
 	int h);
 
+/**
+ * Same as ni_image_dither_floydsteinberg_gray2mono but the result is written
+ * to an image owned by the caller, and the temporary buffer is taken from a
+ * scratch owned by the caller too (see ni_scratch in ni_image_utils.h). With
+ * a scratch of ni_image_dither_floydsteinberg_gray2mono_scratch_size bytes,
+ * nothing is allocated.
+ *
+ * img_data -> pointer to the data of the original image
+ * w -> width of the original image
+ * h -> height of the original image
+ * out -> output image of w * h bytes, may be img_data
+ * scratch -> scratch memory, may be NULL
+ * scratch_size -> size of the scratch memory in bytes
+ *
+ * returns out or NULL on error.
+ */
+stbi_uc *ni_image_dither_floydsteinberg_gray2mono_into(const stbi_uc *img_data,
+	int w,
+	int h,
+	stbi_uc *out,
+	void *scratch,
+	size_t scratch_size);
+
+/**
+ * Returns the number of bytes of scratch
+ * ni_image_dither_floydsteinberg_gray2mono_into needs to not allocate
+ * anything.
+ *
+ * w -> width of the image
+ * h -> height of the image, the scratch does not depend on it
+ */
+size_t ni_image_dither_floydsteinberg_gray2mono_scratch_size(int w, int h);
+
+/**
+ * Same as ni_image_dither_floydsteinberg_gray2mono but the temporary buffer
+ * is taken from the scratch of a context (see ni_image_context.h).
+ *
+ * ctx -> the context, NULL uses the defaults
+ * img_data -> pointer to the data of the original image
+ * w -> width of the original image
+ * h -> height of the original image
+ * out -> output image of w * h bytes (may be img_data), or NULL to return a
+ * new one that needs to be freed separately
+ *
+ * returns out (or the new image) or NULL on error.
+ */
+stbi_uc *ni_image_dither_floydsteinberg_gray2mono_ctx(ni_context *ctx,
+	const stbi_uc *img_data,
+	int w,
+	int h,
+	stbi_uc *out);
+
+/**
+ * Same as ni_image_dither_floydsteinberg_gray2mono_ctx but on image
+ * descriptors, so a region of a larger image can be dithered without
+ * copying it (see ni_image_view in ni_image_utils.h). The error is not
+ * diffused outside of the region.
+ *
+ * ctx -> the context, NULL uses the defaults
+ * src -> the original image, NI_PIXEL_U8 with 1 channel
+ * dst -> output image of the same size, may be src
+ *
+ * returns dst or NULL on error.
+ *
+ * Error conditions:
+ *  -> the images are not NI_PIXEL_U8 with 1 channel or their sizes do not
+ *  match
+ *  -> the temporary buffer could not be allocated
+ */
+ni_image *ni_image_dither_floydsteinberg_gray2mono_view(ni_context *ctx,
+	const ni_image *src,
+	ni_image *dst);
+
+/**
+ * Number of fractional bits of the error of
+ * ni_image_dither_floydsteinberg_gray2mono_fixed
+ */
+#define NI_DITHER_FIXED_BITS 4
+
+/**
+ * Same as ni_image_dither_floydsteinberg_gray2mono using integer arithmetic
+ * only. It is ni_image_dither_diffusion_gray2mono with
+ * NI_DITHER_FLOYD_STEINBERG and no serpentine scan, so it also runs on the
+ * threads of the pool with the same result.
+ *
+ * The values are kept in int16_t with NI_DITHER_FIXED_BITS fractional bits
+ * straight from the image bytes (255 << NI_DITHER_FIXED_BITS is white).
+ * The 1/16, 3/16 and 5/16 of the error are divided with rounding shifts
+ * and the 7/16 is what is left, so no error is lost. The values are
+ * clamped between black and white after every add as with the floating
+ * point versions. There is no floating point work at all, so the result is
+ * the same on every platform and with every compiler.
+ *
+ * The rounding of the shares gives a different pattern than
+ * ni_image_dither_floydsteinberg_gray2mono (any difference in the error
+ * moves the dots after it), but the amount of white stays the same: flat
+ * grays come out within 0.25 levels of the original.
+ *
+ * img_data -> pointer to the data of the original image
+ * w -> width of the original image
+ * h -> height of the original image
+ *
+ * returns a new, dithered image which needs to be freed separately, or
+ * NULL on error.
+ */
+stbi_uc *ni_image_dither_floydsteinberg_gray2mono_fixed(const stbi_uc *img_data,
+	int w,
+	int h);
+
+/**
+ * Same as ni_image_dither_floydsteinberg_gray2mono_fixed but with an output
+ * image and a scratch owned by the caller (see
+ * ni_image_dither_floydsteinberg_gray2mono_into).
+ *
+ * out -> output image of w * h bytes, may be img_data
+ * scratch -> scratch memory, may be NULL
+ * scratch_size -> size of the scratch memory in bytes
+ *
+ * returns out or NULL on error.
+ */
+stbi_uc *ni_image_dither_floydsteinberg_gray2mono_fixed_into(const stbi_uc *img_data,
+	int w,
+	int h,
+	stbi_uc *out,
+	void *scratch,
+	size_t scratch_size);
+
+/**
+ * Returns the number of bytes of scratch
+ * ni_image_dither_floydsteinberg_gray2mono_fixed_into needs to not allocate
+ * anything, with the default thread pool.
+ *
+ * w -> width of the image
+ * h -> height of the image
+ */
+size_t ni_image_dither_floydsteinberg_gray2mono_fixed_scratch_size(int w, int h);
+
+/**
+ * Same as ni_image_dither_floydsteinberg_gray2mono_fixed but the temporary
+ * buffer is taken from the scratch of a context (see
+ * ni_image_dither_floydsteinberg_gray2mono_ctx).
+ */
+stbi_uc *ni_image_dither_floydsteinberg_gray2mono_fixed_ctx(ni_context *ctx,
+	const stbi_uc *img_data,
+	int w,
+	int h,
+	stbi_uc *out);
+
+/**
+ * Same as ni_image_dither_floydsteinberg_gray2mono_fixed_ctx but on image
+ * descriptors (see ni_image_dither_floydsteinberg_gray2mono_view). dst may
+ * be src.
+ */
+ni_image *ni_image_dither_floydsteinberg_gray2mono_fixed_view(ni_context *ctx,
+	const ni_image *src,
+	ni_image *dst);
+
+/**
+ * Error diffusion kernels of ni_image_dither_diffusion_gray2mono, with the
+ * weights of the pixels after the current one (X) and of the rows below it
+ */
+typedef enum __NI_IMAGE_DITHER_KERNEL {
+	NI_DITHER_FLOYD_STEINBERG, // X 7 / 3 5 1, over 16
+	NI_DITHER_JARVIS_JUDICE_NINKE, // X 7 5 / 3 5 7 5 3 / 1 3 5 3 1, over 48
+	NI_DITHER_STUCKI, // X 8 4 / 2 4 8 4 2 / 1 2 4 2 1, over 42
+	NI_DITHER_ATKINSON, // X 1 1 / 1 1 1 / 1, over 8 (3/4 of the error)
+	NI_DITHER_BURKES, // X 8 4 / 2 4 8 4 2, over 32
+	NI_DITHER_SIERRA, // X 5 3 / 2 4 5 4 2 / 2 3 2, over 32
+	NI_DITHER_SIERRA_TWO_ROW, // X 4 3 / 1 2 3 2 1, over 16
+	NI_DITHER_SIERRA_LITE, // X 2 / 1 1, over 4
+} NI_IMAGE_DITHER_KERNEL;
+
+/**
+ * Creates and returns a monochromatic (black and white) image that is the
+ * result of an error diffusion dithering of the original image, which
+ * should be grayscale (1 channel).
+ *
+ * It uses the integer arithmetic of
+ * ni_image_dither_floydsteinberg_gray2mono_fixed with any of the kernels:
+ * the shares are rounded divisions of the error by the divisor of the
+ * kernel (shifts for the powers of two) and the next pixel of the row gets
+ * what is left, so the result is the same on every platform. Every kernel
+ * is compiled on its own, with the matrix unrolled into a loop with no
+ * branches, and the error that falls outside of the image goes to padding
+ * around the rows. Only three rows are kept, so the temporary buffer is
+ * 3 * (w + 6) int16_t.
+ *
+ * With a thread pool of more than one thread the rows are dithered in a
+ * wavefront: the threads take the rows in order and every row trails the
+ * one above it by a few pixels, waiting on its progress with a counter
+ * every 64 pixels. A pixel still gets all its error, in the same order,
+ * before it is dithered, so the result is the same as with one thread.
+ * The temporary buffer is then 3 rows more than the threads, plus a
+ * counter per row. Images narrower than 128 pixels are dithered serially.
+ *
+ * With serpentine the odd rows are scanned right to left with the matrix
+ * mirrored, which breaks up the diagonal patterns of a fixed direction.
+ * A row then starts where the row above ends, so the serpentine scan is
+ * always serial.
+ *
+ * img_data -> pointer to the data of the original image
+ * w -> width of the original image
+ * h -> height of the original image
+ * kernel -> the diffusion matrix
+ * serpentine -> 1 for a serpentine scan, 0 to scan every row left to right
+ *
+ * returns a new, dithered image which needs to be freed separately, or
+ * NULL on error.
+ *
+ * Error conditions:
+ *  -> kernel is not a valid kernel
+ *  -> the image or its temporary buffer could not be allocated
+ */
+stbi_uc *ni_image_dither_diffusion_gray2mono(const stbi_uc *img_data,
+	int w,
+	int h,
+	NI_IMAGE_DITHER_KERNEL kernel,
+	int serpentine);
+
+/**
+ * Same as ni_image_dither_diffusion_gray2mono but with an output image and
+ * a scratch owned by the caller (see
+ * ni_image_dither_floydsteinberg_gray2mono_into).
+ *
+ * out -> output image of w * h bytes, may be img_data
+ * scratch -> scratch memory, may be NULL
+ * scratch_size -> size of the scratch memory in bytes
+ *
+ * returns out or NULL on error.
+ */
+stbi_uc *ni_image_dither_diffusion_gray2mono_into(const stbi_uc *img_data,
+	int w,
+	int h,
+	NI_IMAGE_DITHER_KERNEL kernel,
+	int serpentine,
+	stbi_uc *out,
+	void *scratch,
+	size_t scratch_size);
+
+/**
+ * Returns the number of bytes of scratch
+ * ni_image_dither_diffusion_gray2mono_into needs to not allocate anything,
+ * for any kernel and scan, with the default thread pool.
+ *
+ * w -> width of the image
+ * h -> height of the image
+ */
+size_t ni_image_dither_diffusion_gray2mono_scratch_size(int w, int h);
+
+/**
+ * Same as ni_image_dither_diffusion_gray2mono but the temporary buffer is
+ * taken from the scratch of a context (see
+ * ni_image_dither_floydsteinberg_gray2mono_ctx).
+ */
+stbi_uc *ni_image_dither_diffusion_gray2mono_ctx(ni_context *ctx,
+	const stbi_uc *img_data,
+	int w,
+	int h,
+	NI_IMAGE_DITHER_KERNEL kernel,
+	int serpentine,
+	stbi_uc *out);
+
+/**
+ * Same as ni_image_dither_diffusion_gray2mono_ctx but on image descriptors
+ * (see ni_image_dither_floydsteinberg_gray2mono_view). dst may be src.
+ */
+ni_image *ni_image_dither_diffusion_gray2mono_view(ni_context *ctx,
+	const ni_image *src,
+	ni_image *dst,
+	NI_IMAGE_DITHER_KERNEL kernel,
+	int serpentine);
+
+/**
+ * Converts a color image to grayscale and dithers it with Floyd-Steinberg
+ * in a single pass, giving the same image as
+ * ni_image_grayscale_convert followed by
+ * ni_image_dither_floydsteinberg_gray2mono. Every row is converted to gray
+ * just before the error reaches it, so there is no grayscale image in
+ * between and the temporary buffers are a row of bytes and the error of
+ * two rows (2 * w values).
+ *
+ * img_data -> pointer to the data of the original image
+ * w -> width of the original image
+ * h -> height of the original image
+ * n_channels -> number of channels of the original image, 1 to 4 (see
+ * ni_image_grayscale_convert)
+ * type -> standard of the conversion to grayscale
+ *
+ * returns a new, dithered image which needs to be freed separately, or
+ * NULL on error.
+ */
+stbi_uc *ni_image_dither_floydsteinberg_rgb2mono(const stbi_uc *img_data,
+	int w,
+	int h,
+	int n_channels,
+	NI_IMAGE_GRAYSCALE_STD type);
+
+/**
+ * Same as ni_image_dither_floydsteinberg_rgb2mono but the temporary buffers
+ * are taken from the scratch of a context and its precision is used for
+ * both the luma and the error (see ni_image_context.h).
+ *
+ * ctx -> the context, NULL uses the defaults
+ * out -> output image of w * h bytes (may be img_data), or NULL to return a
+ * new one that needs to be freed separately
+ *
+ * returns out (or the new image) or NULL on error.
+ */
+stbi_uc *ni_image_dither_floydsteinberg_rgb2mono_ctx(ni_context *ctx,
+	const stbi_uc *img_data,
+	int w,
+	int h,
+	int n_channels,
+	NI_IMAGE_GRAYSCALE_STD type,
+	stbi_uc *out);
+
+/**
+ * Same as ni_image_dither_floydsteinberg_rgb2mono_ctx but on image
+ * descriptors, with the options of the conversion to grayscale (see
+ * ni_image_grayscale_convert_opts). The error is not diffused outside of
+ * the region.
+ *
+ * ctx -> the context, NULL uses the defaults
+ * src -> the original image, NI_PIXEL_U8 with 1 to 4 channels
+ * dst -> output image of the same size, NI_PIXEL_U8 with 1 channel
+ * type -> standard of the conversion to grayscale
+ * opts -> the options of the conversion, NULL for RGB with the alpha
+ * ignored
+ *
+ * returns dst or NULL on error.
+ *
+ * Error conditions:
+ *  -> the images are not NI_PIXEL_U8, src does not have 1 to 4 channels or
+ *  dst does not have 1, or their sizes do not match
+ *  -> type is not a valid standard or opts are not valid
+ *  -> the temporary buffers could not be allocated
+ */
+ni_image *ni_image_dither_floydsteinberg_rgb2mono_view(ni_context *ctx,
+	const ni_image *src,
+	ni_image *dst,
+	NI_IMAGE_GRAYSCALE_STD type,
+	const ni_grayscale_options *opts);
+
+/**
+ * Threshold matrices of ni_image_dither_ordered_gray2mono
+ */
+typedef enum __NI_IMAGE_DITHER_PATTERN {
+	NI_DITHER_BAYER_2X2,
+	NI_DITHER_BAYER_4X4,
+	NI_DITHER_BAYER_8X8,
+	NI_DITHER_BAYER_16X16,
+	NI_DITHER_BLUE_NOISE, // 64x64, tileable
+} NI_IMAGE_DITHER_PATTERN;
+
+/**
+ * Creates and returns a monochromatic (black and white) image that is the
+ * result of an ordered dithering of the original image, which should be
+ * grayscale (1 channel): every pixel is compared with the threshold of its
+ * position in a matrix that is tiled over the image.
+ *
+ * The Bayer matrices give the regular cross-hatch patterns, with a level of
+ * gray for every entry of the matrix (4 to 256). The blue noise mask has
+ * the 256 levels spread with no pattern and no low frequencies, so it looks
+ * closer to an error diffusion, and its edges wrap around so the tiles do
+ * not show seams. The levels are spread evenly over the bytes, so a flat
+ * gray g turns g / 255 of every tile white (to the nearest level), all
+ * black for 0 and all white for 255.
+ *
+ * There is no error to carry between the pixels, so a row is a single
+ * vectorised compare against the thresholds of its row of the matrix,
+ * repeated across the image, and the rows are split among the threads of
+ * the pool. It needs no temporary memory.
+ *
+ * img_data -> pointer to the data of the original image
+ * w -> width of the original image
+ * h -> height of the original image
+ * pattern -> the threshold matrix
+ *
+ * returns a new, dithered image which needs to be freed separately, or
+ * NULL on error.
+ *
+ * Error conditions:
+ *  -> pattern is not a valid pattern
+ *  -> the image could not be allocated
+ */
+stbi_uc *ni_image_dither_ordered_gray2mono(const stbi_uc *img_data,
+	int w,
+	int h,
+	NI_IMAGE_DITHER_PATTERN pattern);
+
+/**
+ * Same as ni_image_dither_ordered_gray2mono but the result is written to an
+ * image owned by the caller. It needs no temporary memory, so nothing is
+ * allocated.
+ *
+ * out -> output image of w * h bytes, may be img_data
+ *
+ * returns out or NULL on error.
+ */
+stbi_uc *ni_image_dither_ordered_gray2mono_into(const stbi_uc *img_data,
+	int w,
+	int h,
+	NI_IMAGE_DITHER_PATTERN pattern,
+	stbi_uc *out);
+
+/**
+ * Same as ni_image_dither_ordered_gray2mono_into with the thread pool of a
+ * context (see ni_image_context.h).
+ *
+ * ctx -> the context, NULL uses the defaults
+ * out -> output image of w * h bytes (may be img_data), or NULL to return a
+ * new one that needs to be freed separately
+ *
+ * returns out (or the new image) or NULL on error.
+ */
+stbi_uc *ni_image_dither_ordered_gray2mono_ctx(ni_context *ctx,
+	const stbi_uc *img_data,
+	int w,
+	int h,
+	NI_IMAGE_DITHER_PATTERN pattern,
+	stbi_uc *out);
+
+/**
+ * Same as ni_image_dither_ordered_gray2mono_ctx but on image descriptors
+ * (see ni_image_view). The matrix is tiled from the top left corner of the
+ * region. dst may be src.
+ *
+ * ctx -> the context, NULL uses the defaults
+ * src -> the original image, NI_PIXEL_U8 with 1 channel
+ * dst -> output image of the same size and type
+ * pattern -> the threshold matrix
+ *
+ * returns dst or NULL on error.
+ *
+ * Error conditions:
+ *  -> the images are not NI_PIXEL_U8 with 1 channel, or their sizes do not
+ *  match
+ *  -> pattern is not a valid pattern
+ */
+ni_image *ni_image_dither_ordered_gray2mono_view(ni_context *ctx,
+	const ni_image *src,
+	ni_image *dst,
+	NI_IMAGE_DITHER_PATTERN pattern);
+
 // = IMPLEMENTATION =
 
 #ifdef NI_DITHER_IMPLEMENTATION
@@ -50,40 +524,1156 @@ ni_image_dither_floydsteinberg_gray2mono(const stbi_uc *img_data,
 	int w,
 	int h)
 {
-	double *data = ni_grayscale_fp_convert(img_data, w, h);
-
-	int idx;
-	double oldpx, newpx, err;
-	BEGIN_FOREACH_PIXEL(w, h)
-	idx = PX_IDX(__x, __y, w, 1);
-	oldpx = data[idx];
-	newpx = __ni_image_closest_mono(oldpx);
-	data[idx] = newpx;
-	err = oldpx - newpx;
-	if(PX_VALID(__x + 1, __y, w, h)) {
-		idx = PX_IDX(__x + 1, __y, w, 1);
-		data[idx] = ni_image_data_clamp(data[idx] + (err * 7 / 16));
+	stbi_uc *ret_img = ni_image_create(w, h, 1);
+	if(ni_image_dither_floydsteinberg_gray2mono_into(img_data, w, h, ret_img, NULL, 0) == NULL) {
+		ni_free(ret_img);
+		return NULL;
+	}
+	return ret_img;
+}
+
+/**
+ * Returns the number of bytes of scratch the dithering needs in a
+ * precision: the error is only kept for the row being dithered and the
+ * next one. Only intended for internal usage.
+ *
+ * w -> width of the image
+ * precision -> precision of the error buffer
+ */
+static size_t
+__ni_image_dither_floydsteinberg_gray2mono_scratch(int w, NI_PRECISION precision)
+{
+	const size_t elem = (precision == NI_PRECISION_FLOAT) ? sizeof(float) : sizeof(double);
+	return NI_SCRATCH_ALIGNMENT + ni_scratch_reserve(2 * elem * w);
+}
+
+size_t
+ni_image_dither_floydsteinberg_gray2mono_scratch_size(int w, int h)
+{
+	(void)h;
+	return __ni_image_dither_floydsteinberg_gray2mono_scratch(w, NI_DEFAULT_PRECISION);
+}
+
+/**
+ * Same as ni_image_data_clamp in single precision. Only intended for
+ * internal usage.
+ */
+static inline float
+__ni_image_dither_clamp_f32(float val)
+{
+	if(val >= 1.0f)
+		return 1.0f;
+	if(val <= 0.0f)
+		return 0.0f;
+	return val;
+}
+
+/**
+ * Same as __ni_image_closest_mono in single precision. Only intended for
+ * internal usage.
+ */
+static inline float
+__ni_image_closest_mono_f32(float datapx)
+{
+	if(datapx >= 0.5f)
+		return 1.0f;
+	return 0.0f;
+}
+
+/**
+ * Returns the gray bytes of a row of the image being dithered, so the
+ * dithering can read them from an image or convert them as it goes. Only
+ * intended for internal usage.
+ *
+ * user -> the source of the rows
+ * y -> the row
+ */
+typedef const stbi_uc *(*__ni_image_dither_source_fn)(const void *user, int y);
+
+/**
+ * Source of the rows of a grayscale image, user is the ni_image. Only
+ * intended for internal usage.
+ */
+static const stbi_uc *
+__ni_image_dither_image_rows(const void *user, int y)
+{
+	return ni_image_row(user, y);
+}
+
+// clang-format off
+/**
+ * Only intended for internal usage.
+ *
+ * Generates the driver of a row by row dithering with rows of type T. The
+ * image is streamed a row at a time: cur holds the values of the row being
+ * dithered and next the ones of the row below, that are loaded from the
+ * source before the error reaches them. On the last row the error still
+ * goes to next, that is not read again, so the rows need no check for it.
+ *
+ * NAME(w, h, source, user, dst, scratch) dithers an image with
+ * NAME##_load(row, in, w), that loads the gray bytes of a row, and
+ * NAME##_row(cur, next, out, w), that dithers a row into out. It returns
+ * dst, or NULL if the rows could not be allocated.
+ *
+ * NAME -> name of the generated function
+ * T -> type of the rows
+ */
+#define __NI_IMAGE_DITHER_STREAM(NAME, T) \
+	static ni_image * \
+	NAME(int w, int h, __ni_image_dither_source_fn source, const void *user, ni_image *dst, ni_scratch *scratch) \
+	{ \
+		T *const rows = ni_scratch_alloc(scratch, 2 * sizeof(T) * w); \
+		/* ERROR: out of memory */ \
+		if(rows == NULL) \
+			return NULL; \
+		T *cur = rows, *next = rows + w, *tmp; \
+		if(h > 0) \
+			NAME##_load(cur, source(user, 0), w); \
+		/* The row below is read before the output row is written, so the */ \
+		/* dithering works in place */ \
+		for(int __y = 0; __y < h; __y++) { \
+			if(__y + 1 < h) \
+				NAME##_load(next, source(user, __y + 1), w); \
+			NAME##_row(cur, next, ni_image_row(dst, __y), w); \
+			tmp = cur; \
+			cur = next; \
+			next = tmp; \
+		} \
+		ni_scratch_free(scratch, rows); \
+		return dst; \
+	}
+
+/**
+ * Only intended for internal usage.
+ *
+ * Generates the Floyd-Steinberg dithering with an error buffer of type T
+ * (see __NI_IMAGE_DITHER_STREAM). The values and the clamps are applied in
+ * the same order as with a buffer of the whole image, so both give the
+ * same dots.
+ *
+ * NAME -> name of the generated functions
+ * T -> type of the error buffer
+ * NORMALIZE -> converts a byte to [0, 1] in T
+ * CLOSEST -> closest monochrome color of a value
+ * CLAMP -> clamps a value to [0, 1]
+ */
+#define __NI_IMAGE_DITHER_FLOYDSTEINBERG(NAME, T, NORMALIZE, CLOSEST, CLAMP) \
+	static void \
+	NAME##_row(T *cur, T *next, stbi_uc *out, int w) \
+	{ \
+		T oldpx, newpx, err; \
+		for(int __x = 0; __x < w; __x++) { \
+			oldpx = cur[__x]; \
+			newpx = CLOSEST(oldpx); \
+			out[__x] = (newpx != 0) ? UCHAR_MAX : 0; \
+			err = oldpx - newpx; \
+			if(__x + 1 < w) \
+				cur[__x + 1] = CLAMP(cur[__x + 1] + (err * 7 / 16)); \
+			if(__x > 0) \
+				next[__x - 1] = CLAMP(next[__x - 1] + (err * 3 / 16)); \
+			next[__x] = CLAMP(next[__x] + (err * 5 / 16)); \
+			if(__x + 1 < w) \
+				next[__x + 1] = CLAMP(next[__x + 1] + (err * 1 / 16)); \
+		} \
+	} \
+	static void \
+	NAME##_load(T *row, const stbi_uc *in, int w) \
+	{ \
+		for(int __x = 0; __x < w; __x++) \
+			row[__x] = NORMALIZE(in[__x]); \
+	} \
+	__NI_IMAGE_DITHER_STREAM(NAME, T)
+// clang-format on
+
+#define __NI_IMAGE_DITHER_NORMALIZE_F32(V) ((float)(V) / (float)UCHAR_MAX)
+
+__NI_IMAGE_DITHER_FLOYDSTEINBERG(__ni_image_dither_floydsteinberg_f64, double, ni_stbi_uc_normalize, __ni_image_closest_mono, ni_image_data_clamp)
+__NI_IMAGE_DITHER_FLOYDSTEINBERG(__ni_image_dither_floydsteinberg_f32, float, __NI_IMAGE_DITHER_NORMALIZE_F32, __ni_image_closest_mono_f32, __ni_image_dither_clamp_f32)
+
+/**
+ * Floyd-Steinberg dithering of the rows of a source, that every entry
+ * point shares. Only intended for internal usage.
+ *
+ * w -> width of the image
+ * h -> height of the image
+ * source -> the source of the gray rows
+ * user -> the argument of source
+ * dst -> output image of the same size
+ * precision -> precision of the error buffer
+ * scratch -> scratch for the error buffer
+ *
+ * returns dst or NULL on error.
+ */
+static ni_image *
+__ni_image_dither_floydsteinberg_stream(int w,
+	int h,
+	__ni_image_dither_source_fn source,
+	const void *user,
+	ni_image *dst,
+	NI_PRECISION precision,
+	ni_scratch *scratch)
+{
+	if(precision == NI_PRECISION_FLOAT)
+		return __ni_image_dither_floydsteinberg_f32(w, h, source, user, dst, scratch);
+	return __ni_image_dither_floydsteinberg_f64(w, h, source, user, dst, scratch);
+}
+
+/**
+ * Floyd-Steinberg dithering on a scratch, that
+ * ni_image_dither_floydsteinberg_gray2mono_into and
+ * ni_image_dither_floydsteinberg_gray2mono_ctx share. Only intended for
+ * internal usage.
+ *
+ * src -> the original image (8 bits, 1 channel)
+ * dst -> output image of the same size
+ * precision -> precision of the error buffer
+ * scratch -> scratch for the temporary buffer
+ *
+ * returns dst or NULL on error.
+ */
+static ni_image *
+__ni_image_dither_floydsteinberg_gray2mono_apply(const ni_image *src,
+	ni_image *dst,
+	NI_PRECISION precision,
+	ni_scratch *scratch)
+{
+	return __ni_image_dither_floydsteinberg_stream(src->w, src->h, __ni_image_dither_image_rows, src, dst, precision, scratch);
+}
+
+stbi_uc *
+ni_image_dither_floydsteinberg_gray2mono_into(const stbi_uc *img_data,
+	int w,
+	int h,
+	stbi_uc *out,
+	void *scratch,
+	size_t scratch_size)
+{
+	// ERROR: no output
+	if(out == NULL)
+		return NULL;
+
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, 1, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(out, w, h, 1, NI_PIXEL_U8);
+	ni_scratch s = ni_scratch_init(scratch, scratch_size);
+	if(__ni_image_dither_floydsteinberg_gray2mono_apply(&src, &dst, NI_DEFAULT_PRECISION, &s) == NULL)
+		return NULL;
+	return out;
+}
+
+stbi_uc *
+ni_image_dither_floydsteinberg_gray2mono_ctx(ni_context *ctx,
+	const stbi_uc *img_data,
+	int w,
+	int h,
+	stbi_uc *out)
+{
+	stbi_uc *img = (out == NULL) ? ni_image_create(w, h, 1) : out;
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, 1, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(img, w, h, 1, NI_PIXEL_U8);
+	if(ni_image_dither_floydsteinberg_gray2mono_view(ctx, &src, &dst) == NULL) {
+		if(out == NULL)
+			ni_free(img);
+		return NULL;
 	}
-	if(PX_VALID(__x - 1, __y + 1, w, h)) {
-		idx = PX_IDX(__x - 1, __y + 1, w, 1);
-		data[idx] = ni_image_data_clamp(data[idx] + (err * 3 / 16));
+	return img;
+}
+
+ni_image *
+ni_image_dither_floydsteinberg_gray2mono_view(ni_context *ctx,
+	const ni_image *src,
+	ni_image *dst)
+{
+	// ERROR: the images do not match
+	if(src->n_channels != 1 || !__ni_image_views_match(src, dst, 1))
+		return NULL;
+
+	const NI_PRECISION precision = ni_context_precision(ctx);
+	ni_scratch s = ni_context_scratch_begin(ctx, __ni_image_dither_floydsteinberg_gray2mono_scratch(src->w, precision));
+	ni_image *res = __ni_image_dither_floydsteinberg_gray2mono_apply(src, dst, precision, &s);
+	ni_context_scratch_end(ctx, &s);
+	return res;
+}
+
+/**
+ * White and the threshold between black and white (127.5) of the values of
+ * the integer dithering. Only intended for internal usage.
+ */
+#define __NI_DITHER_FIXED_ONE (UCHAR_MAX << NI_DITHER_FIXED_BITS)
+#define __NI_DITHER_FIXED_HALF (__NI_DITHER_FIXED_ONE / 2)
+
+/**
+ * Columns of padding on each side of the rows of the integer dithering, as
+ * far as the widest kernel reaches plus the value that is loaded ahead.
+ * Only intended for internal usage.
+ */
+#define __NI_DITHER_DIFFUSION_PAD 3
+
+/**
+ * Divides a part of the error by the divisor of a kernel rounding to the
+ * nearest. The value is made positive first, so the result does not depend
+ * on how negative numbers are divided or shifted, and a power of two
+ * divisor is a shift. Only intended for internal usage.
+ *
+ * v -> the error times its weight, at least -div * __NI_DITHER_FIXED_ONE
+ * div -> the divisor of the kernel
+ */
+static inline int
+__ni_image_dither_fixed_share(int v, int div)
+{
+	return (int)((unsigned)(v + div / 2 + div * __NI_DITHER_FIXED_ONE) / (unsigned)div) - __NI_DITHER_FIXED_ONE;
+}
+
+/**
+ * Adds to a value of the integer dithering, saturating it between black and
+ * white. Only intended for internal usage.
+ */
+static inline int16_t
+__ni_image_dither_fixed_add(int16_t val, int add)
+{
+	const int v = val + add;
+	return (int16_t)((v < 0) ? 0 : (v > __NI_DITHER_FIXED_ONE) ? __NI_DITHER_FIXED_ONE : v);
+}
+
+/**
+ * Loads a row of gray bytes into the values of the integer dithering. Only
+ * intended for internal usage.
+ */
+static void
+__ni_image_dither_fixed_load(int16_t *row, const stbi_uc *in, int w)
+{
+	for(int __x = 0; __x < w; __x++)
+		row[__x] = (int16_t)(in[__x] << NI_DITHER_FIXED_BITS);
+}
+
+// clang-format off
+/**
+ * Only intended for internal usage.
+ *
+ * Diffusion matrices of the kernels, as lists of the neighbours that get
+ * error. TAP(DY, DX, W) gives W / DIV of the error to the pixel DY rows
+ * below and DX columns ahead, and REST(0, 1) gives the next pixel of the
+ * row what is left of SUM / DIV of the error after the taps, so the
+ * rounding of the shares does not lose any error.
+ */
+#define __NI_DITHER_KERNEL_FLOYD_STEINBERG(REST, TAP) /* SUM 16, DIV 16 */ \
+	REST(0, 1) \
+	TAP(1, -1, 3) TAP(1, 0, 5) TAP(1, 1, 1)
+#define __NI_DITHER_KERNEL_JARVIS_JUDICE_NINKE(REST, TAP) /* SUM 48, DIV 48 */ \
+	REST(0, 1) TAP(0, 2, 5) \
+	TAP(1, -2, 3) TAP(1, -1, 5) TAP(1, 0, 7) TAP(1, 1, 5) TAP(1, 2, 3) \
+	TAP(2, -2, 1) TAP(2, -1, 3) TAP(2, 0, 5) TAP(2, 1, 3) TAP(2, 2, 1)
+#define __NI_DITHER_KERNEL_STUCKI(REST, TAP) /* SUM 42, DIV 42 */ \
+	REST(0, 1) TAP(0, 2, 4) \
+	TAP(1, -2, 2) TAP(1, -1, 4) TAP(1, 0, 8) TAP(1, 1, 4) TAP(1, 2, 2) \
+	TAP(2, -2, 1) TAP(2, -1, 2) TAP(2, 0, 4) TAP(2, 1, 2) TAP(2, 2, 1)
+#define __NI_DITHER_KERNEL_ATKINSON(REST, TAP) /* SUM 6, DIV 8 */ \
+	REST(0, 1) TAP(0, 2, 1) \
+	TAP(1, -1, 1) TAP(1, 0, 1) TAP(1, 1, 1) \
+	TAP(2, 0, 1)
+#define __NI_DITHER_KERNEL_BURKES(REST, TAP) /* SUM 32, DIV 32 */ \
+	REST(0, 1) TAP(0, 2, 4) \
+	TAP(1, -2, 2) TAP(1, -1, 4) TAP(1, 0, 8) TAP(1, 1, 4) TAP(1, 2, 2)
+#define __NI_DITHER_KERNEL_SIERRA(REST, TAP) /* SUM 32, DIV 32 */ \
+	REST(0, 1) TAP(0, 2, 3) \
+	TAP(1, -2, 2) TAP(1, -1, 4) TAP(1, 0, 5) TAP(1, 1, 4) TAP(1, 2, 2) \
+	TAP(2, -1, 2) TAP(2, 0, 3) TAP(2, 1, 2)
+#define __NI_DITHER_KERNEL_SIERRA_TWO_ROW(REST, TAP) /* SUM 16, DIV 16 */ \
+	REST(0, 1) TAP(0, 2, 3) \
+	TAP(1, -2, 1) TAP(1, -1, 2) TAP(1, 0, 3) TAP(1, 1, 2) TAP(1, 2, 1)
+#define __NI_DITHER_KERNEL_SIERRA_LITE(REST, TAP) /* SUM 4, DIV 4 */ \
+	REST(0, 1) \
+	TAP(1, -1, 1) TAP(1, 0, 1)
+
+/**
+ * Only intended for internal usage.
+ *
+ * Expansions of the entries of the kernels in __NI_IMAGE_DITHER_DIFFUSION_ROW.
+ * The error of the current row goes to the values ahead of the pixel, that
+ * are kept in registers (ahead1 and ahead2), and the one of the rows below
+ * to row1 and row2. The columns are mirrored with dir, so the same matrix
+ * runs in both directions of the serpentine scan.
+ */
+#define __NI_IMAGE_DITHER_SKIP_REST(DY, DX)
+#define __NI_IMAGE_DITHER_SKIP_TAP(DY, DX, W)
+#define __NI_IMAGE_DITHER_TAP(DY, DX, W) \
+	share = __ni_image_dither_fixed_share(err * (W), div); \
+	rest -= share; \
+	__NI_IMAGE_DITHER_ADD_##DY(DX, share)
+#define __NI_IMAGE_DITHER_REST(DY, DX) __NI_IMAGE_DITHER_ADD_##DY(DX, rest)
+#define __NI_IMAGE_DITHER_ADD_0(DX, V) ahead##DX = __ni_image_dither_fixed_add(ahead##DX, V);
+#define __NI_IMAGE_DITHER_ADD_1(DX, V) row1[x + dir * (DX)] = __ni_image_dither_fixed_add(row1[x + dir * (DX)], V);
+#define __NI_IMAGE_DITHER_ADD_2(DX, V) row2[x + dir * (DX)] = __ni_image_dither_fixed_add(row2[x + dir * (DX)], V);
+
+/**
+ * Only intended for internal usage.
+ *
+ * Generates the kernel of a row of an error diffusion, that dithers the
+ * pixels begin to end - 1 (in the order of the scan) of rows[0] into out
+ * and diffuses their error to the rest of rows[0] and to rows[1] and
+ * rows[2] (the next two rows). The matrix, the divisor and the direction
+ * are constants, so the taps unroll into a loop with no branches, and the
+ * padding of the rows takes the error that falls outside of the image. The
+ * values ahead are stored back at the end, so a row can be dithered in
+ * parts.
+ *
+ * NAME -> name of the generated function
+ * KERNEL -> the matrix (see __NI_DITHER_KERNEL_FLOYD_STEINBERG)
+ * SUM -> sum of the weights, with the one of REST
+ * DIV -> divisor of the weights
+ * DIR -> 1 to scan the row left to right, -1 right to left
+ */
+#define __NI_IMAGE_DITHER_DIFFUSION_ROW(NAME, KERNEL, SUM, DIV, DIR) \
+	static void \
+	NAME(int16_t *const *rows, stbi_uc *out, int w, int begin, int end) \
+	{ \
+		int16_t *const row0 = rows[0], *const row1 = rows[1], *const row2 = rows[2]; \
+		const int div = (DIV), dir = (DIR); \
+		int x = (dir > 0) ? begin : w - 1 - begin; \
+		int16_t px = row0[x], ahead1 = row0[x + dir], ahead2 = row0[x + 2 * dir]; \
+		int white, err, rest, share; \
+		(void)row2; \
+		(void)share; \
+		for(int __i = begin; __i < end; __i++) { \
+			x = (dir > 0) ? __i : w - 1 - __i; \
+			white = (px >= __NI_DITHER_FIXED_HALF); \
+			out[x] = white ? UCHAR_MAX : 0; \
+			err = px - (white ? __NI_DITHER_FIXED_ONE : 0); \
+			rest = __ni_image_dither_fixed_share(err * (SUM), div); \
+			KERNEL(__NI_IMAGE_DITHER_SKIP_REST, __NI_IMAGE_DITHER_TAP) \
+			KERNEL(__NI_IMAGE_DITHER_REST, __NI_IMAGE_DITHER_SKIP_TAP) \
+			px = ahead1; \
+			ahead1 = ahead2; \
+			ahead2 = row0[x + 3 * dir]; \
+		} \
+		x = (dir > 0) ? end : w - 1 - end; \
+		row0[x] = px; \
+		row0[x + dir] = ahead1; \
+		row0[x + 2 * dir] = ahead2; \
 	}
-	if(PX_VALID(__x, __y + 1, w, h)) {
-		idx = PX_IDX(__x, __y + 1, w, 1);
-		data[idx] = ni_image_data_clamp(data[idx] + (err * 5 / 16));
+#define __NI_IMAGE_DITHER_DIFFUSION(NAME, KERNEL, SUM, DIV) \
+	__NI_IMAGE_DITHER_DIFFUSION_ROW(NAME##_ltr, KERNEL, SUM, DIV, 1) \
+	__NI_IMAGE_DITHER_DIFFUSION_ROW(NAME##_rtl, KERNEL, SUM, DIV, -1)
+// clang-format on
+
+__NI_IMAGE_DITHER_DIFFUSION(__ni_image_dither_floyd_steinberg, __NI_DITHER_KERNEL_FLOYD_STEINBERG, 16, 16)
+__NI_IMAGE_DITHER_DIFFUSION(__ni_image_dither_jarvis_judice_ninke, __NI_DITHER_KERNEL_JARVIS_JUDICE_NINKE, 48, 48)
+__NI_IMAGE_DITHER_DIFFUSION(__ni_image_dither_stucki, __NI_DITHER_KERNEL_STUCKI, 42, 42)
+__NI_IMAGE_DITHER_DIFFUSION(__ni_image_dither_atkinson, __NI_DITHER_KERNEL_ATKINSON, 6, 8)
+__NI_IMAGE_DITHER_DIFFUSION(__ni_image_dither_burkes, __NI_DITHER_KERNEL_BURKES, 32, 32)
+__NI_IMAGE_DITHER_DIFFUSION(__ni_image_dither_sierra, __NI_DITHER_KERNEL_SIERRA, 32, 32)
+__NI_IMAGE_DITHER_DIFFUSION(__ni_image_dither_sierra_two_row, __NI_DITHER_KERNEL_SIERRA_TWO_ROW, 16, 16)
+__NI_IMAGE_DITHER_DIFFUSION(__ni_image_dither_sierra_lite, __NI_DITHER_KERNEL_SIERRA_LITE, 4, 4)
+
+/**
+ * Only intended for internal usage.
+ *
+ * Row kernel of an error diffusion, see __NI_IMAGE_DITHER_DIFFUSION_ROW.
+ */
+typedef void (*__ni_image_dither_diffusion_row_fn)(int16_t *const *rows, stbi_uc *out, int w, int begin, int end);
+
+/**
+ * Only intended for internal usage.
+ *
+ * Row kernels by kernel and direction (left to right, right to left), in
+ * the order of NI_IMAGE_DITHER_KERNEL.
+ */
+static const __ni_image_dither_diffusion_row_fn __ni_image_dither_diffusion_rows[NI_DITHER_SIERRA_LITE + 1][2] = {
+	{ __ni_image_dither_floyd_steinberg_ltr, __ni_image_dither_floyd_steinberg_rtl },
+	{ __ni_image_dither_jarvis_judice_ninke_ltr, __ni_image_dither_jarvis_judice_ninke_rtl },
+	{ __ni_image_dither_stucki_ltr, __ni_image_dither_stucki_rtl },
+	{ __ni_image_dither_atkinson_ltr, __ni_image_dither_atkinson_rtl },
+	{ __ni_image_dither_burkes_ltr, __ni_image_dither_burkes_rtl },
+	{ __ni_image_dither_sierra_ltr, __ni_image_dither_sierra_rtl },
+	{ __ni_image_dither_sierra_two_row_ltr, __ni_image_dither_sierra_two_row_rtl },
+	{ __ni_image_dither_sierra_lite_ltr, __ni_image_dither_sierra_lite_rtl },
+};
+
+/**
+ * Number of pixels of a row the wavefront of an error diffusion dithers
+ * between two updates of its progress. Only intended for internal usage.
+ */
+#define __NI_DITHER_WAVEFRONT_BLOCK 64
+
+/**
+ * Number of pixels a row of the wavefront trails the row above it by: the
+ * row above adds error two pixels ahead of the pixel it dithers, and a row
+ * reads its values three pixels ahead of the pixel it dithers. Only
+ * intended for internal usage.
+ */
+#define __NI_DITHER_WAVEFRONT_LAG 5
+
+/**
+ * Returns the number of tasks the wavefront of an error diffusion runs
+ * with, 1 when the image is dithered serially. A serpentine scan starts
+ * every row where the row above ends, so it has nothing to run in
+ * parallel. Only intended for internal usage.
+ *
+ * ni_threadpool *pool -> the pool that runs the dithering
+ * int w -> width of the image
+ * int h -> height of the image
+ * int serpentine -> 1 to scan the odd rows right to left
+ */
+static int
+__ni_image_dither_wavefront_tasks(ni_threadpool *pool, int w, int h, int serpentine)
+{
+	if(serpentine || w < 2 * __NI_DITHER_WAVEFRONT_BLOCK)
+		return 1;
+	const int n_tasks = ni_threadpool_size(pool);
+	return (n_tasks < h) ? n_tasks : (h > 0) ? h : 1;
+}
+
+/**
+ * Returns the number of rows of the integer dithering: the row being
+ * dithered and the two below it for every task. Only intended for internal
+ * usage.
+ */
+static int
+__ni_image_dither_diffusion_rows_count(int n_tasks)
+{
+	return (n_tasks > 1) ? n_tasks + 3 : 3;
+}
+
+/**
+ * Returns the number of bytes of scratch of the integer dithering: the
+ * padded rows and, with more than one task, the progress of every row.
+ * Only intended for internal usage.
+ *
+ * int w -> width of the image
+ * int h -> height of the image
+ * int n_tasks -> number of tasks (see __ni_image_dither_wavefront_tasks)
+ */
+static size_t
+__ni_image_dither_diffusion_scratch(int w, int h, int n_tasks)
+{
+	const size_t row_len = w + 2 * __NI_DITHER_DIFFUSION_PAD;
+	size_t size = NI_SCRATCH_ALIGNMENT + ni_scratch_reserve(__ni_image_dither_diffusion_rows_count(n_tasks) * sizeof(int16_t) * row_len);
+	if(n_tasks > 1)
+		size += ni_scratch_reserve(sizeof(ni_threadpool_counter) * h);
+	return size;
+}
+
+/**
+ * An error diffusion that dithers the rows in a wavefront: the tasks take
+ * the rows in order, and every row trails the one above it by
+ * __NI_DITHER_WAVEFRONT_LAG pixels, waiting on its progress. A pixel gets
+ * its error from the same pixels in the same order as in the serial
+ * dithering, so the result is the same. Only intended for internal usage.
+ */
+typedef struct __ni_image_dither_wavefront {
+	__ni_image_dither_source_fn source;
+	const void *user;
+	ni_image *dst;
+	__ni_image_dither_diffusion_row_fn row;
+	int16_t *data;
+	size_t row_len;
+	int n_rows;
+	ni_threadpool_counter next;
+	ni_threadpool_counter *progress;
+} __ni_image_dither_wavefront;
+
+/**
+ * Thread pool task of the wavefront, that dithers rows until there are
+ * none left. Only intended for internal usage.
+ */
+static void
+__ni_image_dither_wavefront_task(void *arg, int index, int n_tasks)
+{
+	__ni_image_dither_wavefront *job = arg;
+	const int w = job->dst->w, h = job->dst->h;
+	int16_t *rows[3];
+	(void)index;
+	(void)n_tasks;
+
+	for(int y = ni_threadpool_counter_add(&job->next, 1); y < h; y = ni_threadpool_counter_add(&job->next, 1)) {
+		for(int r = 0; r < 3; r++)
+			rows[r] = job->data + ((y + r) % job->n_rows) * job->row_len + __NI_DITHER_DIFFUSION_PAD;
+		// The row below the next one takes the place of a row that is
+		// done, and is loaded before any error reaches it
+		if(y + 2 < h) {
+			if(y + 2 >= job->n_rows)
+				ni_threadpool_counter_wait(&job->progress[y + 2 - job->n_rows], w);
+			__ni_image_dither_fixed_load(rows[2], job->source(job->user, y + 2), w);
+		}
+
+		stbi_uc *out = ni_image_row(job->dst, y);
+		for(int begin = 0, end; begin < w; begin = end) {
+			end = (w - begin > __NI_DITHER_WAVEFRONT_BLOCK) ? begin + __NI_DITHER_WAVEFRONT_BLOCK : w;
+			// The row above has added all its error to the pixels up to
+			// the ones read ahead
+			if(y > 0)
+				ni_threadpool_counter_wait(&job->progress[y - 1], (w - end > __NI_DITHER_WAVEFRONT_LAG) ? end + __NI_DITHER_WAVEFRONT_LAG : w);
+			job->row(rows, out, w, begin, end);
+			ni_threadpool_counter_set(&job->progress[y], end);
+		}
 	}
-	if(PX_VALID(__x + 1, __y + 1, w, h)) {
-		idx = PX_IDX(__x + 1, __y + 1, w, 1);
-		data[idx] = ni_image_data_clamp(data[idx] + (err * 1 / 16));
+}
+
+/**
+ * Error diffusion of the rows of a source with the integer arithmetic,
+ * that every integer entry point shares. The image is streamed a row at a
+ * time: the row being dithered and the two below it are kept, and a row is
+ * loaded from the source before any error reaches it. With more than one
+ * task the rows are dithered in a wavefront (see
+ * __ni_image_dither_wavefront). Only intended for internal usage.
+ *
+ * w -> width of the image
+ * h -> height of the image
+ * source -> the source of the gray rows
+ * user -> the argument of source
+ * dst -> output image of the same size
+ * kernel -> the kernel
+ * serpentine -> 1 to scan the odd rows right to left
+ * pool -> the pool that runs the dithering
+ * scratch -> scratch for the rows (see __ni_image_dither_diffusion_scratch)
+ *
+ * returns dst or NULL on error.
+ */
+static ni_image *
+__ni_image_dither_diffusion(int w,
+	int h,
+	__ni_image_dither_source_fn source,
+	const void *user,
+	ni_image *dst,
+	NI_IMAGE_DITHER_KERNEL kernel,
+	int serpentine,
+	ni_threadpool *pool,
+	ni_scratch *scratch)
+{
+	// ERROR: unknown kernel
+	if(kernel < NI_DITHER_FLOYD_STEINBERG || kernel > NI_DITHER_SIERRA_LITE)
+		return NULL;
+
+	const int n_tasks = __ni_image_dither_wavefront_tasks(pool, w, h, serpentine);
+	const int n_rows = __ni_image_dither_diffusion_rows_count(n_tasks);
+	const size_t row_len = w + 2 * __NI_DITHER_DIFFUSION_PAD;
+	int16_t *const data = ni_scratch_alloc(scratch, n_rows * sizeof(int16_t) * row_len);
+	// ERROR: out of memory
+	if(data == NULL)
+		return NULL;
+	// The error that falls on the padding is never read, it only needs to
+	// start as a valid value
+	memset(data, 0, n_rows * sizeof(int16_t) * row_len);
+
+	if(n_tasks > 1) {
+		ni_threadpool_counter *const progress = ni_scratch_alloc(scratch, sizeof(ni_threadpool_counter) * h);
+		// ERROR: out of memory
+		if(progress == NULL) {
+			ni_scratch_free(scratch, data);
+			return NULL;
+		}
+		__ni_image_dither_wavefront job = { source, user, dst, __ni_image_dither_diffusion_rows[kernel][0], data, row_len, n_rows, { 0 }, progress };
+		for(int __y = 0; __y < h; __y++)
+			ni_threadpool_counter_set(&progress[__y], 0);
+		for(int r = 0; r < 2; r++)
+			__ni_image_dither_fixed_load(data + r * row_len + __NI_DITHER_DIFFUSION_PAD, source(user, r), w);
+		ni_threadpool_run(pool, __ni_image_dither_wavefront_task, &job, n_tasks);
+		ni_scratch_free(scratch, progress);
+		ni_scratch_free(scratch, data);
+		return dst;
 	}
-	END_FOREACH_PIXEL
 
-	stbi_uc *ret_img = ni_fp_grayscale_convert(data, w, h);
+	int16_t *rows[3], *tmp;
+	for(int r = 0; r < 3; r++)
+		rows[r] = data + r * row_len + __NI_DITHER_DIFFUSION_PAD;
+	for(int r = 0; r < 2 && r < h; r++)
+		__ni_image_dither_fixed_load(rows[r], source(user, r), w);
+	// The rows below are read before the output row is written, so the
+	// dithering works in place
+	for(int __y = 0; __y < h; __y++) {
+		if(__y + 2 < h)
+			__ni_image_dither_fixed_load(rows[2], source(user, __y + 2), w);
+		__ni_image_dither_diffusion_rows[kernel][serpentine && (__y & 1)](rows, ni_image_row(dst, __y), w, 0, w);
+		tmp = rows[0];
+		rows[0] = rows[1];
+		rows[1] = rows[2];
+		rows[2] = tmp;
+	}
+	ni_scratch_free(scratch, data);
+	return dst;
+}
 
-	free((void *)data);
+stbi_uc *
+ni_image_dither_diffusion_gray2mono(const stbi_uc *img_data,
+	int w,
+	int h,
+	NI_IMAGE_DITHER_KERNEL kernel,
+	int serpentine)
+{
+	stbi_uc *ret_img = ni_image_create(w, h, 1);
+	if(ni_image_dither_diffusion_gray2mono_into(img_data, w, h, kernel, serpentine, ret_img, NULL, 0) == NULL) {
+		ni_free(ret_img);
+		return NULL;
+	}
 	return ret_img;
 }
 
+size_t
+ni_image_dither_diffusion_gray2mono_scratch_size(int w, int h)
+{
+	// The serial scan takes less, so this is enough for both scans
+	return __ni_image_dither_diffusion_scratch(w, h, __ni_image_dither_wavefront_tasks(ni_threadpool_default(), w, h, 0));
+}
+
+stbi_uc *
+ni_image_dither_diffusion_gray2mono_into(const stbi_uc *img_data,
+	int w,
+	int h,
+	NI_IMAGE_DITHER_KERNEL kernel,
+	int serpentine,
+	stbi_uc *out,
+	void *scratch,
+	size_t scratch_size)
+{
+	// ERROR: no output
+	if(out == NULL)
+		return NULL;
+
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, 1, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(out, w, h, 1, NI_PIXEL_U8);
+	ni_scratch s = ni_scratch_init(scratch, scratch_size);
+	if(__ni_image_dither_diffusion(w, h, __ni_image_dither_image_rows, &src, &dst, kernel, serpentine, ni_threadpool_default(), &s) == NULL)
+		return NULL;
+	return out;
+}
+
+stbi_uc *
+ni_image_dither_diffusion_gray2mono_ctx(ni_context *ctx,
+	const stbi_uc *img_data,
+	int w,
+	int h,
+	NI_IMAGE_DITHER_KERNEL kernel,
+	int serpentine,
+	stbi_uc *out)
+{
+	stbi_uc *img = (out == NULL) ? ni_image_create(w, h, 1) : out;
+	// ERROR: out of memory
+	if(img == NULL)
+		return NULL;
+
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, 1, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(img, w, h, 1, NI_PIXEL_U8);
+	if(ni_image_dither_diffusion_gray2mono_view(ctx, &src, &dst, kernel, serpentine) == NULL) {
+		if(out == NULL)
+			ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+ni_image *
+ni_image_dither_diffusion_gray2mono_view(ni_context *ctx,
+	const ni_image *src,
+	ni_image *dst,
+	NI_IMAGE_DITHER_KERNEL kernel,
+	int serpentine)
+{
+	// ERROR: the images do not match
+	if(src->n_channels != 1 || !__ni_image_views_match(src, dst, 1))
+		return NULL;
+
+	ni_threadpool *pool = ni_context_threadpool(ctx);
+	const int n_tasks = __ni_image_dither_wavefront_tasks(pool, src->w, src->h, serpentine);
+	ni_scratch s = ni_context_scratch_begin(ctx, __ni_image_dither_diffusion_scratch(src->w, src->h, n_tasks));
+	ni_image *res = __ni_image_dither_diffusion(src->w, src->h, __ni_image_dither_image_rows, src, dst, kernel, serpentine, pool, &s);
+	ni_context_scratch_end(ctx, &s);
+	return res;
+}
+
+stbi_uc *
+ni_image_dither_floydsteinberg_gray2mono_fixed(const stbi_uc *img_data,
+	int w,
+	int h)
+{
+	return ni_image_dither_diffusion_gray2mono(img_data, w, h, NI_DITHER_FLOYD_STEINBERG, 0);
+}
+
+size_t
+ni_image_dither_floydsteinberg_gray2mono_fixed_scratch_size(int w, int h)
+{
+	return ni_image_dither_diffusion_gray2mono_scratch_size(w, h);
+}
+
+stbi_uc *
+ni_image_dither_floydsteinberg_gray2mono_fixed_into(const stbi_uc *img_data,
+	int w,
+	int h,
+	stbi_uc *out,
+	void *scratch,
+	size_t scratch_size)
+{
+	return ni_image_dither_diffusion_gray2mono_into(img_data, w, h, NI_DITHER_FLOYD_STEINBERG, 0, out, scratch, scratch_size);
+}
+
+stbi_uc *
+ni_image_dither_floydsteinberg_gray2mono_fixed_ctx(ni_context *ctx,
+	const stbi_uc *img_data,
+	int w,
+	int h,
+	stbi_uc *out)
+{
+	return ni_image_dither_diffusion_gray2mono_ctx(ctx, img_data, w, h, NI_DITHER_FLOYD_STEINBERG, 0, out);
+}
+
+ni_image *
+ni_image_dither_floydsteinberg_gray2mono_fixed_view(ni_context *ctx,
+	const ni_image *src,
+	ni_image *dst)
+{
+	return ni_image_dither_diffusion_gray2mono_view(ctx, src, dst, NI_DITHER_FLOYD_STEINBERG, 0);
+}
+
+/**
+ * Source of the rows of a color image, converted to gray as they are read.
+ * Only intended for internal usage.
+ *
+ * src -> the original image
+ * pass -> the conversion to grayscale
+ * gray -> buffer of a row of bytes
+ */
+typedef struct __ni_image_dither_gray_source {
+	const ni_image *src;
+	const __ni_image_grayscale_pass *pass;
+	stbi_uc *gray;
+} __ni_image_dither_gray_source;
+
+/**
+ * Converts a row of the color image of a __ni_image_dither_gray_source to
+ * gray. Only intended for internal usage.
+ */
+static const stbi_uc *
+__ni_image_dither_gray_rows(const void *user, int y)
+{
+	const __ni_image_dither_gray_source *source = user;
+	__ni_image_grayscale_u8_row(ni_image_row(source->src, y), source->gray, source->src->w, source->pass);
+	return source->gray;
+}
+
+stbi_uc *
+ni_image_dither_floydsteinberg_rgb2mono(const stbi_uc *img_data,
+	int w,
+	int h,
+	int n_channels,
+	NI_IMAGE_GRAYSCALE_STD type)
+{
+	return ni_image_dither_floydsteinberg_rgb2mono_ctx(NULL, img_data, w, h, n_channels, type, NULL);
+}
+
+stbi_uc *
+ni_image_dither_floydsteinberg_rgb2mono_ctx(ni_context *ctx,
+	const stbi_uc *img_data,
+	int w,
+	int h,
+	int n_channels,
+	NI_IMAGE_GRAYSCALE_STD type,
+	stbi_uc *out)
+{
+	stbi_uc *img = (out == NULL) ? ni_image_create(w, h, 1) : out;
+	// ERROR: out of memory
+	if(img == NULL)
+		return NULL;
+
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(img, w, h, 1, NI_PIXEL_U8);
+	if(ni_image_dither_floydsteinberg_rgb2mono_view(ctx, &src, &dst, type, NULL) == NULL) {
+		if(out == NULL)
+			ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+ni_image *
+ni_image_dither_floydsteinberg_rgb2mono_view(ni_context *ctx,
+	const ni_image *src,
+	ni_image *dst,
+	NI_IMAGE_GRAYSCALE_STD type,
+	const ni_grayscale_options *opts)
+{
+	// ERROR: the images do not match
+	if(src->type != NI_PIXEL_U8 || !__ni_image_views_same(src, dst, 1))
+		return NULL;
+
+	const NI_PRECISION precision = ni_context_precision(ctx);
+	__ni_image_grayscale_pass pass;
+	// ERROR: unknown standard or options
+	if(__ni_image_grayscale_pass_init(&pass, NI_PIXEL_U8, precision, src->n_channels, type, opts) == NULL)
+		return NULL;
+
+	ni_scratch s = ni_context_scratch_begin(ctx, __ni_image_dither_floydsteinberg_gray2mono_scratch(src->w, precision) + ni_scratch_reserve(src->w));
+	__ni_image_dither_gray_source source = { src, &pass, ni_scratch_alloc(&s, src->w) };
+	ni_image *res = NULL;
+	// ERROR: out of memory
+	if(source.gray != NULL) {
+		res = __ni_image_dither_floydsteinberg_stream(src->w, src->h, __ni_image_dither_gray_rows, &source, dst, precision, &s);
+		ni_scratch_free(&s, source.gray);
+	}
+	ni_context_scratch_end(ctx, &s);
+	return res;
+}
+
+/**
+ * Width of the rows of thresholds of the ordered dithering: the size of the
+ * blue noise mask, and a multiple of the size of every Bayer matrix and of
+ * the vectors. Only intended for internal usage.
+ */
+#define __NI_DITHER_ORDERED_TILE 64
+
+// clang-format off
+/**
+ * Only intended for internal usage.
+ *
+ * Levels (0 to 255) of the tileable blue noise mask, made with the
+ * void-and-cluster method (a gaussian of sigma 1.5 on the torus) and every
+ * level on 16 pixels.
+ */
+static const stbi_uc __ni_image_dither_blue_noise[__NI_DITHER_ORDERED_TILE][__NI_DITHER_ORDERED_TILE] = {
+	{ 208, 12, 190, 219, 91, 58, 123, 233, 37, 154, 61, 124, 47, 15, 213, 112, 225, 123, 236, 53, 171, 73, 34, 139, 192, 65, 231, 125, 172, 247, 40, 208, 88, 252, 74, 186, 27, 224, 137, 246, 107, 20, 230, 89, 218, 64, 4, 231, 124, 16, 96, 225, 59, 187, 82, 235, 63, 194, 110, 146, 176, 133, 61, 110 },
+	{ 37, 131, 71, 142, 2, 161, 203, 74, 170, 217, 91, 251, 198, 98, 155, 55, 167, 0, 146, 97, 202, 129, 106, 167, 244, 97, 41, 10, 69, 107, 192, 59, 135, 19, 220, 99, 160, 56, 93, 33, 72, 147, 122, 176, 38, 143, 210, 164, 56, 150, 205, 167, 138, 242, 30, 116, 178, 19, 246, 31, 211, 10, 254, 164 },
+	{ 226, 103, 172, 245, 39, 223, 137, 25, 109, 4, 179, 31, 147, 77, 239, 34, 201, 85, 189, 29, 250, 13, 222, 54, 22, 153, 216, 184, 226, 146, 14, 231, 156, 111, 171, 7, 240, 116, 212, 190, 167, 215, 5, 68, 253, 114, 87, 34, 106, 234, 75, 1, 89, 46, 160, 210, 141, 51, 163, 71, 98, 120, 188, 76 },
+	{ 202, 16, 57, 194, 118, 99, 55, 187, 229, 142, 71, 115, 218, 7, 176, 106, 134, 244, 46, 165, 66, 149, 185, 84, 201, 112, 74, 130, 49, 90, 168, 77, 33, 215, 51, 203, 144, 78, 20, 125, 49, 241, 102, 195, 159, 17, 182, 244, 195, 22, 179, 119, 199, 220, 103, 13, 77, 230, 124, 197, 224, 55, 28, 147 },
+	{ 48, 233, 154, 77, 23, 176, 251, 88, 44, 196, 242, 51, 190, 127, 62, 224, 16, 73, 120, 230, 90, 115, 42, 234, 137, 1, 176, 251, 23, 212, 118, 243, 183, 93, 128, 70, 37, 176, 254, 153, 91, 27, 139, 41, 80, 223, 52, 132, 72, 141, 48, 246, 27, 134, 65, 247, 192, 92, 3, 39, 144, 173, 242, 94 },
+	{ 182, 107, 127, 239, 209, 144, 9, 163, 121, 17, 98, 166, 21, 246, 90, 156, 183, 204, 144, 9, 179, 208, 25, 163, 60, 211, 38, 159, 104, 186, 4, 52, 144, 21, 248, 190, 106, 217, 1, 62, 203, 178, 235, 119, 202, 148, 103, 5, 171, 222, 105, 157, 81, 186, 166, 40, 114, 155, 178, 251, 80, 110, 6, 136 },
+	{ 31, 216, 11, 45, 95, 62, 218, 74, 236, 138, 207, 79, 150, 43, 209, 26, 56, 98, 37, 217, 55, 130, 254, 104, 86, 240, 123, 81, 61, 233, 133, 202, 72, 220, 153, 14, 164, 82, 133, 229, 115, 76, 8, 165, 59, 29, 233, 209, 91, 33, 197, 60, 234, 6, 123, 224, 21, 216, 51, 132, 25, 221, 199, 70 },
+	{ 168, 84, 188, 157, 200, 129, 33, 106, 183, 57, 34, 233, 104, 187, 115, 139, 250, 168, 237, 108, 156, 77, 5, 196, 145, 22, 180, 203, 149, 32, 85, 164, 104, 41, 119, 60, 238, 44, 193, 29, 160, 47, 214, 98, 249, 175, 138, 65, 125, 251, 15, 145, 93, 203, 50, 85, 145, 70, 102, 208, 184, 59, 151, 238 },
+	{ 130, 57, 253, 110, 18, 173, 247, 149, 0, 222, 171, 130, 8, 64, 227, 82, 2, 127, 65, 17, 191, 228, 176, 40, 224, 111, 54, 8, 226, 114, 254, 14, 210, 176, 228, 90, 202, 112, 149, 93, 246, 188, 134, 22, 81, 114, 12, 183, 42, 162, 112, 180, 37, 135, 254, 168, 189, 242, 14, 162, 83, 118, 15, 96 },
+	{ 227, 3, 138, 68, 232, 82, 50, 195, 89, 115, 76, 198, 255, 160, 31, 177, 215, 89, 198, 148, 47, 96, 124, 63, 160, 78, 213, 137, 171, 50, 187, 63, 140, 29, 131, 6, 160, 23, 226, 60, 10, 107, 154, 225, 196, 48, 239, 202, 87, 225, 73, 207, 230, 103, 64, 10, 112, 43, 126, 228, 34, 248, 174, 44 },
+	{ 107, 184, 206, 36, 150, 216, 119, 27, 240, 162, 20, 47, 93, 119, 196, 52, 145, 39, 225, 114, 245, 28, 143, 237, 12, 189, 249, 91, 29, 101, 154, 215, 88, 242, 69, 184, 252, 76, 132, 170, 217, 78, 36, 64, 121, 163, 99, 145, 19, 131, 52, 2, 156, 27, 195, 141, 218, 90, 203, 149, 57, 198, 139, 212 },
+	{ 155, 28, 86, 169, 105, 10, 181, 140, 62, 205, 132, 219, 148, 17, 78, 236, 102, 171, 21, 77, 161, 211, 84, 199, 117, 35, 127, 66, 205, 239, 1, 119, 43, 193, 109, 146, 36, 103, 202, 42, 116, 193, 253, 172, 2, 229, 35, 67, 212, 178, 245, 88, 119, 173, 81, 238, 30, 179, 68, 0, 112, 88, 23, 72 },
+	{ 53, 247, 122, 221, 54, 200, 77, 231, 103, 38, 185, 68, 242, 174, 211, 129, 7, 250, 137, 187, 59, 0, 171, 45, 99, 177, 152, 16, 180, 135, 80, 230, 170, 12, 224, 57, 214, 177, 3, 241, 158, 18, 94, 139, 207, 84, 155, 251, 113, 32, 143, 196, 233, 45, 208, 107, 56, 130, 251, 158, 231, 177, 124, 236 },
+	{ 102, 175, 7, 74, 237, 131, 43, 156, 17, 249, 114, 4, 100, 56, 30, 162, 64, 204, 42, 108, 218, 127, 252, 70, 207, 242, 53, 226, 112, 37, 196, 60, 130, 92, 159, 23, 126, 65, 144, 85, 51, 131, 222, 24, 59, 185, 128, 8, 170, 57, 101, 17, 65, 136, 6, 153, 172, 23, 191, 79, 44, 215, 13, 192 },
+	{ 34, 211, 140, 159, 25, 178, 94, 215, 175, 83, 145, 165, 200, 137, 232, 115, 93, 181, 82, 234, 18, 93, 150, 25, 133, 5, 87, 166, 70, 252, 155, 18, 209, 248, 73, 192, 244, 99, 228, 184, 205, 70, 178, 112, 243, 42, 101, 224, 82, 205, 238, 161, 187, 221, 75, 245, 94, 222, 117, 16, 102, 134, 61, 148 },
+	{ 227, 92, 51, 196, 105, 253, 2, 120, 58, 221, 44, 238, 25, 83, 186, 45, 241, 13, 134, 158, 201, 53, 180, 214, 107, 191, 144, 217, 20, 93, 185, 108, 36, 145, 116, 47, 169, 18, 39, 109, 9, 248, 34, 142, 77, 201, 157, 30, 189, 118, 39, 79, 109, 29, 122, 198, 42, 66, 145, 240, 205, 169, 255, 78 },
+	{ 130, 19, 117, 220, 36, 69, 149, 200, 29, 134, 185, 67, 108, 223, 8, 146, 210, 166, 35, 70, 119, 239, 34, 80, 228, 61, 36, 124, 202, 49, 137, 233, 64, 183, 6, 234, 83, 133, 217, 165, 124, 151, 89, 219, 171, 11, 235, 69, 140, 12, 219, 151, 254, 56, 181, 141, 10, 214, 180, 32, 54, 89, 3, 186 },
+	{ 162, 246, 75, 182, 134, 229, 172, 77, 236, 93, 9, 123, 204, 155, 59, 125, 75, 102, 253, 182, 22, 100, 168, 135, 10, 161, 238, 102, 172, 243, 3, 84, 162, 222, 99, 206, 150, 197, 56, 77, 230, 46, 185, 20, 121, 58, 133, 104, 248, 164, 53, 131, 1, 163, 91, 229, 112, 162, 80, 128, 197, 158, 115, 44 },
+	{ 64, 201, 149, 5, 98, 53, 15, 107, 144, 211, 168, 254, 30, 95, 173, 228, 18, 190, 50, 128, 222, 196, 58, 247, 112, 186, 83, 13, 67, 151, 113, 210, 27, 121, 43, 69, 13, 107, 255, 24, 102, 203, 66, 241, 95, 213, 188, 37, 180, 86, 203, 98, 189, 212, 22, 73, 47, 251, 19, 104, 238, 27, 229, 209 },
+	{ 15, 107, 40, 233, 163, 212, 186, 247, 48, 20, 72, 141, 51, 192, 244, 40, 114, 215, 86, 155, 2, 75, 143, 21, 206, 51, 146, 198, 221, 36, 188, 57, 173, 140, 237, 161, 183, 37, 146, 190, 168, 0, 134, 161, 40, 148, 5, 226, 64, 22, 241, 35, 64, 117, 240, 155, 192, 133, 204, 58, 151, 76, 139, 94 },
+	{ 240, 136, 191, 60, 120, 87, 33, 125, 159, 193, 109, 226, 86, 2, 135, 73, 167, 141, 28, 230, 108, 164, 214, 97, 37, 130, 255, 24, 119, 77, 229, 97, 252, 12, 81, 211, 119, 228, 61, 127, 81, 235, 107, 208, 80, 253, 116, 92, 152, 129, 108, 177, 223, 143, 43, 106, 4, 89, 174, 220, 14, 191, 49, 171 },
+	{ 32, 79, 169, 252, 20, 146, 225, 62, 92, 237, 38, 177, 214, 160, 107, 209, 12, 249, 63, 195, 38, 243, 54, 179, 232, 79, 170, 96, 182, 143, 17, 129, 42, 196, 104, 52, 19, 88, 197, 13, 215, 53, 32, 177, 16, 192, 51, 173, 206, 232, 6, 158, 81, 24, 200, 166, 231, 68, 35, 122, 100, 250, 126, 212 },
+	{ 113, 222, 8, 100, 205, 76, 173, 0, 210, 138, 13, 121, 66, 27, 239, 53, 187, 97, 125, 175, 85, 132, 15, 109, 151, 3, 60, 212, 46, 245, 161, 202, 73, 150, 181, 246, 138, 159, 237, 100, 152, 121, 244, 144, 62, 129, 218, 19, 40, 71, 192, 52, 135, 249, 92, 55, 207, 144, 244, 158, 43, 178, 1, 67 },
+	{ 188, 146, 54, 128, 160, 47, 243, 105, 181, 80, 54, 250, 142, 174, 89, 131, 154, 36, 235, 7, 152, 204, 68, 224, 190, 121, 239, 136, 10, 88, 59, 109, 218, 2, 122, 33, 214, 72, 45, 175, 27, 188, 75, 98, 230, 159, 104, 82, 144, 117, 245, 100, 213, 16, 185, 128, 29, 110, 9, 195, 80, 228, 96, 159 },
+	{ 40, 89, 244, 194, 24, 218, 132, 38, 150, 232, 204, 95, 194, 43, 230, 20, 202, 77, 216, 56, 114, 248, 168, 27, 87, 42, 199, 104, 166, 188, 236, 22, 170, 231, 66, 94, 171, 5, 129, 249, 59, 224, 18, 202, 41, 2, 246, 194, 224, 161, 11, 180, 43, 118, 159, 70, 238, 173, 93, 217, 58, 141, 26, 239 },
+	{ 199, 12, 172, 71, 116, 91, 188, 68, 17, 115, 30, 159, 6, 110, 212, 67, 118, 164, 99, 182, 21, 80, 46, 142, 213, 163, 72, 26, 220, 124, 37, 145, 86, 44, 134, 194, 235, 111, 207, 83, 141, 105, 165, 123, 181, 70, 116, 50, 29, 92, 63, 137, 226, 85, 196, 11, 211, 48, 137, 32, 114, 169, 207, 124 },
+	{ 106, 140, 221, 35, 237, 14, 156, 255, 201, 172, 71, 129, 244, 79, 140, 178, 3, 251, 33, 132, 230, 194, 125, 234, 101, 12, 249, 140, 50, 78, 213, 115, 242, 201, 155, 21, 52, 148, 36, 183, 9, 214, 49, 252, 87, 213, 170, 136, 184, 209, 240, 167, 29, 58, 255, 99, 151, 78, 227, 181, 252, 16, 76, 50 },
+	{ 248, 62, 86, 163, 135, 206, 55, 124, 86, 45, 227, 186, 50, 165, 31, 236, 55, 147, 207, 64, 156, 95, 1, 180, 54, 122, 187, 92, 237, 157, 10, 175, 69, 14, 100, 253, 75, 191, 96, 232, 160, 78, 136, 12, 149, 32, 229, 10, 78, 124, 18, 104, 200, 126, 144, 41, 177, 120, 2, 65, 152, 103, 219, 176 },
+	{ 157, 27, 213, 110, 46, 180, 102, 3, 218, 142, 104, 11, 215, 121, 199, 102, 82, 184, 108, 17, 220, 41, 252, 74, 150, 225, 40, 169, 20, 201, 97, 54, 189, 127, 219, 164, 117, 216, 23, 63, 122, 34, 236, 192, 113, 64, 99, 158, 253, 54, 152, 76, 236, 5, 186, 216, 23, 245, 197, 90, 205, 45, 131, 4 },
+	{ 235, 118, 194, 8, 246, 79, 232, 164, 188, 25, 249, 154, 92, 66, 24, 221, 131, 38, 239, 75, 175, 138, 111, 200, 28, 83, 207, 110, 67, 125, 226, 147, 246, 31, 82, 46, 10, 174, 140, 250, 180, 208, 91, 54, 161, 241, 198, 42, 112, 187, 221, 38, 173, 114, 65, 86, 109, 55, 163, 126, 18, 228, 186, 94 },
+	{ 144, 47, 166, 67, 151, 24, 139, 41, 67, 122, 79, 38, 183, 241, 149, 172, 10, 195, 160, 124, 204, 56, 16, 161, 239, 131, 5, 153, 252, 174, 42, 0, 111, 167, 206, 132, 239, 71, 103, 49, 1, 108, 168, 23, 215, 14, 136, 84, 214, 0, 132, 97, 208, 48, 242, 166, 225, 141, 34, 235, 60, 149, 78, 31 },
+	{ 71, 218, 99, 227, 190, 91, 211, 109, 202, 233, 165, 210, 132, 15, 113, 53, 254, 97, 47, 6, 87, 244, 189, 95, 63, 178, 221, 59, 31, 88, 199, 70, 217, 94, 59, 152, 194, 29, 223, 202, 151, 66, 227, 139, 73, 118, 181, 30, 166, 66, 247, 23, 158, 139, 26, 200, 7, 73, 191, 97, 175, 110, 254, 203 },
+	{ 172, 16, 135, 36, 122, 55, 251, 15, 150, 51, 5, 106, 60, 222, 87, 206, 73, 142, 211, 233, 154, 117, 35, 218, 121, 44, 101, 192, 135, 236, 116, 143, 182, 24, 234, 6, 85, 121, 165, 82, 128, 244, 41, 195, 97, 245, 50, 233, 146, 108, 179, 86, 231, 72, 124, 94, 156, 116, 247, 22, 211, 43, 11, 125 },
+	{ 243, 84, 179, 238, 1, 168, 133, 72, 181, 96, 194, 247, 147, 32, 187, 157, 18, 180, 110, 68, 25, 174, 79, 145, 10, 156, 241, 78, 11, 166, 22, 224, 46, 125, 199, 110, 179, 248, 44, 12, 189, 26, 116, 173, 5, 153, 203, 92, 12, 225, 40, 203, 14, 186, 250, 35, 219, 48, 169, 83, 131, 155, 193, 56 },
+	{ 152, 44, 200, 64, 100, 220, 197, 32, 237, 130, 23, 82, 170, 118, 231, 44, 129, 219, 35, 138, 194, 223, 52, 253, 184, 206, 33, 141, 216, 107, 62, 84, 155, 255, 71, 39, 147, 62, 205, 102, 157, 215, 87, 61, 221, 36, 69, 125, 173, 62, 141, 122, 53, 109, 169, 61, 194, 128, 9, 223, 62, 237, 92, 115 },
+	{ 28, 224, 112, 159, 137, 46, 83, 116, 158, 61, 222, 46, 204, 0, 69, 103, 247, 58, 90, 240, 2, 101, 124, 28, 90, 69, 113, 175, 53, 194, 241, 178, 4, 99, 169, 218, 15, 227, 139, 73, 238, 50, 143, 252, 129, 100, 190, 249, 32, 198, 88, 219, 152, 228, 2, 142, 83, 242, 103, 188, 33, 167, 4, 216 },
+	{ 176, 89, 12, 253, 22, 183, 241, 7, 209, 102, 184, 135, 94, 239, 143, 175, 11, 154, 200, 170, 74, 152, 210, 169, 133, 227, 4, 250, 94, 35, 143, 118, 208, 31, 132, 192, 88, 114, 21, 185, 123, 7, 176, 23, 206, 162, 19, 145, 111, 236, 5, 177, 31, 72, 98, 210, 25, 158, 68, 147, 117, 205, 75, 141 },
+	{ 60, 126, 195, 74, 214, 95, 149, 55, 175, 17, 250, 31, 163, 55, 194, 79, 212, 118, 28, 128, 45, 230, 17, 62, 199, 39, 189, 157, 126, 17, 231, 47, 77, 243, 60, 156, 49, 236, 170, 39, 213, 91, 197, 110, 77, 54, 228, 85, 50, 162, 68, 105, 254, 190, 128, 234, 178, 45, 219, 17, 253, 48, 105, 244 },
+	{ 39, 230, 144, 49, 162, 29, 126, 231, 89, 142, 75, 120, 220, 19, 125, 32, 232, 98, 68, 249, 178, 88, 116, 244, 99, 146, 56, 79, 220, 173, 90, 199, 166, 111, 222, 7, 126, 200, 70, 104, 247, 61, 149, 42, 241, 123, 178, 11, 204, 119, 193, 139, 45, 161, 16, 57, 87, 119, 197, 93, 132, 182, 22, 199 },
+	{ 167, 8, 100, 181, 113, 243, 66, 198, 41, 215, 171, 60, 200, 106, 254, 160, 49, 185, 208, 20, 137, 193, 35, 160, 11, 232, 120, 25, 197, 63, 131, 9, 148, 26, 180, 100, 251, 28, 141, 159, 16, 126, 225, 171, 4, 215, 95, 153, 247, 34, 217, 19, 91, 205, 114, 152, 249, 8, 169, 60, 229, 82, 149, 115 },
+	{ 220, 80, 247, 34, 206, 3, 170, 101, 23, 113, 240, 4, 148, 83, 183, 67, 135, 6, 152, 108, 56, 216, 75, 127, 213, 85, 166, 243, 107, 38, 249, 217, 55, 87, 207, 66, 163, 83, 215, 52, 184, 207, 28, 84, 137, 193, 35, 70, 134, 99, 61, 168, 243, 71, 225, 37, 189, 136, 222, 36, 162, 0, 240, 63 },
+	{ 131, 202, 151, 64, 129, 83, 223, 138, 189, 153, 48, 96, 230, 40, 13, 216, 113, 242, 81, 229, 167, 4, 255, 179, 63, 42, 187, 2, 140, 161, 97, 185, 117, 241, 136, 38, 189, 116, 9, 241, 88, 112, 64, 254, 104, 58, 164, 224, 22, 185, 233, 122, 145, 11, 174, 64, 100, 24, 75, 114, 206, 103, 191, 28 },
+	{ 44, 109, 14, 186, 234, 158, 55, 15, 253, 70, 210, 174, 123, 193, 155, 94, 178, 43, 200, 30, 92, 148, 103, 24, 204, 149, 95, 223, 74, 210, 14, 67, 35, 168, 1, 230, 57, 220, 132, 171, 38, 150, 201, 161, 20, 235, 116, 197, 81, 151, 0, 47, 86, 198, 111, 142, 242, 201, 156, 238, 52, 139, 77, 158 },
+	{ 175, 85, 219, 48, 98, 27, 201, 125, 92, 33, 133, 15, 72, 245, 58, 224, 21, 145, 65, 125, 193, 237, 51, 139, 113, 234, 32, 123, 51, 174, 129, 237, 150, 199, 79, 105, 153, 24, 93, 65, 229, 2, 123, 47, 182, 142, 7, 49, 251, 105, 208, 179, 222, 31, 54, 219, 5, 85, 126, 27, 183, 12, 244, 214 },
+	{ 19, 255, 140, 166, 122, 241, 74, 177, 218, 161, 233, 197, 105, 27, 141, 117, 84, 252, 160, 218, 14, 74, 172, 220, 8, 68, 167, 196, 252, 27, 84, 217, 101, 21, 253, 128, 205, 182, 248, 138, 179, 210, 94, 240, 75, 217, 95, 177, 130, 29, 72, 117, 155, 253, 130, 184, 159, 44, 177, 67, 223, 94, 120, 60 },
+	{ 195, 116, 68, 5, 210, 43, 145, 103, 1, 59, 85, 39, 165, 213, 181, 48, 198, 1, 106, 46, 181, 118, 34, 84, 187, 244, 101, 15, 151, 111, 182, 44, 142, 63, 177, 30, 49, 76, 11, 111, 33, 59, 165, 25, 112, 39, 203, 63, 221, 165, 234, 14, 57, 99, 21, 70, 96, 206, 250, 107, 151, 205, 33, 147 },
+	{ 97, 37, 179, 231, 90, 192, 20, 247, 195, 117, 148, 250, 127, 79, 13, 238, 131, 174, 229, 89, 140, 246, 208, 157, 128, 40, 142, 81, 209, 59, 231, 13, 195, 118, 214, 160, 95, 231, 147, 217, 84, 245, 127, 188, 226, 153, 121, 11, 143, 43, 88, 176, 197, 143, 212, 240, 121, 30, 136, 3, 47, 80, 171, 235 },
+	{ 72, 208, 124, 57, 150, 113, 69, 164, 45, 222, 178, 10, 56, 230, 97, 154, 61, 30, 73, 193, 17, 55, 101, 13, 228, 58, 216, 176, 29, 134, 157, 95, 245, 81, 4, 238, 113, 195, 40, 163, 192, 7, 148, 67, 17, 81, 168, 248, 101, 206, 120, 243, 74, 41, 169, 8, 188, 61, 231, 167, 199, 246, 130, 8 },
+	{ 226, 160, 14, 250, 30, 174, 230, 129, 95, 29, 72, 104, 193, 162, 37, 201, 121, 248, 158, 113, 223, 147, 199, 72, 115, 163, 0, 105, 242, 76, 213, 51, 165, 36, 148, 55, 136, 15, 69, 123, 100, 54, 233, 106, 206, 238, 33, 191, 70, 24, 154, 6, 136, 229, 111, 81, 146, 215, 89, 116, 67, 26, 104, 184 },
+	{ 39, 90, 136, 194, 80, 209, 13, 58, 200, 143, 240, 211, 138, 23, 111, 225, 84, 9, 209, 37, 65, 175, 26, 251, 185, 86, 235, 190, 41, 120, 8, 191, 128, 227, 186, 85, 210, 170, 221, 254, 26, 210, 167, 42, 138, 93, 57, 115, 227, 182, 52, 214, 100, 26, 200, 49, 165, 16, 40, 193, 154, 223, 52, 146 },
+	{ 237, 65, 219, 109, 48, 137, 102, 243, 157, 7, 120, 41, 84, 255, 187, 49, 145, 179, 99, 135, 243, 90, 126, 41, 149, 21, 132, 64, 150, 173, 255, 101, 25, 69, 106, 249, 28, 48, 91, 144, 181, 80, 132, 10, 195, 176, 150, 2, 135, 85, 255, 172, 66, 152, 244, 130, 225, 105, 254, 131, 11, 83, 205, 118 },
+	{ 188, 29, 177, 20, 163, 227, 184, 37, 81, 219, 180, 63, 164, 3, 130, 74, 19, 222, 53, 189, 5, 160, 216, 108, 228, 52, 200, 93, 221, 28, 83, 145, 211, 175, 7, 153, 127, 188, 113, 1, 61, 229, 109, 246, 75, 25, 232, 212, 165, 35, 108, 128, 42, 179, 87, 22, 71, 183, 58, 169, 235, 110, 164, 1 },
+	{ 98, 152, 122, 245, 91, 4, 66, 117, 170, 25, 106, 204, 236, 96, 212, 175, 246, 157, 123, 80, 232, 24, 61, 196, 79, 173, 248, 18, 113, 202, 60, 231, 47, 118, 204, 62, 227, 74, 239, 201, 156, 28, 174, 46, 207, 123, 101, 44, 76, 198, 15, 208, 234, 1, 195, 118, 212, 150, 95, 27, 196, 38, 67, 250 },
+	{ 45, 204, 75, 53, 214, 151, 201, 252, 133, 234, 49, 142, 31, 154, 56, 111, 38, 93, 25, 204, 140, 103, 181, 31, 142, 4, 125, 162, 45, 177, 130, 9, 162, 241, 92, 39, 164, 14, 135, 41, 98, 213, 129, 88, 156, 62, 251, 186, 130, 238, 156, 71, 95, 142, 57, 248, 43, 7, 239, 123, 80, 143, 215, 127 },
+	{ 87, 225, 9, 185, 127, 32, 99, 51, 15, 89, 187, 74, 122, 191, 18, 218, 137, 194, 242, 48, 169, 74, 254, 115, 214, 96, 57, 237, 78, 226, 97, 193, 73, 19, 136, 189, 108, 211, 85, 179, 250, 66, 6, 237, 182, 20, 146, 9, 96, 60, 30, 183, 121, 222, 159, 101, 172, 134, 202, 50, 227, 182, 20, 172 },
+	{ 32, 134, 162, 105, 236, 78, 183, 163, 209, 146, 223, 6, 250, 90, 232, 76, 168, 1, 69, 112, 220, 8, 154, 46, 234, 184, 151, 206, 11, 147, 33, 245, 110, 152, 218, 26, 248, 52, 153, 18, 119, 148, 191, 39, 111, 221, 81, 213, 172, 226, 147, 249, 46, 16, 80, 30, 192, 65, 89, 162, 10, 100, 61, 235 },
+	{ 197, 67, 255, 43, 148, 20, 229, 111, 69, 39, 117, 174, 59, 158, 127, 47, 105, 235, 153, 185, 36, 133, 209, 87, 19, 72, 30, 102, 121, 190, 63, 168, 209, 54, 86, 173, 71, 127, 225, 199, 49, 79, 227, 134, 57, 165, 31, 126, 48, 114, 7, 90, 196, 167, 211, 238, 114, 223, 26, 252, 138, 205, 150, 115 },
+	{ 167, 97, 14, 190, 63, 212, 133, 0, 245, 157, 98, 213, 34, 203, 11, 180, 207, 31, 126, 90, 243, 65, 192, 122, 169, 138, 198, 251, 51, 220, 88, 5, 131, 34, 227, 120, 3, 186, 35, 102, 164, 211, 25, 91, 246, 189, 102, 240, 193, 75, 207, 139, 65, 103, 136, 59, 4, 151, 182, 106, 71, 38, 243, 3 },
+	{ 223, 139, 208, 125, 94, 170, 46, 87, 189, 26, 232, 78, 141, 108, 245, 148, 87, 62, 224, 17, 166, 103, 13, 247, 57, 225, 89, 166, 18, 140, 181, 105, 253, 157, 196, 101, 241, 147, 83, 236, 8, 115, 180, 155, 0, 69, 143, 16, 154, 35, 174, 221, 21, 245, 38, 184, 126, 82, 44, 212, 128, 191, 90, 53 },
+	{ 181, 40, 82, 226, 23, 247, 153, 204, 120, 58, 171, 18, 191, 50, 73, 26, 237, 139, 190, 48, 216, 144, 40, 182, 110, 2, 41, 128, 71, 234, 45, 203, 76, 16, 67, 42, 166, 58, 203, 137, 68, 255, 53, 104, 198, 233, 45, 210, 92, 251, 106, 53, 121, 191, 154, 91, 205, 242, 167, 13, 232, 24, 155, 110 },
+	{ 249, 19, 158, 56, 183, 112, 70, 32, 228, 138, 92, 254, 120, 217, 169, 198, 106, 6, 163, 117, 68, 199, 234, 78, 159, 213, 188, 240, 108, 171, 28, 147, 122, 232, 185, 133, 214, 15, 117, 32, 191, 146, 219, 33, 136, 82, 119, 178, 62, 133, 3, 161, 229, 73, 12, 232, 24, 56, 141, 101, 66, 174, 217, 73 },
+	{ 119, 201, 98, 235, 135, 7, 216, 105, 164, 9, 184, 43, 153, 3, 94, 129, 52, 219, 84, 252, 24, 95, 123, 21, 133, 63, 96, 149, 9, 195, 93, 216, 52, 165, 82, 22, 98, 249, 170, 228, 96, 12, 76, 172, 207, 13, 161, 228, 23, 217, 197, 88, 33, 140, 100, 170, 120, 78, 190, 250, 124, 41, 138, 8 },
+	{ 55, 140, 176, 28, 76, 196, 148, 50, 243, 77, 209, 107, 71, 233, 37, 248, 152, 179, 36, 137, 187, 154, 50, 221, 176, 255, 30, 54, 223, 134, 66, 239, 0, 109, 204, 236, 153, 65, 86, 45, 156, 126, 240, 109, 51, 248, 97, 39, 111, 147, 68, 175, 209, 255, 49, 198, 220, 34, 159, 0, 203, 96, 186, 224 },
+	{ 85, 242, 46, 114, 168, 253, 19, 96, 190, 132, 21, 226, 173, 135, 185, 81, 21, 69, 207, 108, 9, 239, 206, 86, 6, 113, 157, 201, 86, 22, 158, 119, 180, 36, 143, 47, 120, 197, 3, 177, 208, 58, 187, 26, 156, 129, 193, 76, 183, 246, 42, 127, 18, 109, 155, 6, 134, 91, 226, 50, 79, 235, 26, 157 },
+};
+// clang-format on
+
+/**
+ * Returns the level of a pixel in a Bayer matrix of 2^bits * 2^bits: every
+ * bit of the coordinates, from the lowest, adds the next two bits of the
+ * level from the highest, as in the 2x2 matrix (0 2 / 3 1). Only intended
+ * for internal usage.
+ */
+static inline int
+__ni_image_dither_bayer(int x, int y, int bits)
+{
+	int level = 0;
+	for(int b = 0; b < bits; b++)
+		level = (level << 2) | ((((x >> b) ^ (y >> b)) & 1) << 1) | ((y >> b) & 1);
+	return level;
+}
+
+/**
+ * Fills the rows of thresholds of a pattern, each tiled to
+ * __NI_DITHER_ORDERED_TILE columns. A level l of n is the threshold
+ * (2l + 1) * 255 / 2n + 1, so the levels are spread evenly over the bytes
+ * and a byte is white from its threshold up. Only intended for internal
+ * usage.
+ *
+ * pattern -> the threshold matrix
+ * thresholds -> the rows of thresholds
+ *
+ * returns the number of rows of the matrix, or 0 if pattern is not valid.
+ */
+static int
+__ni_image_dither_ordered_thresholds(NI_IMAGE_DITHER_PATTERN pattern, stbi_uc thresholds[__NI_DITHER_ORDERED_TILE][__NI_DITHER_ORDERED_TILE])
+{
+	int size, n_levels, level;
+	switch(pattern) {
+	case(NI_DITHER_BAYER_2X2):
+	case(NI_DITHER_BAYER_4X4):
+	case(NI_DITHER_BAYER_8X8):
+	case(NI_DITHER_BAYER_16X16):
+		size = 2 << (pattern - NI_DITHER_BAYER_2X2);
+		n_levels = size * size;
+		break;
+	case(NI_DITHER_BLUE_NOISE):
+		size = __NI_DITHER_ORDERED_TILE;
+		n_levels = UCHAR_MAX + 1;
+		break;
+	default:
+		return 0;
+	}
+
+	for(int __y = 0; __y < size; __y++)
+		for(int __x = 0; __x < __NI_DITHER_ORDERED_TILE; __x++) {
+			if(pattern == NI_DITHER_BLUE_NOISE)
+				level = __ni_image_dither_blue_noise[__y][__x];
+			else
+				level = __ni_image_dither_bayer(__x % size, __y, pattern - NI_DITHER_BAYER_2X2 + 1);
+			thresholds[__y][__x] = (stbi_uc)((2 * level + 1) * UCHAR_MAX / (2 * n_levels) + 1);
+		}
+	return size;
+}
+
+/**
+ * An ordered dithering of an image by bands of rows. Only intended for
+ * internal usage.
+ */
+typedef struct __ni_image_dither_ordered_job {
+	const ni_image *src;
+	ni_image *dst;
+	const stbi_uc (*thresholds)[__NI_DITHER_ORDERED_TILE];
+	int size;
+} __ni_image_dither_ordered_job;
+
+/**
+ * Thread pool task of the ordered dithering of one band of rows. Only
+ * intended for internal usage.
+ */
+static void
+__ni_image_dither_ordered_task(void *arg, int index, int n_tasks)
+{
+	const __ni_image_dither_ordered_job *job = arg;
+	const int y0 = (int)((long long)job->src->h * index / n_tasks);
+	const int y1 = (int)((long long)job->src->h * (index + 1) / n_tasks);
+	for(int __y = y0; __y < y1; __y++)
+		ni_simd_threshold_u8(ni_image_row(job->src, __y), job->thresholds[__y % job->size], __NI_DITHER_ORDERED_TILE, ni_image_row(job->dst, __y), job->src->w);
+}
+
+/**
+ * Ordered dithering of an image, that every entry point shares. Only
+ * intended for internal usage.
+ *
+ * pool -> the pool that runs the bands
+ * src -> the original image
+ * dst -> output image of the same size, may be src
+ * pattern -> the threshold matrix
+ *
+ * returns dst or NULL on error.
+ */
+static ni_image *
+__ni_image_dither_ordered(ni_threadpool *pool,
+	const ni_image *src,
+	ni_image *dst,
+	NI_IMAGE_DITHER_PATTERN pattern)
+{
+	stbi_uc thresholds[__NI_DITHER_ORDERED_TILE][__NI_DITHER_ORDERED_TILE];
+	__ni_image_dither_ordered_job job = { src, dst, (const stbi_uc(*)[__NI_DITHER_ORDERED_TILE])thresholds, 0 };
+	job.size = __ni_image_dither_ordered_thresholds(pattern, thresholds);
+	// ERROR: unknown pattern
+	if(job.size == 0)
+		return NULL;
+
+	const int n_tasks = ni_threadpool_size(pool);
+	ni_threadpool_run(pool, __ni_image_dither_ordered_task, &job, (n_tasks < src->h) ? n_tasks : src->h);
+	return dst;
+}
+
+stbi_uc *
+ni_image_dither_ordered_gray2mono(const stbi_uc *img_data,
+	int w,
+	int h,
+	NI_IMAGE_DITHER_PATTERN pattern)
+{
+	stbi_uc *ret_img = ni_image_create(w, h, 1);
+	if(ni_image_dither_ordered_gray2mono_into(img_data, w, h, pattern, ret_img) == NULL) {
+		ni_free(ret_img);
+		return NULL;
+	}
+	return ret_img;
+}
+
+stbi_uc *
+ni_image_dither_ordered_gray2mono_into(const stbi_uc *img_data,
+	int w,
+	int h,
+	NI_IMAGE_DITHER_PATTERN pattern,
+	stbi_uc *out)
+{
+	// ERROR: no output
+	if(out == NULL)
+		return NULL;
+
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, 1, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(out, w, h, 1, NI_PIXEL_U8);
+	if(__ni_image_dither_ordered(ni_threadpool_default(), &src, &dst, pattern) == NULL)
+		return NULL;
+	return out;
+}
+
+stbi_uc *
+ni_image_dither_ordered_gray2mono_ctx(ni_context *ctx,
+	const stbi_uc *img_data,
+	int w,
+	int h,
+	NI_IMAGE_DITHER_PATTERN pattern,
+	stbi_uc *out)
+{
+	stbi_uc *img = (out == NULL) ? ni_image_create(w, h, 1) : out;
+	// ERROR: out of memory
+	if(img == NULL)
+		return NULL;
+
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, 1, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(img, w, h, 1, NI_PIXEL_U8);
+	if(ni_image_dither_ordered_gray2mono_view(ctx, &src, &dst, pattern) == NULL) {
+		if(out == NULL)
+			ni_free(img);
+		return NULL;
+	}
+	return img;
+}
+
+ni_image *
+ni_image_dither_ordered_gray2mono_view(ni_context *ctx,
+	const ni_image *src,
+	ni_image *dst,
+	NI_IMAGE_DITHER_PATTERN pattern)
+{
+	// ERROR: the images do not match
+	if(src->n_channels != 1 || !__ni_image_views_match(src, dst, 1))
+		return NULL;
+
+	return __ni_image_dither_ordered(ni_context_threadpool(ctx), src, dst, pattern);
+}
+
 #endif // NI_DITHER_IMPLEMENTATION
 
 #endif // NI_INCLUDE_DITHER
\ No newline at end of file
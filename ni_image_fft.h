@@ -0,0 +1,267 @@
+#ifndef NI_INCLUDE_FFT
+#define NI_INCLUDE_FFT
+
+#include "math.h"
+
+#ifndef NI_INCLUDE_IMAGE_UTILS
+#define NI_IMAGE_UTILS_IMPLEMENTATION
+#include "ni_image_utils.h"
+#endif
+
+// = DECLARATION =
+
+/**
+ * Precomputed twiddle factors for radix-2 transforms of a power of two
+ * size. Complex numbers are stored interleaved (real, imaginary) in arrays
+ * of doubles, and the transforms are unnormalized: a forward and an inverse
+ * transform of size n scale the data by n.
+ */
+typedef struct ni_fft_plan ni_fft_plan;
+
+/**
+ * Returns the smallest power of two that is greater or equal than n.
+ *
+ * int n -> minimum size (> 0)
+ */
+int ni_fft_size(int n);
+
+/**
+ * Creates a plan for transforms of size n, that needs to be destroyed with
+ * ni_fft_plan_destroy. The same plan serves the complex transforms of any
+ * power of two size up to n, and the real transforms of size n.
+ *
+ * int n -> size of the transforms, a power of two >= 2
+ *
+ * returns a pointer to the new plan or NULL on error.
+ */
+ni_fft_plan *ni_fft_plan_create(int n);
+
+/**
+ * Frees a plan created with ni_fft_plan_create.
+ *
+ * ni_fft_plan *plan -> the plan to destroy
+ */
+void ni_fft_plan_destroy(ni_fft_plan *plan);
+
+/**
+ * Returns the number of bytes ni_fft_plan_init needs for a plan of size n.
+ *
+ * int n -> size of the transforms
+ */
+size_t ni_fft_plan_bytes(int n);
+
+/**
+ * Same as ni_fft_plan_create but the plan is built on memory owned by the
+ * caller, so it is not destroyed.
+ *
+ * void *mem -> ni_fft_plan_bytes(n) bytes aligned like a double
+ * int n -> size of the transforms, a power of two >= 2
+ *
+ * returns a pointer to the plan (mem) or NULL on error.
+ */
+ni_fft_plan *ni_fft_plan_init(void *mem, int n);
+
+/**
+ * Computes in place the complex transform of m elements.
+ *
+ * const ni_fft_plan *plan -> plan of size n >= m
+ * double *z -> m complex numbers (2 * m doubles)
+ * int m -> size of the transform, a power of two
+ * int inverse -> 0 for the forward transform, 1 for the inverse one
+ */
+void ni_fft_complex(const ni_fft_plan *plan, double *z, int m, int inverse);
+
+/**
+ * Computes in place the transform of n real numbers. As the spectrum of
+ * real data is symmetric, only its first n / 2 + 1 elements are kept.
+ *
+ * const ni_fft_plan *plan -> plan of size n
+ * double *z -> n real numbers on input, n / 2 + 1 complex numbers
+ * (n + 2 doubles) on output
+ */
+void ni_fft_forward_real(const ni_fft_plan *plan, double *z);
+
+/**
+ * Computes in place the inverse of ni_fft_forward_real, scaled by n.
+ *
+ * const ni_fft_plan *plan -> plan of size n
+ * double *z -> n / 2 + 1 complex numbers on input, n real numbers on output
+ */
+void ni_fft_inverse_real(const ni_fft_plan *plan, double *z);
+
+// = IMPLEMENTATION =
+#ifdef NI_FFT_IMPLEMENTATION
+
+struct ni_fft_plan {
+	int n;
+	double *twiddles; // e^(-2 pi i k / n) for k in [0, n / 2)
+};
+
+int
+ni_fft_size(int n)
+{
+	int size = 1;
+	while(size < n)
+		size <<= 1;
+	return size;
+}
+
+size_t
+ni_fft_plan_bytes(int n)
+{
+	// The twiddles go right after the plan
+	return sizeof(ni_fft_plan) + sizeof(double) * n;
+}
+
+ni_fft_plan *
+ni_fft_plan_init(void *mem, int n)
+{
+	// ERROR: not a power of two
+	if(mem == NULL || n < 2 || (n & (n - 1)) != 0)
+		return NULL;
+
+	ni_fft_plan *plan = mem;
+	plan->n = n;
+	plan->twiddles = (double *)(plan + 1);
+	for(int k = 0; k < n / 2; k++) {
+		plan->twiddles[2 * k] = cos(-2.0 * M_PI * k / n);
+		plan->twiddles[2 * k + 1] = sin(-2.0 * M_PI * k / n);
+	}
+	return plan;
+}
+
+ni_fft_plan *
+ni_fft_plan_create(int n)
+{
+	// ERROR: not a power of two
+	if(n < 2 || (n & (n - 1)) != 0)
+		return NULL;
+
+	void *mem = ni_alloc(ni_fft_plan_bytes(n));
+	if(mem == NULL)
+		return NULL;
+	return ni_fft_plan_init(mem, n);
+}
+
+void
+ni_fft_plan_destroy(ni_fft_plan *plan)
+{
+	ni_free(plan);
+}
+
+void
+ni_fft_complex(const ni_fft_plan *plan, double *z, int m, int inverse)
+{
+	const double sign = inverse ? -1.0 : 1.0;
+	double t, wr, wi, tr, ti;
+	double *a, *b;
+	int bit, step;
+
+	// -- BIT REVERSAL --
+	for(int i = 1, j = 0; i < m; i++) {
+		for(bit = m >> 1; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if(i < j) {
+			t = z[2 * i];
+			z[2 * i] = z[2 * j];
+			z[2 * j] = t;
+			t = z[2 * i + 1];
+			z[2 * i + 1] = z[2 * j + 1];
+			z[2 * j + 1] = t;
+		}
+	}
+
+	// -- BUTTERFLIES --
+	for(int len = 2; len <= m; len <<= 1) {
+		step = plan->n / len;
+		for(int i = 0; i < m; i += len) {
+			for(int k = 0; k < len / 2; k++) {
+				wr = plan->twiddles[2 * k * step];
+				wi = sign * plan->twiddles[2 * k * step + 1];
+				a = z + 2 * (i + k);
+				b = z + 2 * (i + k + len / 2);
+				tr = b[0] * wr - b[1] * wi;
+				ti = b[0] * wi + b[1] * wr;
+				b[0] = a[0] - tr;
+				b[1] = a[1] - ti;
+				a[0] += tr;
+				a[1] += ti;
+			}
+		}
+	}
+}
+
+void
+ni_fft_forward_real(const ni_fft_plan *plan, double *z)
+{
+	const int n = plan->n;
+	double er, ei, odd_r, odd_i, wr, wi;
+	double *zk, *zm;
+
+	// The even and odd elements are the real and imaginary parts of a
+	// complex transform of half the size, which is then split in two
+	ni_fft_complex(plan, z, n / 2, 0);
+
+	er = z[0];
+	ei = z[1];
+	z[0] = er + ei;
+	z[1] = 0.0;
+	z[n] = er - ei;
+	z[n + 1] = 0.0;
+
+	for(int k = 1; k <= n / 4; k++) {
+		zk = z + 2 * k;
+		zm = z + 2 * (n / 2 - k);
+		// E = (Z[k] + conj(Z[m])) / 2, O = (Z[k] - conj(Z[m])) / 2i
+		er = 0.5 * (zk[0] + zm[0]);
+		ei = 0.5 * (zk[1] - zm[1]);
+		odd_r = 0.5 * (zk[1] + zm[1]);
+		odd_i = -0.5 * (zk[0] - zm[0]);
+		wr = plan->twiddles[2 * k];
+		wi = plan->twiddles[2 * k + 1];
+		// X[k] = E + W^k O, X[m] = conj(E) - conj(W^k) conj(O)
+		zk[0] = er + (wr * odd_r - wi * odd_i);
+		zk[1] = ei + (wr * odd_i + wi * odd_r);
+		zm[0] = er - (wr * odd_r - wi * odd_i);
+		zm[1] = -ei + (wr * odd_i + wi * odd_r);
+	}
+}
+
+void
+ni_fft_inverse_real(const ni_fft_plan *plan, double *z)
+{
+	const int n = plan->n;
+	double er, ei, dr, di, odd_r, odd_i, wr, wi;
+	double *zk, *zm;
+
+	er = z[0];
+	ei = z[n];
+	z[0] = er + ei;
+	z[1] = er - ei;
+
+	for(int k = 1; k <= n / 4; k++) {
+		zk = z + 2 * k;
+		zm = z + 2 * (n / 2 - k);
+		// E = X[k] + conj(X[m]), O = (X[k] - conj(X[m])) conj(W^k)
+		er = zk[0] + zm[0];
+		ei = zk[1] - zm[1];
+		dr = zk[0] - zm[0];
+		di = zk[1] + zm[1];
+		wr = plan->twiddles[2 * k];
+		wi = plan->twiddles[2 * k + 1];
+		odd_r = dr * wr + di * wi;
+		odd_i = di * wr - dr * wi;
+		// Z[k] = E + i O, Z[m] = conj(E) + i conj(O)
+		zk[0] = er - odd_i;
+		zk[1] = ei + odd_r;
+		zm[0] = er + odd_i;
+		zm[1] = -ei + odd_r;
+	}
+
+	ni_fft_complex(plan, z, n / 2, 1);
+}
+
+#endif // NI_FFT_IMPLEMENTATION
+
+#endif // NI_INCLUDE_FFT
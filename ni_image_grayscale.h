@@ -8,6 +8,16 @@
 #include "ni_image_utils.h"
 #endif
 
+#ifndef NI_INCLUDE_CONTEXT
+#define NI_CONTEXT_IMPLEMENTATION
+#include "ni_image_context.h"
+#endif
+
+#ifndef NI_INCLUDE_PLANAR
+#define NI_PLANAR_IMPLEMENTATION
+#include "ni_image_planar.h"
+#endif
+
 // = DECLARATION =
 
 /**
@@ -19,19 +29,160 @@ typedef enum __NI_IMAGE_GRAYSCALE_STD {
 	NI_SMPTE_240M, // SMPTE 240M
 } NI_IMAGE_GRAYSCALE_STD;
 
+/**
+ * Order of the color channels of the original image
+ */
+typedef enum __NI_IMAGE_CHANNEL_ORDER {
+	NI_ORDER_RGB, // RGB and RGBA
+	NI_ORDER_BGR, // BGR and BGRA
+} NI_IMAGE_CHANNEL_ORDER;
+
+/**
+ * Options of the conversion to grayscale (see
+ * ni_image_grayscale_convert_opts). A NULL pointer to them is the same as
+ * { NI_ORDER_RGB, 0, { 0, 0, 0 } }.
+ *
+ * order -> order of the color channels, the alpha is always the last one
+ * composite -> 0 to ignore the alpha, 1 to composite the image over the
+ * background before converting it
+ * background -> R, G and B of the background, in that order for both
+ * channel orders
+ */
+typedef struct ni_grayscale_options {
+	NI_IMAGE_CHANNEL_ORDER order;
+	int composite;
+	stbi_uc background[3];
+} ni_grayscale_options;
+
 /**
  * Converts the image to monochrome and returns the data
  * on a new image, that needs to be freed afterwards.
  *
  * w -> width of the original image
  * h -> height of the original image
- * n_channels -> number of channels of the original image
+ * n_channels -> number of channels of the original image: 1 (gray), 2
+ * (gray and alpha), 3 (RGB) or 4 (RGBA). The alpha is ignored and the gray
+ * images are copied as they are (see ni_image_grayscale_convert_opts for
+ * BGR and the compositing).
  *
- * Note: n_channels needs to be three for now, as it only supports
- * RGB images, but maybe in the future there's more options.
+ * The luma is calculated in fixed point and vectorised (see
+ * ni_simd_luma_u8), giving exactly the same bytes as the formulas of the
+ * standards in double precision.
+ *
+ * With NI_PRECISION_FLOAT the luma is computed in single precision, so a
+ * gray can be one level away from the NI_PRECISION_DOUBLE one, never more.
+ * Which colors are off depends on the compiler and its flags (e.g. whether
+ * it contracts the products into FMA instructions).
  */
 stbi_uc *ni_image_grayscale_convert(const stbi_uc *img_data, int w, int h, int n_channels, NI_IMAGE_GRAYSCALE_STD type);
 
+/**
+ * Same as ni_image_grayscale_convert but the result is written to an image
+ * owned by the caller. It needs no temporary memory, so nothing is
+ * allocated.
+ *
+ * out -> output image of w * h bytes, may be img_data
+ *
+ * returns out or NULL on error.
+ */
+stbi_uc *ni_image_grayscale_convert_into(const stbi_uc *img_data, int w, int h, int n_channels, NI_IMAGE_GRAYSCALE_STD type, stbi_uc *out);
+
+/**
+ * Same as ni_image_grayscale_convert_into, taking a context like the rest
+ * of the operations (see ni_image_context.h). The conversion needs no
+ * scratch, so the context is only there to keep the calls uniform.
+ *
+ * ctx -> the context, NULL uses the defaults
+ * out -> output image of w * h bytes (may be img_data), or NULL to return a
+ * new one that needs to be freed afterwards
+ *
+ * returns out (or the new image) or NULL on error.
+ */
+stbi_uc *ni_image_grayscale_convert_ctx(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, NI_IMAGE_GRAYSCALE_STD type, stbi_uc *out);
+
+/**
+ * Same as ni_image_grayscale_convert_ctx with the channel order and the
+ * alpha compositing of the options. Every row is converted in one pass: it
+ * is split into planes a chunk at a time, so the chunk stays in L1 while
+ * the colors are composited and the luma is calculated, all vectorised.
+ *
+ * The compositing rounds every color to a byte,
+ *
+ *   C = round((C * A + background * (255 - A)) / 255)
+ *
+ * so the result is the same as compositing the image into an RGB one
+ * first and converting that. The gray images are composited over the gray
+ * of the background with the same standard. The images without alpha are
+ * opaque, so they are converted as with ni_image_grayscale_convert_ctx.
+ *
+ * ctx -> the context, NULL uses the defaults
+ * opts -> the options, NULL for RGB with the alpha ignored
+ * out -> output image of w * h bytes (may be img_data), or NULL to return a
+ * new one that needs to be freed afterwards
+ *
+ * returns out (or the new image) or NULL on error.
+ *
+ * Error conditions:
+ *  -> n_channels is not between 1 and 4
+ *  -> type is not a valid standard or the order of opts is not valid
+ */
+stbi_uc *ni_image_grayscale_convert_opts(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, NI_IMAGE_GRAYSCALE_STD type, const ni_grayscale_options *opts, stbi_uc *out);
+
+/**
+ * Same as ni_image_grayscale_convert_ctx but on image descriptors, so a
+ * region of a larger image can be converted without copying it (see
+ * ni_image_view in ni_image_utils.h).
+ *
+ * ctx -> the context, NULL uses the defaults
+ * src -> the original image, with 1 to 4 channels
+ * dst -> output image of the same size and pixel type, with 1 channel
+ *
+ * The images can be NI_PIXEL_U8, NI_PIXEL_U16 or NI_PIXEL_F32. NI_PIXEL_F32
+ * is always converted in single precision and not rounded.
+ *
+ * returns dst or NULL on error.
+ *
+ * Error conditions:
+ *  -> src does not have 1 to 4 channels or dst does not have 1
+ *  -> the pixel types or sizes of the images do not match
+ *  -> type is not a valid standard
+ */
+ni_image *ni_image_grayscale_convert_view(ni_context *ctx, const ni_image *src, ni_image *dst, NI_IMAGE_GRAYSCALE_STD type);
+
+/**
+ * Same as ni_image_grayscale_convert_view with the options of
+ * ni_image_grayscale_convert_opts. The channel order works for every pixel
+ * type, but only the NI_PIXEL_U8 images can be composited.
+ *
+ * opts -> the options, NULL for RGB with the alpha ignored
+ *
+ * returns dst or NULL on error.
+ *
+ * Error conditions:
+ *  -> src does not have 1 to 4 channels or dst does not have 1
+ *  -> the pixel types or sizes of the images do not match
+ *  -> type is not a valid standard or the order of opts is not valid
+ *  -> opts asks to composite an image that is not NI_PIXEL_U8
+ */
+ni_image *ni_image_grayscale_convert_view_opts(ni_context *ctx, const ni_image *src, ni_image *dst, NI_IMAGE_GRAYSCALE_STD type, const ni_grayscale_options *opts);
+
+/**
+ * Same as ni_image_grayscale_convert_view but the original image is planar
+ * (see ni_image_planar.h), with the R, G and B planes in that order.
+ *
+ * ctx -> the context, NULL uses the defaults
+ * src -> the original planar image, with 3 planes
+ * dst -> output image of the same size and pixel type, with 1 channel
+ *
+ * returns dst or NULL on error.
+ *
+ * Error conditions:
+ *  -> src does not have 3 planes or dst does not have 1 channel
+ *  -> the pixel types or sizes of the images do not match
+ *  -> type is not a valid standard
+ */
+ni_image *ni_image_grayscale_convert_planes(ni_context *ctx, const ni_planes *src, ni_image *dst, NI_IMAGE_GRAYSCALE_STD type);
+
 /**
  * Creates a representation of a grayscale image (1 channel, 1 byte per
  * channel) into a normalized array of doubles.
@@ -87,120 +238,477 @@ static inline stbi_uc gray_unnormalize(double val);
 // = IMPLEMENTATION =
 #ifdef NI_GRAYSCALE_IMPLEMENTATION
 
+static inline double
+gray_normalize(stbi_uc val)
+{
+	return ((double)val) / ((double)UCHAR_MAX);
+}
+
+static inline stbi_uc
+gray_unnormalize(double val)
+{
+	return (stbi_uc)round(val * UCHAR_MAX);
+}
+
+stbi_uc *
+ni_image_grayscale_convert(const stbi_uc *img_data, int w, int h, int n_channels, NI_IMAGE_GRAYSCALE_STD type)
+{
+	stbi_uc *ret_img =
+		ni_image_create(w, h, 1); // This image is grayscale -> 1 channel
+	if(ni_image_grayscale_convert_into(img_data, w, h, n_channels, type, ret_img) == NULL) {
+		ni_free(ret_img);
+		return NULL;
+	}
+	return ret_img;
+}
+
+// clang-format off
+/**
+ * Note: this is intended only for internal usage
+ *
+ * Generates the row kernels of a standard, that convert w pixels of
+ * element type T to their luma, computed in type F and rounded with ROUND.
+ * The R, G and B values are read through three pointers that advance by
+ * the number of channels, so the same kernel reads interleaved images and
+ * planes. NAME##_kernel is generic on it and it is fixed to planes in
+ * NAME##_c1 (see __NI_IMAGE_GRAYSCALE_INTERLEAVED for the rest).
+ *
+ * NAME -> name of the generated functions
+ * T -> type of the elements of the images
+ * F -> type the luma is computed in (double or float)
+ * ROUND -> rounding function, empty to keep the value as it is
+ * KR, KG, KB -> coefficients of R, G and B
+ */
+#define __NI_IMAGE_GRAYSCALE_ROW(NAME, T, F, ROUND, KR, KG, KB) \
+	NI_SPECIALIZED void \
+	NAME##_kernel(const void *r_row, const void *g_row, const void *b_row, void *out_row, int w, int n_channels) \
+	{ \
+		const T *r = r_row, *g = g_row, *b = b_row; \
+		T *out = out_row; \
+		for(int __x = 0; __x < w; __x++) \
+			out[__x] = (T)ROUND(((F)(KR) * (F)r[__x * n_channels]) + ((F)(KG) * (F)g[__x * n_channels]) + ((F)(KB) * (F)b[__x * n_channels])); \
+	} \
+	static void \
+	NAME##_c1(const void *r, const void *g, const void *b, void *out, int w) \
+	{ \
+		NAME##_kernel(r, g, b, out, w, 1); \
+	}
+
+/**
+ * Note: this is intended only for internal usage
+ *
+ * Generates the row kernels of every standard for a pixel type and a
+ * precision (see __NI_IMAGE_GRAYSCALE_ROW).
+ */
+#define __NI_IMAGE_GRAYSCALE_ROWS(NAME, T, F, ROUND) \
+	/* LUMA = 0.299 R + 0.587 G + 0.114 B */ \
+	__NI_IMAGE_GRAYSCALE_ROW(NAME##_bt_601, T, F, ROUND, 0.299, 0.587, 0.114) \
+	/* LUMA = 0.2126 R + 0.7152 G + 0.0722 B */ \
+	__NI_IMAGE_GRAYSCALE_ROW(NAME##_bt_709, T, F, ROUND, 0.2126, 0.7152, 0.0722) \
+	/* LUMA = 0.212 R + 0.701 G + 0.087 B */ \
+	__NI_IMAGE_GRAYSCALE_ROW(NAME##_smpte_240m, T, F, ROUND, 0.212, 0.701, 0.087)
+
+/**
+ * Note: this is intended only for internal usage
+ *
+ * Generates the kernels of the interleaved RGB (NAME##_c3) and RGBA
+ * (NAME##_c4) rows of every standard from the ones of
+ * __NI_IMAGE_GRAYSCALE_ROWS. The bytes do not need them, as they are split
+ * into planes first (see __ni_image_grayscale_u8_row).
+ */
+#define __NI_IMAGE_GRAYSCALE_INTERLEAVED_ROW(NAME) \
+	static void \
+	NAME##_c3(const void *r, const void *g, const void *b, void *out, int w) \
+	{ \
+		NAME##_kernel(r, g, b, out, w, 3); \
+	} \
+	static void \
+	NAME##_c4(const void *r, const void *g, const void *b, void *out, int w) \
+	{ \
+		NAME##_kernel(r, g, b, out, w, 4); \
+	}
+#define __NI_IMAGE_GRAYSCALE_INTERLEAVED(NAME) \
+	__NI_IMAGE_GRAYSCALE_INTERLEAVED_ROW(NAME##_bt_601) \
+	__NI_IMAGE_GRAYSCALE_INTERLEAVED_ROW(NAME##_bt_709) \
+	__NI_IMAGE_GRAYSCALE_INTERLEAVED_ROW(NAME##_smpte_240m)
+// clang-format on
+
+/**
+ * Note: this is intended only for internal usage
+ *
+ * Weights of every standard in fixed point for ni_simd_luma_u8, with the
+ * same doubles as the row kernels.
+ */
+static const ni_simd_luma_weights __ni_image_grayscale_weights[3] = {
+	{ { 299, 587, 114 }, 1000, { 0.299, 0.587, 0.114 } },
+	{ { 2126, 7152, 722 }, 10000, { 0.2126, 0.7152, 0.0722 } },
+	{ { 212, 701, 87 }, 1000, { 0.212, 0.701, 0.087 } },
+};
+
+// clang-format off
+/**
+ * Note: this is intended only for internal usage
+ *
+ * Generates the 8 bit double precision plane kernels of every standard,
+ * with the same names as __NI_IMAGE_GRAYSCALE_ROWS. They give the same
+ * bytes as the formula in double precision, but compute it in fixed point
+ * (see ni_simd_luma_u8).
+ */
+#define __NI_IMAGE_GRAYSCALE_FIXED_ROW(NAME, STD) \
+	static void \
+	NAME##_c1(const void *r, const void *g, const void *b, void *out, int w) \
+	{ \
+		ni_simd_luma_u8(r, g, b, out, w, &__ni_image_grayscale_weights[STD]); \
+	}
+#define __NI_IMAGE_GRAYSCALE_FIXED_ROWS(NAME) \
+	__NI_IMAGE_GRAYSCALE_FIXED_ROW(NAME##_bt_601, NI_ITU_BT_601) \
+	__NI_IMAGE_GRAYSCALE_FIXED_ROW(NAME##_bt_709, NI_ITU_BT_709) \
+	__NI_IMAGE_GRAYSCALE_FIXED_ROW(NAME##_smpte_240m, NI_SMPTE_240M)
+// clang-format on
+
+__NI_IMAGE_GRAYSCALE_FIXED_ROWS(__ni_image_grayscale_u8)
+__NI_IMAGE_GRAYSCALE_ROWS(__ni_image_grayscale_u8_f32, stbi_uc, float, roundf)
+__NI_IMAGE_GRAYSCALE_ROWS(__ni_image_grayscale_u16, uint16_t, double, round)
+__NI_IMAGE_GRAYSCALE_INTERLEAVED(__ni_image_grayscale_u16)
+__NI_IMAGE_GRAYSCALE_ROWS(__ni_image_grayscale_u16_f32, uint16_t, float, roundf)
+__NI_IMAGE_GRAYSCALE_INTERLEAVED(__ni_image_grayscale_u16_f32)
+__NI_IMAGE_GRAYSCALE_ROWS(__ni_image_grayscale_f32, float, float, )
+__NI_IMAGE_GRAYSCALE_INTERLEAVED(__ni_image_grayscale_f32)
+
+/**
+ * Note: this is intended only for internal usage
+ *
+ * Row kernel of the conversion: r, g and b point to the first R, G and B
+ * values of a row and out to the first pixel of the output row.
+ */
+typedef void (*__ni_image_grayscale_row_fn)(const void *r, const void *g, const void *b, void *out, int w);
+
+// clang-format off
+/**
+ * Note: this is intended only for internal usage
+ *
+ * Row kernels by pixel type and precision (u8, u8 in float, u16, u16 in
+ * float, f32), standard and layout (planes, RGB, RGBA). The bytes only
+ * have the plane kernels.
+ */
+#define __NI_IMAGE_GRAYSCALE_TABLE_PLANES(NAME) \
+	{ { NAME##_bt_601_c1, NULL, NULL }, \
+	  { NAME##_bt_709_c1, NULL, NULL }, \
+	  { NAME##_smpte_240m_c1, NULL, NULL } }
+#define __NI_IMAGE_GRAYSCALE_TABLE_ENTRY(NAME) \
+	{ { NAME##_bt_601_c1, NAME##_bt_601_c3, NAME##_bt_601_c4 }, \
+	  { NAME##_bt_709_c1, NAME##_bt_709_c3, NAME##_bt_709_c4 }, \
+	  { NAME##_smpte_240m_c1, NAME##_smpte_240m_c3, NAME##_smpte_240m_c4 } }
+static const __ni_image_grayscale_row_fn __ni_image_grayscale_rows[5][3][3] = {
+	__NI_IMAGE_GRAYSCALE_TABLE_PLANES(__ni_image_grayscale_u8),
+	__NI_IMAGE_GRAYSCALE_TABLE_PLANES(__ni_image_grayscale_u8_f32),
+	__NI_IMAGE_GRAYSCALE_TABLE_ENTRY(__ni_image_grayscale_u16),
+	__NI_IMAGE_GRAYSCALE_TABLE_ENTRY(__ni_image_grayscale_u16_f32),
+	__NI_IMAGE_GRAYSCALE_TABLE_ENTRY(__ni_image_grayscale_f32),
+};
+// clang-format on
+
 /**
  * Note: this function is intended only for internal usage
  *
- * Calculates the luma value for an RGB tuple according to ITU BT.601
+ * Chooses the row kernel of a conversion, so the pixel type, the precision
+ * and the standard are only looked at once per image.
  *
- * r -> red value (stbi_uc)
- * g -> green value (stbi_uc)
- * b -> blue value (stbi_uc)
+ * pixel_type -> type of the elements of the images
+ * precision -> precision of the luma calculation, NI_PIXEL_F32 is always
+ * converted in single precision
+ * type -> the standard
+ * step -> 1 if the R, G and B values are in separate planes, or the number
+ * of channels (3 or 4) if they are interleaved
  *
- * Returns the luma value for the rgb tuple
+ * Returns the kernel, or NULL if the standard is not valid
  */
-static inline stbi_uc
-__ni_image_grayscale_itu_bt_601(stbi_uc r, stbi_uc g, stbi_uc b)
+static __ni_image_grayscale_row_fn
+__ni_image_grayscale_row_select(NI_PIXEL_TYPE pixel_type, NI_PRECISION precision, NI_IMAGE_GRAYSCALE_STD type, int step)
 {
-	// LUMA = 0.299 R + 0.587 G + 0.114 B
-	double l =
-		(0.299 * ((double)r)) + (0.587 * ((double)g)) + (0.114 * ((double)b));
-	return (stbi_uc)round(l);
+	// ERROR: unknown standard
+	if(type < NI_ITU_BT_601 || type > NI_SMPTE_240M)
+		return NULL;
+
+	const int f32 = (precision == NI_PRECISION_FLOAT);
+	int variant;
+	switch(pixel_type) {
+	case(NI_PIXEL_U16):
+		variant = f32 ? 3 : 2;
+		break;
+	case(NI_PIXEL_F32):
+		variant = 4;
+		break;
+	default:
+		variant = f32 ? 1 : 0;
+		break;
+	}
+	return __ni_image_grayscale_rows[variant][type][(step == 1) ? 0 : step - 2];
 }
 
+/**
+ * Note: this is intended only for internal usage
+ *
+ * How the rows of an image are converted, worked out once per image by
+ * __ni_image_grayscale_pass_init.
+ *
+ * row -> kernel of the luma, the plane one for the bytes
+ * n_channels -> channels of the original image
+ * first, last -> channels of R and B (0 and 2, or 2 and 0 for BGR)
+ * composite -> 1 if the bytes are composited over background
+ * background -> background of the planes R, G and B in the order of the
+ * image, or the gray one in the first for 1 and 2 channels
+ */
+typedef struct __ni_image_grayscale_pass {
+	__ni_image_grayscale_row_fn row;
+	int n_channels;
+	int first, last;
+	int composite;
+	stbi_uc background[3];
+} __ni_image_grayscale_pass;
+
 /**
  * Note: this function is intended only for internal usage
  *
- * Calculates the luma value for an RGB tuple according to ITU BT.709
+ * Checks the options of a conversion and fills in its pass.
  *
- * r -> red value (stbi_uc)
- * g -> green value (stbi_uc)
- * b -> blue value (stbi_uc)
+ * pass -> the pass to fill in
+ * pixel_type -> type of the elements of the images
+ * precision -> precision of the luma calculation
+ * n_channels -> channels of the original image
+ * type -> the standard
+ * opts -> the options, NULL for the defaults
  *
- * Returns the luma value for the rgb tuple
+ * Returns pass, or NULL if the options are not valid
  */
-static inline stbi_uc
-__ni_image_grayscale_itu_bt_709(stbi_uc r, stbi_uc g, stbi_uc b)
+static __ni_image_grayscale_pass *
+__ni_image_grayscale_pass_init(__ni_image_grayscale_pass *pass, NI_PIXEL_TYPE pixel_type, NI_PRECISION precision, int n_channels, NI_IMAGE_GRAYSCALE_STD type, const ni_grayscale_options *opts)
 {
-	// LUMA = 0.2126 R + 0.7152 G + 0.0722 B
-	double l =
-		(0.2126 * ((double)r)) + (0.7152 * ((double)g)) + (0.0722 * ((double)b));
-	return (stbi_uc)round(l);
+	const ni_grayscale_options defaults = { NI_ORDER_RGB, 0, { 0, 0, 0 } };
+	if(opts == NULL)
+		opts = &defaults;
+	// ERROR: unsupported number of channels or channel order
+	if(n_channels < 1 || n_channels > 4 || (opts->order != NI_ORDER_RGB && opts->order != NI_ORDER_BGR))
+		return NULL;
+	// ERROR: only the bytes can be composited
+	if(opts->composite && pixel_type != NI_PIXEL_U8)
+		return NULL;
+
+	const int u8 = (pixel_type == NI_PIXEL_U8);
+	pass->row = __ni_image_grayscale_row_select(pixel_type, precision, type, (u8 || n_channels < 3) ? 1 : n_channels);
+	// ERROR: unknown standard
+	if(pass->row == NULL)
+		return NULL;
+
+	const int bgr = (opts->order == NI_ORDER_BGR);
+	pass->n_channels = n_channels;
+	pass->first = bgr ? 2 : 0;
+	pass->last = bgr ? 0 : 2;
+	// Without alpha the pixels are opaque, so there is nothing to composite
+	pass->composite = opts->composite && (n_channels == 2 || n_channels == 4);
+	for(int c = 0; c < 3; c++)
+		pass->background[c] = opts->background[bgr ? 2 - c : c];
+	// The gray images are composited over the gray of the background
+	if(pass->composite && n_channels == 2)
+		pass->row(&opts->background[0], &opts->background[1], &opts->background[2], &pass->background[0], 1);
+	return pass;
 }
 
+/**
+ * Number of pixels of a row of bytes that __ni_image_grayscale_u8_row
+ * splits into planes at a time, small enough for the planes to stay in L1.
+ */
+#define NI_GRAYSCALE_CHUNK 512
+
 /**
  * Note: this function is intended only for internal usage
  *
- * Calculates the luma value for an RGB tuple according to SMPTE 240M
+ * Converts a row of bytes in one pass, a chunk at a time: the chunk is
+ * split into planes, the colors are composited over the background and the
+ * luma is calculated on the planes, all of them vectorised.
+ *
+ * in -> w interleaved pixels
+ * out -> w bytes, may be in
+ * w -> number of pixels
+ * pass -> the conversion
+ */
+static void
+__ni_image_grayscale_u8_row(const stbi_uc *in, stbi_uc *out, int w, const __ni_image_grayscale_pass *pass)
+{
+	stbi_uc buffer[4][NI_GRAYSCALE_CHUNK];
+	stbi_uc *const planes[4] = { buffer[0], buffer[1], buffer[2], buffer[3] };
+	const int n_channels = pass->n_channels;
+	const int n_colors = (n_channels < 3) ? 1 : 3;
+	int len;
+	// The output of a chunk ends before the input of the next one starts,
+	// so the conversion works in place
+	for(int x = 0; x < w; x += NI_GRAYSCALE_CHUNK) {
+		len = (w - x < NI_GRAYSCALE_CHUNK) ? w - x : NI_GRAYSCALE_CHUNK;
+		if(n_channels == 1) {
+			memmove(out + x, in + x, len);
+			continue;
+		}
+		ni_simd_deinterleave_u8(in + n_channels * (ptrdiff_t)x, planes, len, n_channels);
+		if(pass->composite)
+			for(int c = 0; c < n_colors; c++)
+				ni_simd_blend_u8(planes[c], planes[n_channels - 1], pass->background[c], planes[c], len);
+		if(n_colors == 1) {
+			memcpy(out + x, planes[0], len);
+			continue;
+		}
+		pass->row(planes[pass->first], planes[1], planes[pass->last], out + x, len);
+	}
+}
+
+/**
+ * Note: this function is intended only for internal usage
  *
- * r -> red value (stbi_uc)
- * g -> green value (stbi_uc)
- * b -> blue value (stbi_uc)
+ * Copies the gray channel of a row of 1 or 2 channels that is not made of
+ * bytes.
  *
- * Returns the luma value for the rgb tuple
+ * in -> w interleaved pixels
+ * out -> w values, may be in
+ * w -> number of pixels
+ * n_channels -> channels of the original image
+ * pixel_type -> NI_PIXEL_U16 or NI_PIXEL_F32
  */
-static inline stbi_uc
-__ni_image_grayscale_smpte_240m(stbi_uc r, stbi_uc g, stbi_uc b)
+static void
+__ni_image_grayscale_copy_row(const void *in, void *out, int w, int n_channels, NI_PIXEL_TYPE pixel_type)
 {
-	// LUMA = 0.212 R + 0.701 G + 0.087 B
-	double l =
-		(0.212 * ((double)r)) + (0.701 * ((double)g)) + (0.087 * ((double)b));
-	return (stbi_uc)round(l);
+	if(n_channels == 1) {
+		memmove(out, in, w * ni_pixel_type_size(pixel_type));
+		return;
+	}
+	if(pixel_type == NI_PIXEL_U16) {
+		const uint16_t *src = in;
+		uint16_t *dst = out;
+		for(int __x = 0; __x < w; __x++)
+			dst[__x] = src[__x * n_channels];
+	} else {
+		const float *src = in;
+		float *dst = out;
+		for(int __x = 0; __x < w; __x++)
+			dst[__x] = src[__x * n_channels];
+	}
 }
 
-static inline double
-gray_normalize(stbi_uc val)
+/**
+ * Converts the rows of an image to grayscale, that
+ * ni_image_grayscale_convert_into and ni_image_grayscale_convert_view_opts
+ * share. Only intended for internal usage.
+ *
+ * src -> the original image (1 to 4 channels)
+ * dst -> output image of the same size and pixel type (1 channel)
+ * precision -> precision of the luma calculation
+ * opts -> the options, NULL for the defaults
+ *
+ * Returns dst or NULL if the standard or the options are not valid
+ */
+static ni_image *
+__ni_image_grayscale_convert_apply(const ni_image *src, ni_image *dst, NI_IMAGE_GRAYSCALE_STD type, NI_PRECISION precision, const ni_grayscale_options *opts)
 {
-	return ((double)val) / ((double)UCHAR_MAX);
+	__ni_image_grayscale_pass pass;
+	// ERROR: unknown standard or options
+	if(__ni_image_grayscale_pass_init(&pass, src->type, precision, src->n_channels, type, opts) == NULL)
+		return NULL;
+
+	const size_t elem_size = ni_pixel_type_size(src->type);
+	const unsigned char *in;
+	for(int __y = 0; __y < src->h; __y++) {
+		in = ni_image_row(src, __y);
+		if(src->type == NI_PIXEL_U8)
+			__ni_image_grayscale_u8_row(in, ni_image_row(dst, __y), src->w, &pass);
+		else if(src->n_channels < 3)
+			__ni_image_grayscale_copy_row(in, ni_image_row(dst, __y), src->w, src->n_channels, src->type);
+		else
+			pass.row(in + pass.first * elem_size, in + elem_size, in + pass.last * elem_size, ni_image_row(dst, __y), src->w);
+	}
+	return dst;
 }
 
-static inline stbi_uc
-gray_unnormalize(double val)
+stbi_uc *
+ni_image_grayscale_convert_into(const stbi_uc *img_data, int w, int h, int n_channels, NI_IMAGE_GRAYSCALE_STD type, stbi_uc *out)
 {
-	return (stbi_uc)round(val * UCHAR_MAX);
+	// ERROR: no output
+	if(out == NULL)
+		return NULL;
+
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(out, w, h, 1, NI_PIXEL_U8);
+	if(__ni_image_grayscale_convert_apply(&src, &dst, type, NI_DEFAULT_PRECISION, NULL) == NULL)
+		return NULL;
+	return out;
 }
 
 stbi_uc *
-ni_image_grayscale_convert(const stbi_uc *img_data, int w, int h, int n_channels, NI_IMAGE_GRAYSCALE_STD type)
+ni_image_grayscale_convert_ctx(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, NI_IMAGE_GRAYSCALE_STD type, stbi_uc *out)
 {
-	assert(n_channels == 3);
-	stbi_uc *ret_img =
-		ni_image_create(w, h, 1); // This image is grayscale -> 1 channel
+	return ni_image_grayscale_convert_opts(ctx, img_data, w, h, n_channels, type, NULL, out);
+}
 
-	int idx, n_idx;
-	stbi_uc r, g, b, l;
+stbi_uc *
+ni_image_grayscale_convert_opts(ni_context *ctx, const stbi_uc *img_data, int w, int h, int n_channels, NI_IMAGE_GRAYSCALE_STD type, const ni_grayscale_options *opts, stbi_uc *out)
+{
+	stbi_uc *img = (out == NULL) ? ni_image_create(w, h, 1) : out;
+	// ERROR: out of memory
+	if(img == NULL)
+		return NULL;
 
-	BEGIN_FOREACH_PIXEL(w, h)
-	idx = PX_IDX(__x, __y, w, n_channels);
-	r = img_data[idx];
-	g = img_data[idx + 1];
-	b = img_data[idx + 2];
-	switch(type) {
-	case(NI_ITU_BT_601):
-		l = __ni_image_grayscale_itu_bt_601(r, g, b);
-		break;
-	case(NI_ITU_BT_709):
-		l = __ni_image_grayscale_itu_bt_709(r, g, b);
-		break;
-	case(NI_SMPTE_240M):
-		l = __ni_image_grayscale_smpte_240m(r, g, b);
-		break;
-	default:
-		l = 0; // Should never reach this default
-		break;
+	const ni_image src = ni_image_wrap((stbi_uc *)img_data, w, h, n_channels, NI_PIXEL_U8);
+	ni_image dst = ni_image_wrap(img, w, h, 1, NI_PIXEL_U8);
+	if(__ni_image_grayscale_convert_apply(&src, &dst, type, ni_context_precision(ctx), opts) == NULL) {
+		if(out == NULL)
+			ni_free(img);
+		return NULL;
 	}
-	n_idx = PX_IDX(__x, __y, w, 1);
-	ret_img[n_idx] = l;
-	END_FOREACH_PIXEL
+	return img;
+}
 
-	return ret_img;
+ni_image *
+ni_image_grayscale_convert_view(ni_context *ctx, const ni_image *src, ni_image *dst, NI_IMAGE_GRAYSCALE_STD type)
+{
+	return ni_image_grayscale_convert_view_opts(ctx, src, dst, type, NULL);
+}
+
+ni_image *
+ni_image_grayscale_convert_view_opts(ni_context *ctx, const ni_image *src, ni_image *dst, NI_IMAGE_GRAYSCALE_STD type, const ni_grayscale_options *opts)
+{
+	// ERROR: the images do not match
+	if(!__ni_image_views_same(src, dst, 1))
+		return NULL;
+
+	return __ni_image_grayscale_convert_apply(src, dst, type, ni_context_precision(ctx), opts);
+}
+
+ni_image *
+ni_image_grayscale_convert_planes(ni_context *ctx, const ni_planes *src, ni_image *dst, NI_IMAGE_GRAYSCALE_STD type)
+{
+	// ERROR: the images do not match
+	if(src->n_planes != 3 || dst->n_channels != 1)
+		return NULL;
+	for(int c = 0; c < 3; c++)
+		if(!__ni_image_views_same(&src->plane[c], dst, 1))
+			return NULL;
+
+	const __ni_image_grayscale_row_fn row = __ni_image_grayscale_row_select(dst->type, ni_context_precision(ctx), type, 1);
+	// ERROR: unknown standard
+	if(row == NULL)
+		return NULL;
+
+	for(int __y = 0; __y < dst->h; __y++)
+		row(ni_image_row(&src->plane[0], __y), ni_image_row(&src->plane[1], __y), ni_image_row(&src->plane[2], __y), ni_image_row(dst, __y), dst->w);
+	return dst;
 }
 
 double *
 ni_grayscale_fp_convert(const stbi_uc *img_data, int w, int h)
 {
 	double *data = ni_data_create(w, h, 1);
+	// ERROR: out of memory
+	if(data == NULL)
+		return NULL;
 
-	int idx;
+	ptrdiff_t idx;
 	stbi_uc value;
 	double new_value;
 	BEGIN_FOREACH_PIXEL(w, h)
@@ -217,8 +725,11 @@ stbi_uc *
 ni_fp_grayscale_convert(const double *img_data, int w, int h)
 {
 	stbi_uc *img = ni_image_create(w, h, 1);
+	// ERROR: out of memory
+	if(img == NULL)
+		return NULL;
 
-	int idx;
+	ptrdiff_t idx;
 	double value;
 	stbi_uc new_value;
 	BEGIN_FOREACH_PIXEL(w, h)
@@ -0,0 +1,277 @@
+#ifndef NI_INCLUDE_KERNEL_CACHE
+#define NI_INCLUDE_KERNEL_CACHE
+
+#ifndef NI_INCLUDE_IMAGE_UTILS
+#define NI_IMAGE_UTILS_IMPLEMENTATION
+#include "ni_image_utils.h"
+#endif
+
+#ifndef NI_INCLUDE_THREADPOOL
+#define NI_THREADPOOL_IMPLEMENTATION
+#include "ni_image_threadpool.h"
+#endif
+
+// = DECLARATION =
+
+/**
+ * Types of kernels kept in the cache. Together with the size and the
+ * parameter they identify a kernel.
+ */
+typedef enum __NI_IMAGE_KERNEL_TYPE {
+	NI_KERNEL_GAUSSIAN, // 1-dimensional Gaussian, double[kernel_size]
+	NI_KERNEL_GAUSSIAN_FIXED, // 1-dimensional Gaussian, int16_t[kernel_size]
+} NI_IMAGE_KERNEL_TYPE;
+
+/**
+ * Default number of kernels kept by a cache.
+ */
+#define NI_KERNEL_CACHE_DEFAULT_CAPACITY 32
+
+/**
+ * Function that creates a kernel when it is not in the cache.
+ *
+ * int kernel_size -> size of the kernel
+ * double param -> parameter of the kernel (e.g. sigma)
+ *
+ * returns the kernel allocated with ni_alloc, or NULL on error
+ */
+typedef void *(*ni_kernel_create_fn)(int kernel_size, double param);
+
+/**
+ * Thread-safe cache of kernels with a bounded size. When it is full, the
+ * least recently used kernel that is not in use is evicted.
+ */
+typedef struct ni_kernel_cache ni_kernel_cache;
+
+/**
+ * Creates a new kernel cache, that needs to be destroyed with
+ * ni_kernel_cache_destroy.
+ *
+ * int capacity -> maximum number of kernels kept (> 0)
+ *
+ * returns a pointer to the new cache or NULL on error.
+ */
+ni_kernel_cache *ni_kernel_cache_create(int capacity);
+
+/**
+ * Frees the cache and all of its kernels. None of them can be in use.
+ *
+ * ni_kernel_cache *cache -> the cache to destroy
+ */
+void ni_kernel_cache_destroy(ni_kernel_cache *cache);
+
+/**
+ * Returns the cache shared by all the niimg operations. It is created the
+ * first time it is needed with NI_KERNEL_CACHE_DEFAULT_CAPACITY entries.
+ *
+ * returns a pointer to the default cache (may be NULL if it could not be created)
+ */
+ni_kernel_cache *ni_kernel_cache_default(void);
+
+/**
+ * Gets a kernel from the cache, creating it if it is not there yet. The
+ * kernel must be handed back with ni_kernel_cache_release once it is not
+ * needed anymore, and it must not be modified.
+ *
+ * ni_kernel_cache *cache -> the cache to use. If NULL, the kernel is just
+ * created (and freed on release).
+ * NI_IMAGE_KERNEL_TYPE type -> type of the kernel
+ * int kernel_size -> size of the kernel
+ * double param -> parameter of the kernel (e.g. sigma)
+ * ni_kernel_create_fn create -> function that creates the kernel
+ *
+ * returns the kernel or NULL on error.
+ */
+const void *ni_kernel_cache_acquire(ni_kernel_cache *cache, NI_IMAGE_KERNEL_TYPE type, int kernel_size, double param, ni_kernel_create_fn create);
+
+/**
+ * Hands back a kernel obtained with ni_kernel_cache_acquire.
+ *
+ * ni_kernel_cache *cache -> the cache it was acquired from
+ * const void *kernel -> the kernel
+ */
+void ni_kernel_cache_release(ni_kernel_cache *cache, const void *kernel);
+
+// = IMPLEMENTATION =
+#ifdef NI_KERNEL_CACHE_IMPLEMENTATION
+
+/**
+ * Entry of the cache. Only intended for internal usage.
+ */
+typedef struct __ni_kernel_cache_entry {
+	NI_IMAGE_KERNEL_TYPE type;
+	int kernel_size;
+	double param;
+	void *kernel; // NULL if the entry is free
+	int refs;
+	unsigned long last_used;
+} __ni_kernel_cache_entry;
+
+struct ni_kernel_cache {
+	__ni_kernel_cache_entry *entries;
+	int capacity;
+	unsigned long clock;
+#ifdef NI_THREADS
+	pthread_mutex_t lock;
+#endif
+};
+
+static inline void
+__ni_kernel_cache_lock(ni_kernel_cache *cache)
+{
+#ifdef NI_THREADS
+	pthread_mutex_lock(&cache->lock);
+#else
+	(void)cache;
+#endif
+}
+
+static inline void
+__ni_kernel_cache_unlock(ni_kernel_cache *cache)
+{
+#ifdef NI_THREADS
+	pthread_mutex_unlock(&cache->lock);
+#else
+	(void)cache;
+#endif
+}
+
+ni_kernel_cache *
+ni_kernel_cache_create(int capacity)
+{
+	if(capacity <= 0)
+		return NULL;
+
+	ni_kernel_cache *cache = ni_alloc(sizeof(ni_kernel_cache));
+	if(cache == NULL)
+		return NULL;
+	cache->entries = ni_alloc(sizeof(__ni_kernel_cache_entry) * capacity);
+	if(cache->entries == NULL) {
+		ni_free(cache);
+		return NULL;
+	}
+	memset(cache->entries, 0, sizeof(__ni_kernel_cache_entry) * capacity);
+	cache->capacity = capacity;
+	cache->clock = 0;
+#ifdef NI_THREADS
+	pthread_mutex_init(&cache->lock, NULL);
+#endif
+	return cache;
+}
+
+void
+ni_kernel_cache_destroy(ni_kernel_cache *cache)
+{
+	if(cache == NULL)
+		return;
+
+	for(int i = 0; i < cache->capacity; i++)
+		ni_free(cache->entries[i].kernel);
+#ifdef NI_THREADS
+	pthread_mutex_destroy(&cache->lock);
+#endif
+	ni_free(cache->entries);
+	ni_free(cache);
+}
+
+#ifdef NI_THREADS
+
+static ni_kernel_cache *__ni_kernel_cache_default_cache = NULL;
+static pthread_once_t __ni_kernel_cache_default_once = PTHREAD_ONCE_INIT;
+
+static void
+__ni_kernel_cache_default_init(void)
+{
+	__ni_kernel_cache_default_cache = ni_kernel_cache_create(NI_KERNEL_CACHE_DEFAULT_CAPACITY);
+}
+
+ni_kernel_cache *
+ni_kernel_cache_default(void)
+{
+	pthread_once(&__ni_kernel_cache_default_once, __ni_kernel_cache_default_init);
+	return __ni_kernel_cache_default_cache;
+}
+
+#else // NI_THREADS
+
+ni_kernel_cache *
+ni_kernel_cache_default(void)
+{
+	static ni_kernel_cache *cache = NULL;
+	if(cache == NULL)
+		cache = ni_kernel_cache_create(NI_KERNEL_CACHE_DEFAULT_CAPACITY);
+	return cache;
+}
+
+#endif // NI_THREADS
+
+const void *
+ni_kernel_cache_acquire(ni_kernel_cache *cache, NI_IMAGE_KERNEL_TYPE type, int kernel_size, double param, ni_kernel_create_fn create)
+{
+	if(cache == NULL)
+		return create(kernel_size, param);
+
+	__ni_kernel_cache_entry *entry;
+	__ni_kernel_cache_entry *victim = NULL;
+	void *kernel;
+
+	__ni_kernel_cache_lock(cache);
+	cache->clock++;
+	for(int i = 0; i < cache->capacity; i++) {
+		entry = &cache->entries[i];
+		if(entry->kernel != NULL && entry->type == type && entry->kernel_size == kernel_size && entry->param == param) {
+			entry->refs++;
+			entry->last_used = cache->clock;
+			__ni_kernel_cache_unlock(cache);
+			return entry->kernel;
+		}
+		// Free entries go first, then the least recently used one
+		if(entry->refs == 0 && (victim == NULL || (victim->kernel != NULL && (entry->kernel == NULL || entry->last_used < victim->last_used))))
+			victim = entry;
+	}
+
+	// Kernels are cheap to create, so doing it with the lock held keeps two
+	// threads from creating the same one
+	kernel = create(kernel_size, param);
+	if(kernel == NULL || victim == NULL) {
+		// Every entry is in use: the kernel is not cached and the release
+		// frees it
+		__ni_kernel_cache_unlock(cache);
+		return kernel;
+	}
+	ni_free(victim->kernel);
+	victim->type = type;
+	victim->kernel_size = kernel_size;
+	victim->param = param;
+	victim->kernel = kernel;
+	victim->refs = 1;
+	victim->last_used = cache->clock;
+	__ni_kernel_cache_unlock(cache);
+	return kernel;
+}
+
+void
+ni_kernel_cache_release(ni_kernel_cache *cache, const void *kernel)
+{
+	if(kernel == NULL)
+		return;
+	if(cache == NULL) {
+		ni_free((void *)kernel);
+		return;
+	}
+
+	__ni_kernel_cache_lock(cache);
+	for(int i = 0; i < cache->capacity; i++) {
+		if(cache->entries[i].kernel == kernel) {
+			cache->entries[i].refs--;
+			__ni_kernel_cache_unlock(cache);
+			return;
+		}
+	}
+	__ni_kernel_cache_unlock(cache);
+	ni_free((void *)kernel);
+}
+
+#endif // NI_KERNEL_CACHE_IMPLEMENTATION
+
+#endif // NI_INCLUDE_KERNEL_CACHE
@@ -0,0 +1,198 @@
+#ifndef NI_INCLUDE_PLANAR
+#define NI_INCLUDE_PLANAR
+
+#ifndef NI_INCLUDE_IMAGE_UTILS
+#define NI_IMAGE_UTILS_IMPLEMENTATION
+#include "ni_image_utils.h"
+#endif
+
+#ifndef NI_INCLUDE_SIMD
+#define NI_SIMD_IMPLEMENTATION
+#include "ni_image_simd.h"
+#endif
+
+// = DECLARATION =
+
+/**
+ * Maximum number of planes of a planar image.
+ */
+#define NI_PLANES_MAX 4
+
+/**
+ * An image stored as one plane per channel (RRRR... GGGG... BBBB...)
+ * instead of interleaved (RGBRGB...). Every plane is a 1 channel ni_image,
+ * so the operations that take image descriptors (the _view functions) work
+ * on a plane as on any other image, reading contiguous rows with no
+ * channel step. The _planes functions run an operation on all the planes,
+ * so an image can be split once, go through a chain of operations and be
+ * merged back at the end.
+ */
+typedef struct ni_planes {
+	ni_image plane[NI_PLANES_MAX];
+	int n_planes;
+} ni_planes;
+
+/**
+ * Allocates a new planar image, that needs to be released with
+ * ni_planes_release. Every plane is a separate packed image.
+ *
+ * int w -> image width
+ * int h -> image height
+ * int n_planes -> number of planes (channels), between 1 and NI_PLANES_MAX
+ * NI_PIXEL_TYPE type -> type of the elements
+ *
+ * returns the planar image, with n_planes set to 0 on error
+ */
+ni_planes ni_planes_alloc(int w, int h, int n_planes, NI_PIXEL_TYPE type);
+
+/**
+ * Frees the planes of a planar image that own their data, and clears it.
+ *
+ * ni_planes *planes -> the planar image
+ */
+void ni_planes_release(ni_planes *planes);
+
+/**
+ * Creates a view of a rectangle of every plane of a planar image (see
+ * ni_image_view).
+ *
+ * const ni_planes *planes -> the planar image
+ * int x -> left column of the rectangle
+ * int y -> top row of the rectangle
+ * int w -> width of the rectangle
+ * int h -> height of the rectangle
+ *
+ * returns the view, with n_planes set to 0 on error
+ */
+ni_planes ni_planes_view(const ni_planes *planes, int x, int y, int w, int h);
+
+/**
+ * Splits an interleaved image into its planes.
+ *
+ * const ni_image *src -> interleaved image, NI_PIXEL_U8
+ * ni_planes *dst -> planar image of the same size, one plane per channel
+ *
+ * returns dst or NULL on error.
+ *
+ * Error conditions:
+ *  -> the images are not NI_PIXEL_U8, or their sizes or number of channels
+ *  do not match
+ */
+ni_planes *ni_planes_split(const ni_image *src, ni_planes *dst);
+
+/**
+ * Merges the planes of a planar image into an interleaved image.
+ *
+ * const ni_planes *src -> planar image, NI_PIXEL_U8
+ * ni_image *dst -> interleaved image of the same size, one channel per plane
+ *
+ * returns dst or NULL on error.
+ *
+ * Error conditions:
+ *  -> the images are not NI_PIXEL_U8, or their sizes or number of channels
+ *  do not match
+ */
+ni_image *ni_planes_merge(const ni_planes *src, ni_image *dst);
+
+// = IMPLEMENTATION =
+#ifdef NI_PLANAR_IMPLEMENTATION
+
+ni_planes
+ni_planes_alloc(int w, int h, int n_planes, NI_PIXEL_TYPE type)
+{
+	ni_planes planes = { 0 };
+	// ERROR: too many planes
+	if(n_planes <= 0 || n_planes > NI_PLANES_MAX)
+		return planes;
+
+	for(int c = 0; c < n_planes; c++) {
+		planes.plane[c] = ni_image_alloc(w, h, 1, type);
+		planes.n_planes = c + 1;
+		// ERROR: out of memory
+		if(planes.plane[c].data == NULL) {
+			ni_planes_release(&planes);
+			return planes;
+		}
+	}
+	return planes;
+}
+
+void
+ni_planes_release(ni_planes *planes)
+{
+	for(int c = 0; c < planes->n_planes; c++)
+		ni_image_release(&planes->plane[c]);
+	planes->n_planes = 0;
+}
+
+ni_planes
+ni_planes_view(const ni_planes *planes, int x, int y, int w, int h)
+{
+	ni_planes view = { 0 };
+	for(int c = 0; c < planes->n_planes; c++) {
+		view.plane[c] = ni_image_view(&planes->plane[c], x, y, w, h);
+		// ERROR: the rectangle is not inside of the image
+		if(view.plane[c].data == NULL) {
+			view.n_planes = 0;
+			return view;
+		}
+	}
+	view.n_planes = planes->n_planes;
+	return view;
+}
+
+/**
+ * Checks that an interleaved image and a planar one are 8 bits, have the
+ * same size and one plane per channel. Only intended for internal usage.
+ *
+ * const ni_image *img -> the interleaved image
+ * const ni_planes *planes -> the planar image
+ *
+ * returns 1 if they match, 0 otherwise
+ */
+static inline int
+__ni_planes_match(const ni_image *img, const ni_planes *planes)
+{
+	if(img->data == NULL || img->type != NI_PIXEL_U8 || img->n_channels != planes->n_planes)
+		return 0;
+	for(int c = 0; c < planes->n_planes; c++)
+		if(!__ni_image_views_match(img, &planes->plane[c], 1))
+			return 0;
+	return 1;
+}
+
+ni_planes *
+ni_planes_split(const ni_image *src, ni_planes *dst)
+{
+	// ERROR: the images do not match
+	if(!__ni_planes_match(src, dst))
+		return NULL;
+
+	stbi_uc *rows[NI_PLANES_MAX];
+	for(int y = 0; y < src->h; y++) {
+		for(int c = 0; c < dst->n_planes; c++)
+			rows[c] = ni_image_row(&dst->plane[c], y);
+		ni_simd_deinterleave_u8(ni_image_row(src, y), rows, src->w, src->n_channels);
+	}
+	return dst;
+}
+
+ni_image *
+ni_planes_merge(const ni_planes *src, ni_image *dst)
+{
+	// ERROR: the images do not match
+	if(!__ni_planes_match(dst, src))
+		return NULL;
+
+	const stbi_uc *rows[NI_PLANES_MAX];
+	for(int y = 0; y < dst->h; y++) {
+		for(int c = 0; c < src->n_planes; c++)
+			rows[c] = ni_image_row(&src->plane[c], y);
+		ni_simd_interleave_u8(rows, ni_image_row(dst, y), dst->w, dst->n_channels);
+	}
+	return dst;
+}
+
+#endif // NI_PLANAR_IMPLEMENTATION
+
+#endif // NI_INCLUDE_PLANAR
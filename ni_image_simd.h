@@ -0,0 +1,1635 @@
+#ifndef NI_INCLUDE_SIMD
+#define NI_INCLUDE_SIMD
+
+#include "math.h"
+
+#ifndef NI_INCLUDE_IMAGE_UTILS
+#define NI_IMAGE_UTILS_IMPLEMENTATION
+#include "ni_image_utils.h"
+#endif
+
+#ifndef NI_INCLUDE_THREADPOOL
+#define NI_THREADPOOL_IMPLEMENTATION
+#include "ni_image_threadpool.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The vectorised kernels are only built with GCC or Clang on x86, and can be
+ * disabled completely by defining NI_NO_SIMD. The instruction set is chosen
+ * at runtime, so the same binary works on any x86 CPU.
+ */
+#if !defined(NI_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define NI_SIMD_X86
+#endif
+
+/**
+ * AVX-512F implies FMA, and GCC fuses separate multiplies and adds into it by
+ * default, which rounds differently from the lower levels. The AVX-512
+ * kernels are built without contraction so every level gives the same
+ * results.
+ */
+#if defined(NI_SIMD_X86) && !defined(__clang__)
+#define NI_SIMD_TARGET_AVX512 __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#else
+#define NI_SIMD_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+// = DECLARATION =
+
+/**
+ * Instruction sets that can be used by the vectorised kernels. The order
+ * matters, every level includes the previous ones.
+ */
+typedef enum __NI_IMAGE_SIMD_LEVEL {
+	NI_SIMD_NONE, // Plain C
+	NI_SIMD_SSE2, // 2 doubles per instruction
+	NI_SIMD_AVX2, // 4 doubles per instruction
+	NI_SIMD_AVX512, // 8 doubles per instruction
+} NI_IMAGE_SIMD_LEVEL;
+
+/**
+ * Returns the instruction set the vectorised kernels are using. The first
+ * call detects the best one supported by the CPU, only once even if several
+ * threads make it at the same time.
+ *
+ * returns the active NI_IMAGE_SIMD_LEVEL
+ */
+NI_IMAGE_SIMD_LEVEL ni_simd_level(void);
+
+/**
+ * Limits the instruction set the vectorised kernels can use, usually for
+ * testing or benchmarking purposes. Levels that the CPU does not support are
+ * lowered to the best supported one.
+ *
+ * NI_IMAGE_SIMD_LEVEL level -> the highest level to use
+ *
+ * note: all the levels produce bit-identical results. It must not be called
+ * while a niimg operation is running.
+ */
+void ni_simd_set_level(NI_IMAGE_SIMD_LEVEL level);
+
+/**
+ * Normalizes an array of bytes from the range [0, 255] into the range
+ * [0, 1], the same way ni_stbi_uc_normalize does.
+ *
+ * const stbi_uc *src -> values to be normalized
+ * double *dst -> normalized values
+ * size_t len -> number of values
+ */
+void ni_simd_u8_to_data(const stbi_uc *src, double *dst, size_t len);
+
+/**
+ * Clamps an array of doubles to [0, 1] and converts them to the range
+ * [0, 255], the same way ni_stbi_uc_unnormalize(ni_image_data_clamp(v)) does.
+ *
+ * const double *src -> values to be un-normalized
+ * stbi_uc *dst -> un-normalized values
+ * size_t len -> number of values
+ */
+void ni_simd_data_to_u8(const double *src, stbi_uc *dst, size_t len);
+
+/**
+ * Convolves an array with a 1-dimensional kernel whose taps are step
+ * elements apart:
+ *
+ *   dst[i] = sum(kernel[j] * src[i + j * step]) for j in [0, taps)
+ *
+ * With step = n_channels this is the horizontal pass over an interleaved
+ * row, and with step = w * n_channels it is the vertical pass over whole
+ * rows. The terms are always added in the order of j.
+ *
+ * const double *src -> source array, src[i + (taps - 1) * step] must be valid
+ * double *dst -> destination array, must not overlap src
+ * size_t len -> number of values to calculate
+ * ptrdiff_t step -> distance between two consecutive taps
+ * const double *kernel -> 1-dimensional kernel
+ * int taps -> number of elements of the kernel
+ */
+void ni_simd_convolve(const double *src, double *dst, size_t len, ptrdiff_t step, const double *kernel, int taps);
+
+/**
+ * Same as ni_simd_convolve, but every tap has its own offset, which allows
+ * 2-dimensional kernels and skipping the taps that are zero:
+ *
+ *   dst[i] = sum(kernel[j] * src[i + offsets[j]]) for j in [0, taps)
+ *
+ * const double *src -> source array, src[i + offsets[j]] must be valid
+ * double *dst -> destination array, must not overlap src
+ * size_t len -> number of values to calculate
+ * const ptrdiff_t *offsets -> offset of every tap
+ * const double *kernel -> weight of every tap
+ * int taps -> number of taps
+ */
+void ni_simd_convolve_offsets(const double *src, double *dst, size_t len, const ptrdiff_t *offsets, const double *kernel, int taps);
+
+/**
+ * Fixed point version of ni_simd_convolve. The products are accumulated in
+ * 32-bit integers and the result is rounded and shifted right:
+ *
+ *   dst[i] = (sum(kernel[j] * src[i + j * step]) + (1 << (shift - 1))) >> shift
+ *
+ * The source and the kernel must be positive and small enough for the sum to
+ * fit in an int32_t, and the result must fit in an int16_t.
+ *
+ * const int16_t *src -> source array, src[i + (taps - 1) * step] must be valid
+ * int16_t *dst -> destination array, must not overlap src
+ * size_t len -> number of values to calculate
+ * ptrdiff_t step -> distance between two consecutive taps
+ * const int16_t *kernel -> 1-dimensional fixed point kernel
+ * int taps -> number of elements of the kernel
+ * int shift -> number of fractional bits removed from the sum (> 0)
+ */
+void ni_simd_convolve_i16(const int16_t *src, int16_t *dst, size_t len, ptrdiff_t step, const int16_t *kernel, int taps, int shift);
+
+/**
+ * Same as ni_simd_convolve_i16 but the result is saturated to [0, 255] and
+ * written as bytes.
+ */
+void ni_simd_convolve_i16_u8(const int16_t *src, stbi_uc *dst, size_t len, ptrdiff_t step, const int16_t *kernel, int taps, int shift);
+
+/**
+ * Single precision versions of ni_simd_u8_to_data, ni_simd_data_to_u8 and
+ * ni_simd_convolve, for the NI_PRECISION_FLOAT paths. They handle twice as
+ * many values per instruction. The rounding to bytes is the same as in the
+ * double versions, but it is applied to v * 255 computed in single
+ * precision.
+ */
+void ni_simd_u8_to_f32(const stbi_uc *src, float *dst, size_t len);
+void ni_simd_f32_to_u8(const float *src, stbi_uc *dst, size_t len);
+void ni_simd_convolve_f32(const float *src, float *dst, size_t len, ptrdiff_t step, const float *kernel, int taps);
+
+/**
+ * Splits interleaved pixels into one array per channel:
+ *
+ *   planes[c][i] = src[i * n_channels + c]
+ *
+ * const stbi_uc *src -> len * n_channels interleaved bytes
+ * stbi_uc *const *planes -> n_channels arrays of len bytes
+ * size_t len -> number of pixels
+ * int n_channels -> number of channels, the vectorised versions handle 2 to 4
+ */
+void ni_simd_deinterleave_u8(const stbi_uc *src, stbi_uc *const *planes, size_t len, int n_channels);
+
+/**
+ * Inverse of ni_simd_deinterleave_u8:
+ *
+ *   dst[i * n_channels + c] = planes[c][i]
+ *
+ * const stbi_uc *const *planes -> n_channels arrays of len bytes
+ * stbi_uc *dst -> len * n_channels interleaved bytes
+ * size_t len -> number of pixels
+ * int n_channels -> number of channels, the vectorised versions handle 2 to 4
+ */
+void ni_simd_interleave_u8(const stbi_uc *const *planes, stbi_uc *dst, size_t len, int n_channels);
+
+/**
+ * Weights of a luma calculation in fixed point. The weights are exactly
+ * c[0] / div, c[1] / div and c[2] / div, and k holds them as the doubles
+ * of the reference formula (e.g. 299 / 1000 and 0.299).
+ *
+ * c -> integer weights of R, G and B
+ * div -> common denominator, even and at most 10000
+ * k -> the weights as doubles
+ */
+typedef struct ni_simd_luma_weights {
+	int16_t c[3];
+	int16_t div;
+	double k[3];
+} ni_simd_luma_weights;
+
+/**
+ * Calculates the luma of planar RGB bytes, bit-exact with the double
+ * formula
+ *
+ *   out[i] = round(k[0] * r[i] + k[1] * g[i] + k[2] * b[i])
+ *
+ * The weighted sum is exact in integers, so it is rounded with one division
+ * by div. Only the exact ties (a fractional part of 0.5) go through the
+ * double formula, whose rounding errors send them either way.
+ *
+ * const stbi_uc *r, *g, *b -> arrays of len bytes
+ * stbi_uc *out -> len bytes, may be one of the inputs
+ * size_t len -> number of pixels
+ * const ni_simd_luma_weights *wt -> the weights
+ */
+void ni_simd_luma_u8(const stbi_uc *r, const stbi_uc *g, const stbi_uc *b, stbi_uc *out, size_t len, const ni_simd_luma_weights *wt);
+
+/**
+ * Composites bytes over a background value with their alpha, rounded to
+ * the nearest integer:
+ *
+ *   dst[i] = round((src[i] * alpha[i] + bg * (255 - alpha[i])) / 255)
+ *
+ * The sum fits in 16 bits, so the division by 255 is done with two shifts
+ * and gives the same bytes as the formula.
+ *
+ * const stbi_uc *src -> len bytes
+ * const stbi_uc *alpha -> len alpha values, 255 is opaque
+ * stbi_uc bg -> the background value
+ * stbi_uc *dst -> len bytes, may be src or alpha
+ * size_t len -> number of values
+ */
+void ni_simd_blend_u8(const stbi_uc *src, const stbi_uc *alpha, stbi_uc bg, stbi_uc *dst, size_t len);
+
+/**
+ * Compares bytes with a row of thresholds that repeats every period bytes,
+ * giving white where the byte reaches the threshold and black elsewhere:
+ *
+ *   dst[i] = (src[i] >= thresholds[i % period]) ? 255 : 0
+ *
+ * The comparison is a mask, so there are no branches. A period that is a
+ * multiple of 32 keeps every block of the row in the vector loop.
+ *
+ * const stbi_uc *src -> len bytes
+ * const stbi_uc *thresholds -> period thresholds
+ * size_t period -> number of thresholds, at least 1
+ * stbi_uc *dst -> len bytes, may be src
+ * size_t len -> number of values
+ */
+void ni_simd_threshold_u8(const stbi_uc *src, const stbi_uc *thresholds, size_t period, stbi_uc *dst, size_t len);
+
+// = IMPLEMENTATION =
+#ifdef NI_SIMD_IMPLEMENTATION
+
+#ifdef NI_SIMD_X86
+#include <immintrin.h>
+#endif
+
+static NI_IMAGE_SIMD_LEVEL __ni_simd_active = NI_SIMD_NONE;
+#ifdef NI_THREADS
+static pthread_once_t __ni_simd_once = PTHREAD_ONCE_INIT;
+#else
+static int __ni_simd_detected = 0;
+#endif
+
+/**
+ * Detects the best instruction set supported by the CPU. Only intended for
+ * internal usage.
+ *
+ * returns the best supported NI_IMAGE_SIMD_LEVEL
+ */
+static NI_IMAGE_SIMD_LEVEL
+__ni_simd_detect(void)
+{
+#ifdef NI_SIMD_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+		return NI_SIMD_AVX512;
+	if(__builtin_cpu_supports("avx2"))
+		return NI_SIMD_AVX2;
+	if(__builtin_cpu_supports("sse2"))
+		return NI_SIMD_SSE2;
+#endif
+	return NI_SIMD_NONE;
+}
+
+/**
+ * Sets the active instruction set to the best supported one. Only intended
+ * for internal usage.
+ */
+static void
+__ni_simd_init(void)
+{
+	__ni_simd_active = __ni_simd_detect();
+}
+
+NI_IMAGE_SIMD_LEVEL
+ni_simd_level(void)
+{
+#ifdef NI_THREADS
+	// The workers of a pool can be the first ones to ask
+	pthread_once(&__ni_simd_once, __ni_simd_init);
+#else
+	if(!__ni_simd_detected) {
+		__ni_simd_init();
+		__ni_simd_detected = 1;
+	}
+#endif
+	return __ni_simd_active;
+}
+
+void
+ni_simd_set_level(NI_IMAGE_SIMD_LEVEL level)
+{
+	// Detected first, so that a later first call does not override it
+	const NI_IMAGE_SIMD_LEVEL best = ni_simd_level();
+	__ni_simd_active = (level < best) ? level : best;
+}
+
+// -- SCALAR --
+
+static void
+__ni_simd_u8_to_data_scalar(const stbi_uc *src, double *dst, size_t len)
+{
+	for(size_t i = 0; i < len; i++)
+		dst[i] = ni_stbi_uc_normalize(src[i]);
+}
+
+static void
+__ni_simd_data_to_u8_scalar(const double *src, stbi_uc *dst, size_t len)
+{
+	for(size_t i = 0; i < len; i++)
+		dst[i] = ni_stbi_uc_unnormalize(ni_image_data_clamp(src[i]));
+}
+
+static void
+__ni_simd_convolve_scalar(const double *src, double *dst, size_t len, ptrdiff_t step, const double *kernel, int taps)
+{
+	double sum;
+	for(size_t i = 0; i < len; i++) {
+		sum = 0.0;
+		for(int j = 0; j < taps; j++)
+			sum += kernel[j] * src[i + j * step];
+		dst[i] = sum;
+	}
+}
+
+static void
+__ni_simd_u8_to_f32_scalar(const stbi_uc *src, float *dst, size_t len)
+{
+	for(size_t i = 0; i < len; i++)
+		dst[i] = (float)src[i] / (float)UCHAR_MAX;
+}
+
+static void
+__ni_simd_f32_to_u8_scalar(const float *src, stbi_uc *dst, size_t len)
+{
+	float v, t;
+	for(size_t i = 0; i < len; i++) {
+		v = src[i] < 0.0f ? 0.0f : src[i] > 1.0f ? 1.0f : src[i];
+		v *= (float)UCHAR_MAX;
+		t = floorf(v);
+		dst[i] = (stbi_uc)(t + (v - t >= 0.5f));
+	}
+}
+
+static void
+__ni_simd_convolve_f32_scalar(const float *src, float *dst, size_t len, ptrdiff_t step, const float *kernel, int taps)
+{
+	float sum;
+	for(size_t i = 0; i < len; i++) {
+		sum = 0.0f;
+		for(int j = 0; j < taps; j++)
+			sum += kernel[j] * src[i + j * step];
+		dst[i] = sum;
+	}
+}
+
+static inline int32_t
+__ni_simd_convolve_i16_one(const int16_t *src, ptrdiff_t step, const int16_t *kernel, int taps, int shift)
+{
+	int32_t sum = 0;
+	for(int j = 0; j < taps; j++)
+		sum += (int32_t)kernel[j] * src[j * step];
+	return (sum + (1 << (shift - 1))) >> shift;
+}
+
+static void
+__ni_simd_convolve_i16_scalar(const int16_t *src, int16_t *dst, size_t len, ptrdiff_t step, const int16_t *kernel, int taps, int shift)
+{
+	for(size_t i = 0; i < len; i++)
+		dst[i] = (int16_t)__ni_simd_convolve_i16_one(src + i, step, kernel, taps, shift);
+}
+
+static void
+__ni_simd_convolve_i16_u8_scalar(const int16_t *src, stbi_uc *dst, size_t len, ptrdiff_t step, const int16_t *kernel, int taps, int shift)
+{
+	int32_t v;
+	for(size_t i = 0; i < len; i++) {
+		v = __ni_simd_convolve_i16_one(src + i, step, kernel, taps, shift);
+		dst[i] = (stbi_uc)(v < 0 ? 0 : v > UCHAR_MAX ? UCHAR_MAX : v);
+	}
+}
+
+static void
+__ni_simd_deinterleave_u8_scalar(const stbi_uc *src, stbi_uc *const *planes, size_t len, int n_channels)
+{
+	for(size_t i = 0; i < len; i++)
+		for(int c = 0; c < n_channels; c++)
+			planes[c][i] = src[i * n_channels + c];
+}
+
+static void
+__ni_simd_interleave_u8_scalar(const stbi_uc *const *planes, stbi_uc *dst, size_t len, int n_channels)
+{
+	for(size_t i = 0; i < len; i++)
+		for(int c = 0; c < n_channels; c++)
+			dst[i * n_channels + c] = planes[c][i];
+}
+
+/**
+ * Luma of one pixel with the double formula of ni_simd_luma_u8. It is kept
+ * out of the vectorised kernels, so it is compiled like the rest of the
+ * scalar code. Only intended for internal usage.
+ */
+static stbi_uc
+__ni_simd_luma_double(stbi_uc r, stbi_uc g, stbi_uc b, const ni_simd_luma_weights *wt)
+{
+	return (stbi_uc)round((wt->k[0] * (double)r) + (wt->k[1] * (double)g) + (wt->k[2] * (double)b));
+}
+
+static void
+__ni_simd_luma_u8_scalar(const stbi_uc *r, const stbi_uc *g, const stbi_uc *b, stbi_uc *out, size_t len, const ni_simd_luma_weights *wt)
+{
+	const uint32_t div = (uint32_t)wt->div;
+	// The sums are below 2^22 and div is at most 10000, so multiplying by
+	// the reciprocal rounded up to 40 bits gives the exact quotient
+	const uint64_t rcp = ((uint64_t)1 << 40) / div + 1;
+	uint32_t m, q;
+	for(size_t i = 0; i < len; i++) {
+		m = (uint32_t)wt->c[0] * r[i] + (uint32_t)wt->c[1] * g[i] + (uint32_t)wt->c[2] * b[i] + div / 2;
+		q = (uint32_t)((m * rcp) >> 40);
+		out[i] = (q * div == m) ? __ni_simd_luma_double(r[i], g[i], b[i], wt) : (stbi_uc)q;
+	}
+}
+
+static void
+__ni_simd_blend_u8_scalar(const stbi_uc *src, const stbi_uc *alpha, stbi_uc bg, stbi_uc *dst, size_t len)
+{
+	uint32_t t;
+	for(size_t i = 0; i < len; i++) {
+		// round(x / 255) for any x up to 255 * 255
+		t = (uint32_t)src[i] * alpha[i] + (uint32_t)bg * (UCHAR_MAX - alpha[i]) + 128;
+		dst[i] = (stbi_uc)((t + (t >> 8)) >> 8);
+	}
+}
+
+static void
+__ni_simd_threshold_u8_scalar(const stbi_uc *src, const stbi_uc *thresholds, size_t period, stbi_uc *dst, size_t len)
+{
+	for(size_t i = 0, j = 0; i < len; i++, j = (j + 1 < period) ? j + 1 : 0)
+		dst[i] = (src[i] >= thresholds[j]) ? UCHAR_MAX : 0;
+}
+
+static void
+__ni_simd_convolve_offsets_scalar(const double *src, double *dst, size_t len, const ptrdiff_t *offsets, const double *kernel, int taps)
+{
+	double sum;
+	for(size_t i = 0; i < len; i++) {
+		sum = 0.0;
+		for(int j = 0; j < taps; j++)
+			sum += kernel[j] * src[i + offsets[j]];
+		dst[i] = sum;
+	}
+}
+
+#ifdef NI_SIMD_X86
+
+// The rounding is done as trunc(v) + (v - trunc(v) >= 0.5), which is exactly
+// what round() does for positive values, so every level gives the same bytes.
+
+// -- SSE2 --
+
+__attribute__((target("sse2"))) static void
+__ni_simd_u8_to_data_sse2(const stbi_uc *src, double *dst, size_t len)
+{
+	const __m128d scale = _mm_set1_pd((double)UCHAR_MAX);
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	int packed;
+	__m128i v;
+	for(; i + 4 <= len; i += 4) {
+		memcpy(&packed, src + i, sizeof(packed));
+		v = _mm_cvtsi32_si128(packed);
+		v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero);
+		_mm_storeu_pd(dst + i, _mm_div_pd(_mm_cvtepi32_pd(v), scale));
+		_mm_storeu_pd(dst + i + 2, _mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(v, 8)), scale));
+	}
+	__ni_simd_u8_to_data_scalar(src + i, dst + i, len - i);
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+__ni_simd_round_sse2(__m128d v)
+{
+	const __m128d half = _mm_set1_pd(0.5);
+	const __m128d one = _mm_set1_pd(1.0);
+	v = _mm_min_pd(_mm_max_pd(v, _mm_setzero_pd()), one);
+	v = _mm_mul_pd(v, _mm_set1_pd((double)UCHAR_MAX));
+	const __m128i t = _mm_cvttpd_epi32(v);
+	const __m128d frac = _mm_sub_pd(v, _mm_cvtepi32_pd(t));
+	const __m128d r = _mm_add_pd(_mm_cvtepi32_pd(t), _mm_and_pd(_mm_cmpge_pd(frac, half), one));
+	return _mm_cvttpd_epi32(r);
+}
+
+__attribute__((target("sse2"))) static void
+__ni_simd_data_to_u8_sse2(const double *src, stbi_uc *dst, size_t len)
+{
+	size_t i = 0;
+	int packed;
+	__m128i v;
+	for(; i + 4 <= len; i += 4) {
+		v = _mm_unpacklo_epi64(__ni_simd_round_sse2(_mm_loadu_pd(src + i)), __ni_simd_round_sse2(_mm_loadu_pd(src + i + 2)));
+		v = _mm_packs_epi32(v, v);
+		v = _mm_packus_epi16(v, v);
+		packed = _mm_cvtsi128_si32(v);
+		memcpy(dst + i, &packed, sizeof(packed));
+	}
+	__ni_simd_data_to_u8_scalar(src + i, dst + i, len - i);
+}
+
+__attribute__((target("sse2"))) static void
+__ni_simd_convolve_sse2(const double *src, double *dst, size_t len, ptrdiff_t step, const double *kernel, int taps)
+{
+	size_t i = 0;
+	__m128d k, s0, s1, s2, s3;
+	const double *in;
+	// Four independent accumulators to hide the latency of the additions
+	for(; i + 8 <= len; i += 8) {
+		s0 = s1 = s2 = s3 = _mm_setzero_pd();
+		in = src + i;
+		for(int j = 0; j < taps; j++, in += step) {
+			k = _mm_set1_pd(kernel[j]);
+			s0 = _mm_add_pd(s0, _mm_mul_pd(k, _mm_loadu_pd(in)));
+			s1 = _mm_add_pd(s1, _mm_mul_pd(k, _mm_loadu_pd(in + 2)));
+			s2 = _mm_add_pd(s2, _mm_mul_pd(k, _mm_loadu_pd(in + 4)));
+			s3 = _mm_add_pd(s3, _mm_mul_pd(k, _mm_loadu_pd(in + 6)));
+		}
+		_mm_storeu_pd(dst + i, s0);
+		_mm_storeu_pd(dst + i + 2, s1);
+		_mm_storeu_pd(dst + i + 4, s2);
+		_mm_storeu_pd(dst + i + 6, s3);
+	}
+	for(; i + 2 <= len; i += 2) {
+		s0 = _mm_setzero_pd();
+		in = src + i;
+		for(int j = 0; j < taps; j++, in += step)
+			s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_set1_pd(kernel[j]), _mm_loadu_pd(in)));
+		_mm_storeu_pd(dst + i, s0);
+	}
+	__ni_simd_convolve_scalar(src + i, dst + i, len - i, step, kernel, taps);
+}
+
+__attribute__((target("sse2"))) static void
+__ni_simd_u8_to_f32_sse2(const stbi_uc *src, float *dst, size_t len)
+{
+	const __m128 scale = _mm_set1_ps((float)UCHAR_MAX);
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	__m128i v, lo, hi;
+	for(; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		lo = _mm_unpacklo_epi8(v, zero);
+		hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_ps(dst + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+		_mm_storeu_ps(dst + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+		_mm_storeu_ps(dst + i + 8, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+		_mm_storeu_ps(dst + i + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+	}
+	__ni_simd_u8_to_f32_scalar(src + i, dst + i, len - i);
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+__ni_simd_round_f32_sse2(__m128 v)
+{
+	v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	v = _mm_mul_ps(v, _mm_set1_ps((float)UCHAR_MAX));
+	const __m128i t = _mm_cvttps_epi32(v);
+	const __m128 frac = _mm_sub_ps(v, _mm_cvtepi32_ps(t));
+	// The comparison gives -1 where the value rounds up
+	return _mm_sub_epi32(t, _mm_castps_si128(_mm_cmpge_ps(frac, _mm_set1_ps(0.5f))));
+}
+
+__attribute__((target("sse2"))) static void
+__ni_simd_f32_to_u8_sse2(const float *src, stbi_uc *dst, size_t len)
+{
+	size_t i = 0;
+	__m128i lo, hi;
+	for(; i + 16 <= len; i += 16) {
+		lo = _mm_packs_epi32(__ni_simd_round_f32_sse2(_mm_loadu_ps(src + i)), __ni_simd_round_f32_sse2(_mm_loadu_ps(src + i + 4)));
+		hi = _mm_packs_epi32(__ni_simd_round_f32_sse2(_mm_loadu_ps(src + i + 8)), __ni_simd_round_f32_sse2(_mm_loadu_ps(src + i + 12)));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+	__ni_simd_f32_to_u8_scalar(src + i, dst + i, len - i);
+}
+
+__attribute__((target("sse2"))) static void
+__ni_simd_convolve_f32_sse2(const float *src, float *dst, size_t len, ptrdiff_t step, const float *kernel, int taps)
+{
+	size_t i = 0;
+	__m128 k, s0, s1, s2, s3;
+	const float *in;
+	for(; i + 16 <= len; i += 16) {
+		s0 = s1 = s2 = s3 = _mm_setzero_ps();
+		in = src + i;
+		for(int j = 0; j < taps; j++, in += step) {
+			k = _mm_set1_ps(kernel[j]);
+			s0 = _mm_add_ps(s0, _mm_mul_ps(k, _mm_loadu_ps(in)));
+			s1 = _mm_add_ps(s1, _mm_mul_ps(k, _mm_loadu_ps(in + 4)));
+			s2 = _mm_add_ps(s2, _mm_mul_ps(k, _mm_loadu_ps(in + 8)));
+			s3 = _mm_add_ps(s3, _mm_mul_ps(k, _mm_loadu_ps(in + 12)));
+		}
+		_mm_storeu_ps(dst + i, s0);
+		_mm_storeu_ps(dst + i + 4, s1);
+		_mm_storeu_ps(dst + i + 8, s2);
+		_mm_storeu_ps(dst + i + 12, s3);
+	}
+	for(; i + 4 <= len; i += 4) {
+		s0 = _mm_setzero_ps();
+		in = src + i;
+		for(int j = 0; j < taps; j++, in += step)
+			s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_set1_ps(kernel[j]), _mm_loadu_ps(in)));
+		_mm_storeu_ps(dst + i, s0);
+	}
+	__ni_simd_convolve_f32_scalar(src + i, dst + i, len - i, step, kernel, taps);
+}
+
+/**
+ * Accumulates 8 fixed point outputs with pmaddwd, two taps per instruction:
+ * the values of taps j and j + 1 are interleaved and multiplied by the
+ * (kernel[j], kernel[j + 1]) pair. Returns the rounded results packed to
+ * int16. Only intended for internal usage.
+ */
+__attribute__((target("sse2"))) static inline __m128i
+__ni_simd_convolve_i16_block_sse2(const int16_t *in, ptrdiff_t step, const int16_t *kernel, int taps, int shift)
+{
+	__m128i lo = _mm_setzero_si128();
+	__m128i hi = _mm_setzero_si128();
+	__m128i a, b, k;
+	for(int j = 0; j < taps; j += 2) {
+		a = _mm_loadu_si128((const __m128i *)(in + j * step));
+		if(j + 1 < taps) {
+			b = _mm_loadu_si128((const __m128i *)(in + (j + 1) * step));
+			k = _mm_set1_epi32((int32_t)(((uint32_t)(uint16_t)kernel[j + 1] << 16) | (uint16_t)kernel[j]));
+		} else {
+			b = a;
+			k = _mm_set1_epi32((int32_t)(uint16_t)kernel[j]);
+		}
+		lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), k));
+		hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), k));
+	}
+	const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	lo = _mm_sra_epi32(_mm_add_epi32(lo, round), count);
+	hi = _mm_sra_epi32(_mm_add_epi32(hi, round), count);
+	return _mm_packs_epi32(lo, hi);
+}
+
+__attribute__((target("sse2"))) static void
+__ni_simd_convolve_i16_sse2(const int16_t *src, int16_t *dst, size_t len, ptrdiff_t step, const int16_t *kernel, int taps, int shift)
+{
+	size_t i = 0;
+	for(; i + 8 <= len; i += 8)
+		_mm_storeu_si128((__m128i *)(dst + i), __ni_simd_convolve_i16_block_sse2(src + i, step, kernel, taps, shift));
+	__ni_simd_convolve_i16_scalar(src + i, dst + i, len - i, step, kernel, taps, shift);
+}
+
+__attribute__((target("sse2"))) static void
+__ni_simd_convolve_i16_u8_sse2(const int16_t *src, stbi_uc *dst, size_t len, ptrdiff_t step, const int16_t *kernel, int taps, int shift)
+{
+	size_t i = 0;
+	__m128i v;
+	for(; i + 8 <= len; i += 8) {
+		v = __ni_simd_convolve_i16_block_sse2(src + i, step, kernel, taps, shift);
+		_mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(v, v));
+	}
+	__ni_simd_convolve_i16_u8_scalar(src + i, dst + i, len - i, step, kernel, taps, shift);
+}
+
+__attribute__((target("sse2"))) static void
+__ni_simd_convolve_offsets_sse2(const double *src, double *dst, size_t len, const ptrdiff_t *offsets, const double *kernel, int taps)
+{
+	size_t i = 0;
+	__m128d k, s0, s1, s2, s3;
+	const double *in;
+	for(; i + 8 <= len; i += 8) {
+		s0 = s1 = s2 = s3 = _mm_setzero_pd();
+		for(int j = 0; j < taps; j++) {
+			in = src + i + offsets[j];
+			k = _mm_set1_pd(kernel[j]);
+			s0 = _mm_add_pd(s0, _mm_mul_pd(k, _mm_loadu_pd(in)));
+			s1 = _mm_add_pd(s1, _mm_mul_pd(k, _mm_loadu_pd(in + 2)));
+			s2 = _mm_add_pd(s2, _mm_mul_pd(k, _mm_loadu_pd(in + 4)));
+			s3 = _mm_add_pd(s3, _mm_mul_pd(k, _mm_loadu_pd(in + 6)));
+		}
+		_mm_storeu_pd(dst + i, s0);
+		_mm_storeu_pd(dst + i + 2, s1);
+		_mm_storeu_pd(dst + i + 4, s2);
+		_mm_storeu_pd(dst + i + 6, s3);
+	}
+	__ni_simd_convolve_offsets_scalar(src + i, dst + i, len - i, offsets, kernel, taps);
+}
+
+// The luma is rounded by dividing the sum (plus div / 2) by div in single
+// precision. Both are integers below 2^24, and the quotient is at least
+// 1 / (256 * div) away from the next integer unless it is one, so the
+// truncation of the quotient is exact and the ties are the lanes where
+// quotient * div gives the sum back.
+
+__attribute__((target("sse2"))) static inline __m128i
+__ni_simd_luma_quarter_sse2(__m128i rg, __m128i b1, __m128i crg, __m128i cbh, __m128 div, int *tie)
+{
+	const __m128 m = _mm_cvtepi32_ps(_mm_add_epi32(_mm_madd_epi16(rg, crg), _mm_madd_epi16(b1, cbh)));
+	const __m128i q = _mm_cvttps_epi32(_mm_div_ps(m, div));
+	*tie |= _mm_movemask_ps(_mm_cmpeq_ps(_mm_mul_ps(_mm_cvtepi32_ps(q), div), m));
+	return q;
+}
+
+__attribute__((target("sse2"))) static void
+__ni_simd_luma_u8_sse2(const stbi_uc *r, const stbi_uc *g, const stbi_uc *b, stbi_uc *out, size_t len, const ni_simd_luma_weights *wt)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	// (R, G) pairs times (c[0], c[1]) plus (B, 1) pairs times (c[2], div / 2)
+	const __m128i crg = _mm_set1_epi32((int32_t)((uint32_t)(uint16_t)wt->c[0] | ((uint32_t)(uint16_t)wt->c[1] << 16)));
+	const __m128i cbh = _mm_set1_epi32((int32_t)((uint32_t)(uint16_t)wt->c[2] | ((uint32_t)(uint16_t)(wt->div / 2) << 16)));
+	const __m128 div = _mm_set1_ps((float)wt->div);
+	size_t i = 0;
+	__m128i vr, vg, vb, r16, g16, b16, q0, q1, q2, q3;
+	int tie;
+	for(; i + 16 <= len; i += 16) {
+		vr = _mm_loadu_si128((const __m128i *)(r + i));
+		vg = _mm_loadu_si128((const __m128i *)(g + i));
+		vb = _mm_loadu_si128((const __m128i *)(b + i));
+		tie = 0;
+		r16 = _mm_unpacklo_epi8(vr, zero);
+		g16 = _mm_unpacklo_epi8(vg, zero);
+		b16 = _mm_unpacklo_epi8(vb, zero);
+		q0 = __ni_simd_luma_quarter_sse2(_mm_unpacklo_epi16(r16, g16), _mm_unpacklo_epi16(b16, one), crg, cbh, div, &tie);
+		q1 = __ni_simd_luma_quarter_sse2(_mm_unpackhi_epi16(r16, g16), _mm_unpackhi_epi16(b16, one), crg, cbh, div, &tie);
+		r16 = _mm_unpackhi_epi8(vr, zero);
+		g16 = _mm_unpackhi_epi8(vg, zero);
+		b16 = _mm_unpackhi_epi8(vb, zero);
+		q2 = __ni_simd_luma_quarter_sse2(_mm_unpacklo_epi16(r16, g16), _mm_unpacklo_epi16(b16, one), crg, cbh, div, &tie);
+		q3 = __ni_simd_luma_quarter_sse2(_mm_unpackhi_epi16(r16, g16), _mm_unpackhi_epi16(b16, one), crg, cbh, div, &tie);
+		// The blocks with a tie are redone in plain C, they are rare
+		if(tie)
+			__ni_simd_luma_u8_scalar(r + i, g + i, b + i, out + i, 16, wt);
+		else
+			_mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(_mm_packs_epi32(q0, q1), _mm_packs_epi32(q2, q3)));
+	}
+	__ni_simd_luma_u8_scalar(r + i, g + i, b + i, out + i, len - i, wt);
+}
+
+/**
+ * Composites 8 values widened to 16 bits (see ni_simd_blend_u8). The sums
+ * and the rounding stay below 2^16, so the 16-bit lanes never overflow.
+ * Only intended for internal usage.
+ */
+__attribute__((target("sse2"))) static inline __m128i
+__ni_simd_blend_8_sse2(__m128i s16, __m128i a16, __m128i bg, __m128i max, __m128i half)
+{
+	const __m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s16, a16), _mm_mullo_epi16(bg, _mm_sub_epi16(max, a16))), half);
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2"))) static void
+__ni_simd_blend_u8_sse2(const stbi_uc *src, const stbi_uc *alpha, stbi_uc bg, stbi_uc *dst, size_t len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i vbg = _mm_set1_epi16(bg);
+	const __m128i max = _mm_set1_epi16(UCHAR_MAX);
+	const __m128i half = _mm_set1_epi16(128);
+	size_t i = 0;
+	__m128i vs, va, lo, hi;
+	for(; i + 16 <= len; i += 16) {
+		vs = _mm_loadu_si128((const __m128i *)(src + i));
+		va = _mm_loadu_si128((const __m128i *)(alpha + i));
+		lo = __ni_simd_blend_8_sse2(_mm_unpacklo_epi8(vs, zero), _mm_unpacklo_epi8(va, zero), vbg, max, half);
+		hi = __ni_simd_blend_8_sse2(_mm_unpackhi_epi8(vs, zero), _mm_unpackhi_epi8(va, zero), vbg, max, half);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+	__ni_simd_blend_u8_scalar(src + i, alpha + i, bg, dst + i, len - i);
+}
+
+/**
+ * Thresholds one period of the row (see ni_simd_threshold_u8): max(s, t)
+ * is s only where s >= t, so the equality is the mask of the white bytes.
+ * Only intended for internal usage.
+ */
+__attribute__((target("sse2"))) static void
+__ni_simd_threshold_u8_sse2(const stbi_uc *src, const stbi_uc *thresholds, size_t period, stbi_uc *dst, size_t len)
+{
+	size_t i, j, n;
+	__m128i vs;
+	for(i = 0; i < len; i += n) {
+		n = (len - i < period) ? len - i : period;
+		for(j = 0; j + 16 <= n; j += 16) {
+			vs = _mm_loadu_si128((const __m128i *)(src + i + j));
+			_mm_storeu_si128((__m128i *)(dst + i + j), _mm_cmpeq_epi8(_mm_max_epu8(vs, _mm_loadu_si128((const __m128i *)(thresholds + j))), vs));
+		}
+		__ni_simd_threshold_u8_scalar(src + i + j, thresholds + j, n - j, dst + i + j, n - j);
+	}
+}
+
+// -- AVX2 --
+
+__attribute__((target("avx2"))) static void
+__ni_simd_u8_to_data_avx2(const stbi_uc *src, double *dst, size_t len)
+{
+	const __m256d scale = _mm256_set1_pd((double)UCHAR_MAX);
+	size_t i = 0;
+	__m256i v;
+	for(; i + 8 <= len; i += 8) {
+		v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+		_mm256_storeu_pd(dst + i, _mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(v)), scale));
+		_mm256_storeu_pd(dst + i + 4, _mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1)), scale));
+	}
+	__ni_simd_u8_to_data_sse2(src + i, dst + i, len - i);
+}
+
+__attribute__((target("avx2"))) static inline __m128i
+__ni_simd_round_avx2(__m256d v)
+{
+	const __m256d one = _mm256_set1_pd(1.0);
+	v = _mm256_min_pd(_mm256_max_pd(v, _mm256_setzero_pd()), one);
+	v = _mm256_mul_pd(v, _mm256_set1_pd((double)UCHAR_MAX));
+	const __m256d t = _mm256_floor_pd(v);
+	const __m256d up = _mm256_cmp_pd(_mm256_sub_pd(v, t), _mm256_set1_pd(0.5), _CMP_GE_OQ);
+	return _mm256_cvttpd_epi32(_mm256_add_pd(t, _mm256_and_pd(up, one)));
+}
+
+__attribute__((target("avx2"))) static void
+__ni_simd_data_to_u8_avx2(const double *src, stbi_uc *dst, size_t len)
+{
+	size_t i = 0;
+	__m128i v;
+	for(; i + 8 <= len; i += 8) {
+		v = _mm_packs_epi32(__ni_simd_round_avx2(_mm256_loadu_pd(src + i)), __ni_simd_round_avx2(_mm256_loadu_pd(src + i + 4)));
+		_mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(v, v));
+	}
+	__ni_simd_data_to_u8_sse2(src + i, dst + i, len - i);
+}
+
+__attribute__((target("avx2"))) static void
+__ni_simd_convolve_avx2(const double *src, double *dst, size_t len, ptrdiff_t step, const double *kernel, int taps)
+{
+	size_t i = 0;
+	__m256d k, s0, s1, s2, s3;
+	const double *in;
+	for(; i + 16 <= len; i += 16) {
+		s0 = s1 = s2 = s3 = _mm256_setzero_pd();
+		in = src + i;
+		for(int j = 0; j < taps; j++, in += step) {
+			k = _mm256_set1_pd(kernel[j]);
+			s0 = _mm256_add_pd(s0, _mm256_mul_pd(k, _mm256_loadu_pd(in)));
+			s1 = _mm256_add_pd(s1, _mm256_mul_pd(k, _mm256_loadu_pd(in + 4)));
+			s2 = _mm256_add_pd(s2, _mm256_mul_pd(k, _mm256_loadu_pd(in + 8)));
+			s3 = _mm256_add_pd(s3, _mm256_mul_pd(k, _mm256_loadu_pd(in + 12)));
+		}
+		_mm256_storeu_pd(dst + i, s0);
+		_mm256_storeu_pd(dst + i + 4, s1);
+		_mm256_storeu_pd(dst + i + 8, s2);
+		_mm256_storeu_pd(dst + i + 12, s3);
+	}
+	for(; i + 4 <= len; i += 4) {
+		s0 = _mm256_setzero_pd();
+		in = src + i;
+		for(int j = 0; j < taps; j++, in += step)
+			s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_set1_pd(kernel[j]), _mm256_loadu_pd(in)));
+		_mm256_storeu_pd(dst + i, s0);
+	}
+	__ni_simd_convolve_sse2(src + i, dst + i, len - i, step, kernel, taps);
+}
+
+__attribute__((target("avx2"))) static void
+__ni_simd_u8_to_f32_avx2(const stbi_uc *src, float *dst, size_t len)
+{
+	const __m256 scale = _mm256_set1_ps((float)UCHAR_MAX);
+	size_t i = 0;
+	for(; i + 8 <= len; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)))), scale));
+	__ni_simd_u8_to_f32_sse2(src + i, dst + i, len - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+__ni_simd_round_f32_avx2(__m256 v)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), one);
+	v = _mm256_mul_ps(v, _mm256_set1_ps((float)UCHAR_MAX));
+	const __m256 t = _mm256_floor_ps(v);
+	const __m256 up = _mm256_cmp_ps(_mm256_sub_ps(v, t), _mm256_set1_ps(0.5f), _CMP_GE_OQ);
+	return _mm256_cvttps_epi32(_mm256_add_ps(t, _mm256_and_ps(up, one)));
+}
+
+__attribute__((target("avx2"))) static void
+__ni_simd_f32_to_u8_avx2(const float *src, stbi_uc *dst, size_t len)
+{
+	size_t i = 0;
+	__m256i a, b;
+	for(; i + 16 <= len; i += 16) {
+		a = __ni_simd_round_f32_avx2(_mm256_loadu_ps(src + i));
+		b = __ni_simd_round_f32_avx2(_mm256_loadu_ps(src + i + 8));
+		a = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1)));
+	}
+	__ni_simd_f32_to_u8_sse2(src + i, dst + i, len - i);
+}
+
+__attribute__((target("avx2"))) static void
+__ni_simd_convolve_f32_avx2(const float *src, float *dst, size_t len, ptrdiff_t step, const float *kernel, int taps)
+{
+	size_t i = 0;
+	__m256 k, s0, s1, s2, s3;
+	const float *in;
+	for(; i + 32 <= len; i += 32) {
+		s0 = s1 = s2 = s3 = _mm256_setzero_ps();
+		in = src + i;
+		for(int j = 0; j < taps; j++, in += step) {
+			k = _mm256_set1_ps(kernel[j]);
+			s0 = _mm256_add_ps(s0, _mm256_mul_ps(k, _mm256_loadu_ps(in)));
+			s1 = _mm256_add_ps(s1, _mm256_mul_ps(k, _mm256_loadu_ps(in + 8)));
+			s2 = _mm256_add_ps(s2, _mm256_mul_ps(k, _mm256_loadu_ps(in + 16)));
+			s3 = _mm256_add_ps(s3, _mm256_mul_ps(k, _mm256_loadu_ps(in + 24)));
+		}
+		_mm256_storeu_ps(dst + i, s0);
+		_mm256_storeu_ps(dst + i + 8, s1);
+		_mm256_storeu_ps(dst + i + 16, s2);
+		_mm256_storeu_ps(dst + i + 24, s3);
+	}
+	for(; i + 8 <= len; i += 8) {
+		s0 = _mm256_setzero_ps();
+		in = src + i;
+		for(int j = 0; j < taps; j++, in += step)
+			s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_set1_ps(kernel[j]), _mm256_loadu_ps(in)));
+		_mm256_storeu_ps(dst + i, s0);
+	}
+	__ni_simd_convolve_f32_sse2(src + i, dst + i, len - i, step, kernel, taps);
+}
+
+/**
+ * AVX2 version of __ni_simd_convolve_i16_block_sse2 for 16 outputs. The
+ * unpack and pack instructions work inside of each 128-bit half, so the
+ * results come back in order. Only intended for internal usage.
+ */
+__attribute__((target("avx2"))) static inline __m256i
+__ni_simd_convolve_i16_block_avx2(const int16_t *in, ptrdiff_t step, const int16_t *kernel, int taps, int shift)
+{
+	__m256i lo = _mm256_setzero_si256();
+	__m256i hi = _mm256_setzero_si256();
+	__m256i a, b, k;
+	for(int j = 0; j < taps; j += 2) {
+		a = _mm256_loadu_si256((const __m256i *)(in + j * step));
+		if(j + 1 < taps) {
+			b = _mm256_loadu_si256((const __m256i *)(in + (j + 1) * step));
+			k = _mm256_set1_epi32((int32_t)(((uint32_t)(uint16_t)kernel[j + 1] << 16) | (uint16_t)kernel[j]));
+		} else {
+			b = a;
+			k = _mm256_set1_epi32((int32_t)(uint16_t)kernel[j]);
+		}
+		lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), k));
+		hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), k));
+	}
+	const __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	lo = _mm256_sra_epi32(_mm256_add_epi32(lo, round), count);
+	hi = _mm256_sra_epi32(_mm256_add_epi32(hi, round), count);
+	return _mm256_packs_epi32(lo, hi);
+}
+
+__attribute__((target("avx2"))) static void
+__ni_simd_convolve_i16_avx2(const int16_t *src, int16_t *dst, size_t len, ptrdiff_t step, const int16_t *kernel, int taps, int shift)
+{
+	size_t i = 0;
+	for(; i + 16 <= len; i += 16)
+		_mm256_storeu_si256((__m256i *)(dst + i), __ni_simd_convolve_i16_block_avx2(src + i, step, kernel, taps, shift));
+	__ni_simd_convolve_i16_sse2(src + i, dst + i, len - i, step, kernel, taps, shift);
+}
+
+__attribute__((target("avx2"))) static void
+__ni_simd_convolve_i16_u8_avx2(const int16_t *src, stbi_uc *dst, size_t len, ptrdiff_t step, const int16_t *kernel, int taps, int shift)
+{
+	size_t i = 0;
+	__m256i v;
+	for(; i + 16 <= len; i += 16) {
+		v = __ni_simd_convolve_i16_block_avx2(src + i, step, kernel, taps, shift);
+		v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm256_castsi256_si128(v));
+	}
+	__ni_simd_convolve_i16_u8_sse2(src + i, dst + i, len - i, step, kernel, taps, shift);
+}
+
+__attribute__((target("avx2"))) static void
+__ni_simd_convolve_offsets_avx2(const double *src, double *dst, size_t len, const ptrdiff_t *offsets, const double *kernel, int taps)
+{
+	size_t i = 0;
+	__m256d k, s0, s1, s2, s3;
+	const double *in;
+	for(; i + 16 <= len; i += 16) {
+		s0 = s1 = s2 = s3 = _mm256_setzero_pd();
+		for(int j = 0; j < taps; j++) {
+			in = src + i + offsets[j];
+			k = _mm256_set1_pd(kernel[j]);
+			s0 = _mm256_add_pd(s0, _mm256_mul_pd(k, _mm256_loadu_pd(in)));
+			s1 = _mm256_add_pd(s1, _mm256_mul_pd(k, _mm256_loadu_pd(in + 4)));
+			s2 = _mm256_add_pd(s2, _mm256_mul_pd(k, _mm256_loadu_pd(in + 8)));
+			s3 = _mm256_add_pd(s3, _mm256_mul_pd(k, _mm256_loadu_pd(in + 12)));
+		}
+		_mm256_storeu_pd(dst + i, s0);
+		_mm256_storeu_pd(dst + i + 4, s1);
+		_mm256_storeu_pd(dst + i + 8, s2);
+		_mm256_storeu_pd(dst + i + 12, s3);
+	}
+	__ni_simd_convolve_offsets_sse2(src + i, dst + i, len - i, offsets, kernel, taps);
+}
+
+/**
+ * Fills the byte shuffles that move 16 pixels between n_channels blocks of
+ * 16 interleaved bytes and n_channels planes. With deinterleave set,
+ * shuffling block k with masks[c][k] gives the bytes of plane c that are in
+ * that block, and with it unset, shuffling plane c with masks[c][k] gives
+ * the bytes of block k that come from that plane. Bytes that are not moved
+ * are set to -128, which the shuffle turns into zero. Only intended for
+ * internal usage.
+ */
+static void
+__ni_simd_interleave_masks(int8_t masks[4][4][16], int n_channels, int deinterleave)
+{
+	int pos;
+	for(int c = 0; c < n_channels; c++) {
+		for(int k = 0; k < n_channels; k++) {
+			for(int j = 0; j < 16; j++) {
+				if(deinterleave) {
+					pos = j * n_channels + c;
+					masks[c][k][j] = (pos / 16 == k) ? (int8_t)(pos % 16) : -128;
+				} else {
+					pos = 16 * k + j;
+					masks[c][k][j] = (pos % n_channels == c) ? (int8_t)(pos / n_channels) : -128;
+				}
+			}
+		}
+	}
+}
+
+// The byte shuffle is SSSE3, that every CPU with AVX2 has, so the SSE2 level
+// (de)interleaves in plain C.
+
+__attribute__((target("avx2"))) static void
+__ni_simd_deinterleave_u8_avx2(const stbi_uc *src, stbi_uc *const *planes, size_t len, int n_channels)
+{
+	int8_t masks[4][4][16];
+	__m128i in[4], v;
+	size_t i = 0;
+	if(n_channels >= 2 && n_channels <= 4) {
+		__ni_simd_interleave_masks(masks, n_channels, 1);
+		for(; i + 16 <= len; i += 16) {
+			for(int k = 0; k < n_channels; k++)
+				in[k] = _mm_loadu_si128((const __m128i *)(src + i * n_channels + 16 * k));
+			for(int c = 0; c < n_channels; c++) {
+				v = _mm_setzero_si128();
+				for(int k = 0; k < n_channels; k++)
+					v = _mm_or_si128(v, _mm_shuffle_epi8(in[k], _mm_loadu_si128((const __m128i *)masks[c][k])));
+				_mm_storeu_si128((__m128i *)(planes[c] + i), v);
+			}
+		}
+	}
+	for(; i < len; i++)
+		for(int c = 0; c < n_channels; c++)
+			planes[c][i] = src[i * n_channels + c];
+}
+
+__attribute__((target("avx2"))) static void
+__ni_simd_interleave_u8_avx2(const stbi_uc *const *planes, stbi_uc *dst, size_t len, int n_channels)
+{
+	int8_t masks[4][4][16];
+	__m128i in[4], v;
+	size_t i = 0;
+	if(n_channels >= 2 && n_channels <= 4) {
+		__ni_simd_interleave_masks(masks, n_channels, 0);
+		for(; i + 16 <= len; i += 16) {
+			for(int c = 0; c < n_channels; c++)
+				in[c] = _mm_loadu_si128((const __m128i *)(planes[c] + i));
+			for(int k = 0; k < n_channels; k++) {
+				v = _mm_setzero_si128();
+				for(int c = 0; c < n_channels; c++)
+					v = _mm_or_si128(v, _mm_shuffle_epi8(in[c], _mm_loadu_si128((const __m128i *)masks[c][k])));
+				_mm_storeu_si128((__m128i *)(dst + i * n_channels + 16 * k), v);
+			}
+		}
+	}
+	for(; i < len; i++)
+		for(int c = 0; c < n_channels; c++)
+			dst[i * n_channels + c] = planes[c][i];
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+__ni_simd_luma_half_avx2(__m256i rg, __m256i b1, __m256i crg, __m256i cbh, __m256 div, int *tie)
+{
+	const __m256 m = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_madd_epi16(rg, crg), _mm256_madd_epi16(b1, cbh)));
+	const __m256i q = _mm256_cvttps_epi32(_mm256_div_ps(m, div));
+	*tie |= _mm256_movemask_ps(_mm256_cmp_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(q), div), m, _CMP_EQ_OQ));
+	return q;
+}
+
+/**
+ * Luma of 16 pixels as 16-bit values in order. The unpacks work inside of
+ * the 128-bit lanes, so the first half has the pixels 0-3 and 8-11, and the
+ * pack puts them back in order. Only intended for internal usage.
+ */
+__attribute__((target("avx2"))) static inline __m256i
+__ni_simd_luma_16_avx2(const stbi_uc *r, const stbi_uc *g, const stbi_uc *b, __m256i crg, __m256i cbh, __m256 div, int *tie)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i r16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)r));
+	const __m256i g16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)g));
+	const __m256i b16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)b));
+	const __m256i lo = __ni_simd_luma_half_avx2(_mm256_unpacklo_epi16(r16, g16), _mm256_unpacklo_epi16(b16, one), crg, cbh, div, tie);
+	const __m256i hi = __ni_simd_luma_half_avx2(_mm256_unpackhi_epi16(r16, g16), _mm256_unpackhi_epi16(b16, one), crg, cbh, div, tie);
+	return _mm256_packs_epi32(lo, hi);
+}
+
+__attribute__((target("avx2"))) static void
+__ni_simd_luma_u8_avx2(const stbi_uc *r, const stbi_uc *g, const stbi_uc *b, stbi_uc *out, size_t len, const ni_simd_luma_weights *wt)
+{
+	const __m256i crg = _mm256_set1_epi32((int32_t)((uint32_t)(uint16_t)wt->c[0] | ((uint32_t)(uint16_t)wt->c[1] << 16)));
+	const __m256i cbh = _mm256_set1_epi32((int32_t)((uint32_t)(uint16_t)wt->c[2] | ((uint32_t)(uint16_t)(wt->div / 2) << 16)));
+	const __m256 div = _mm256_set1_ps((float)wt->div);
+	size_t i = 0;
+	__m256i a, c;
+	int tie;
+	for(; i + 32 <= len; i += 32) {
+		tie = 0;
+		a = __ni_simd_luma_16_avx2(r + i, g + i, b + i, crg, cbh, div, &tie);
+		c = __ni_simd_luma_16_avx2(r + i + 16, g + i + 16, b + i + 16, crg, cbh, div, &tie);
+		if(tie)
+			__ni_simd_luma_u8_scalar(r + i, g + i, b + i, out + i, 32, wt);
+		else
+			_mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, c), 0xD8));
+	}
+	__ni_simd_luma_u8_sse2(r + i, g + i, b + i, out + i, len - i, wt);
+}
+
+/**
+ * Composites 16 bytes into 16-bit values in order (see
+ * __ni_simd_blend_8_sse2). Only intended for internal usage.
+ */
+__attribute__((target("avx2"))) static inline __m256i
+__ni_simd_blend_16_avx2(const stbi_uc *src, const stbi_uc *alpha, __m256i bg, __m256i max, __m256i half)
+{
+	const __m256i s16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)src));
+	const __m256i a16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)alpha));
+	const __m256i t = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(s16, a16), _mm256_mullo_epi16(bg, _mm256_sub_epi16(max, a16))), half);
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2"))) static void
+__ni_simd_blend_u8_avx2(const stbi_uc *src, const stbi_uc *alpha, stbi_uc bg, stbi_uc *dst, size_t len)
+{
+	const __m256i vbg = _mm256_set1_epi16(bg);
+	const __m256i max = _mm256_set1_epi16(UCHAR_MAX);
+	const __m256i half = _mm256_set1_epi16(128);
+	size_t i = 0;
+	__m256i a, c;
+	for(; i + 32 <= len; i += 32) {
+		a = __ni_simd_blend_16_avx2(src + i, alpha + i, vbg, max, half);
+		c = __ni_simd_blend_16_avx2(src + i + 16, alpha + i + 16, vbg, max, half);
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, c), 0xD8));
+	}
+	__ni_simd_blend_u8_sse2(src + i, alpha + i, bg, dst + i, len - i);
+}
+
+__attribute__((target("avx2"))) static void
+__ni_simd_threshold_u8_avx2(const stbi_uc *src, const stbi_uc *thresholds, size_t period, stbi_uc *dst, size_t len)
+{
+	size_t i, j, n;
+	__m256i vs;
+	for(i = 0; i < len; i += n) {
+		n = (len - i < period) ? len - i : period;
+		for(j = 0; j + 32 <= n; j += 32) {
+			vs = _mm256_loadu_si256((const __m256i *)(src + i + j));
+			_mm256_storeu_si256((__m256i *)(dst + i + j), _mm256_cmpeq_epi8(_mm256_max_epu8(vs, _mm256_loadu_si256((const __m256i *)(thresholds + j))), vs));
+		}
+		__ni_simd_threshold_u8_sse2(src + i + j, thresholds + j, n - j, dst + i + j, n - j);
+	}
+}
+
+// -- AVX-512 --
+
+NI_SIMD_TARGET_AVX512 static void
+__ni_simd_u8_to_data_avx512(const stbi_uc *src, double *dst, size_t len)
+{
+	const __m512d scale = _mm512_set1_pd((double)UCHAR_MAX);
+	size_t i = 0;
+	__m256i v;
+	for(; i + 8 <= len; i += 8) {
+		v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+		_mm512_storeu_pd(dst + i, _mm512_div_pd(_mm512_cvtepi32_pd(v), scale));
+	}
+	__ni_simd_u8_to_data_sse2(src + i, dst + i, len - i);
+}
+
+NI_SIMD_TARGET_AVX512 static void
+__ni_simd_data_to_u8_avx512(const double *src, stbi_uc *dst, size_t len)
+{
+	const __m512d one = _mm512_set1_pd(1.0);
+	size_t i = 0;
+	__m512d v, t;
+	__m256i r;
+	__mmask8 up;
+	for(; i + 8 <= len; i += 8) {
+		v = _mm512_min_pd(_mm512_max_pd(_mm512_loadu_pd(src + i), _mm512_setzero_pd()), one);
+		v = _mm512_mul_pd(v, _mm512_set1_pd((double)UCHAR_MAX));
+		t = _mm512_roundscale_pd(v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+		up = _mm512_cmp_pd_mask(_mm512_sub_pd(v, t), _mm512_set1_pd(0.5), _CMP_GE_OQ);
+		r = _mm512_cvttpd_epi32(_mm512_mask_add_pd(t, up, t, one));
+		_mm512_mask_cvtepi32_storeu_epi8(dst + i, 0xFF, _mm512_castsi256_si512(r));
+	}
+	__ni_simd_data_to_u8_sse2(src + i, dst + i, len - i);
+}
+
+NI_SIMD_TARGET_AVX512 static void
+__ni_simd_convolve_avx512(const double *src, double *dst, size_t len, ptrdiff_t step, const double *kernel, int taps)
+{
+	size_t i = 0;
+	__m512d k, s0, s1, s2, s3;
+	const double *in;
+	for(; i + 32 <= len; i += 32) {
+		s0 = s1 = s2 = s3 = _mm512_setzero_pd();
+		in = src + i;
+		for(int j = 0; j < taps; j++, in += step) {
+			k = _mm512_set1_pd(kernel[j]);
+			s0 = _mm512_add_pd(s0, _mm512_mul_pd(k, _mm512_loadu_pd(in)));
+			s1 = _mm512_add_pd(s1, _mm512_mul_pd(k, _mm512_loadu_pd(in + 8)));
+			s2 = _mm512_add_pd(s2, _mm512_mul_pd(k, _mm512_loadu_pd(in + 16)));
+			s3 = _mm512_add_pd(s3, _mm512_mul_pd(k, _mm512_loadu_pd(in + 24)));
+		}
+		_mm512_storeu_pd(dst + i, s0);
+		_mm512_storeu_pd(dst + i + 8, s1);
+		_mm512_storeu_pd(dst + i + 16, s2);
+		_mm512_storeu_pd(dst + i + 24, s3);
+	}
+	for(; i + 8 <= len; i += 8) {
+		s0 = _mm512_setzero_pd();
+		in = src + i;
+		for(int j = 0; j < taps; j++, in += step)
+			s0 = _mm512_add_pd(s0, _mm512_mul_pd(_mm512_set1_pd(kernel[j]), _mm512_loadu_pd(in)));
+		_mm512_storeu_pd(dst + i, s0);
+	}
+	__ni_simd_convolve_avx2(src + i, dst + i, len - i, step, kernel, taps);
+}
+
+NI_SIMD_TARGET_AVX512 static void
+__ni_simd_u8_to_f32_avx512(const stbi_uc *src, float *dst, size_t len)
+{
+	const __m512 scale = _mm512_set1_ps((float)UCHAR_MAX);
+	size_t i = 0;
+	for(; i + 16 <= len; i += 16)
+		_mm512_storeu_ps(dst + i, _mm512_div_ps(_mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(src + i)))), scale));
+	__ni_simd_u8_to_f32_avx2(src + i, dst + i, len - i);
+}
+
+NI_SIMD_TARGET_AVX512 static void
+__ni_simd_f32_to_u8_avx512(const float *src, stbi_uc *dst, size_t len)
+{
+	const __m512 one = _mm512_set1_ps(1.0f);
+	size_t i = 0;
+	__m512 v, t;
+	__mmask16 up;
+	for(; i + 16 <= len; i += 16) {
+		v = _mm512_min_ps(_mm512_max_ps(_mm512_loadu_ps(src + i), _mm512_setzero_ps()), one);
+		v = _mm512_mul_ps(v, _mm512_set1_ps((float)UCHAR_MAX));
+		t = _mm512_roundscale_ps(v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+		up = _mm512_cmp_ps_mask(_mm512_sub_ps(v, t), _mm512_set1_ps(0.5f), _CMP_GE_OQ);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm512_cvtepi32_epi8(_mm512_cvttps_epi32(_mm512_mask_add_ps(t, up, t, one))));
+	}
+	__ni_simd_f32_to_u8_avx2(src + i, dst + i, len - i);
+}
+
+NI_SIMD_TARGET_AVX512 static void
+__ni_simd_convolve_f32_avx512(const float *src, float *dst, size_t len, ptrdiff_t step, const float *kernel, int taps)
+{
+	size_t i = 0;
+	__m512 k, s0, s1, s2, s3;
+	const float *in;
+	for(; i + 64 <= len; i += 64) {
+		s0 = s1 = s2 = s3 = _mm512_setzero_ps();
+		in = src + i;
+		for(int j = 0; j < taps; j++, in += step) {
+			k = _mm512_set1_ps(kernel[j]);
+			s0 = _mm512_add_ps(s0, _mm512_mul_ps(k, _mm512_loadu_ps(in)));
+			s1 = _mm512_add_ps(s1, _mm512_mul_ps(k, _mm512_loadu_ps(in + 16)));
+			s2 = _mm512_add_ps(s2, _mm512_mul_ps(k, _mm512_loadu_ps(in + 32)));
+			s3 = _mm512_add_ps(s3, _mm512_mul_ps(k, _mm512_loadu_ps(in + 48)));
+		}
+		_mm512_storeu_ps(dst + i, s0);
+		_mm512_storeu_ps(dst + i + 16, s1);
+		_mm512_storeu_ps(dst + i + 32, s2);
+		_mm512_storeu_ps(dst + i + 48, s3);
+	}
+	for(; i + 16 <= len; i += 16) {
+		s0 = _mm512_setzero_ps();
+		in = src + i;
+		for(int j = 0; j < taps; j++, in += step)
+			s0 = _mm512_add_ps(s0, _mm512_mul_ps(_mm512_set1_ps(kernel[j]), _mm512_loadu_ps(in)));
+		_mm512_storeu_ps(dst + i, s0);
+	}
+	__ni_simd_convolve_f32_avx2(src + i, dst + i, len - i, step, kernel, taps);
+}
+
+NI_SIMD_TARGET_AVX512 static void
+__ni_simd_convolve_offsets_avx512(const double *src, double *dst, size_t len, const ptrdiff_t *offsets, const double *kernel, int taps)
+{
+	size_t i = 0;
+	__m512d k, s0, s1, s2, s3;
+	const double *in;
+	for(; i + 32 <= len; i += 32) {
+		s0 = s1 = s2 = s3 = _mm512_setzero_pd();
+		for(int j = 0; j < taps; j++) {
+			in = src + i + offsets[j];
+			k = _mm512_set1_pd(kernel[j]);
+			s0 = _mm512_add_pd(s0, _mm512_mul_pd(k, _mm512_loadu_pd(in)));
+			s1 = _mm512_add_pd(s1, _mm512_mul_pd(k, _mm512_loadu_pd(in + 8)));
+			s2 = _mm512_add_pd(s2, _mm512_mul_pd(k, _mm512_loadu_pd(in + 16)));
+			s3 = _mm512_add_pd(s3, _mm512_mul_pd(k, _mm512_loadu_pd(in + 24)));
+		}
+		_mm512_storeu_pd(dst + i, s0);
+		_mm512_storeu_pd(dst + i + 8, s1);
+		_mm512_storeu_pd(dst + i + 16, s2);
+		_mm512_storeu_pd(dst + i + 24, s3);
+	}
+	__ni_simd_convolve_offsets_avx2(src + i, dst + i, len - i, offsets, kernel, taps);
+}
+
+#endif // NI_SIMD_X86
+
+// -- DISPATCH --
+
+void
+ni_simd_u8_to_data(const stbi_uc *src, double *dst, size_t len)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+		__ni_simd_u8_to_data_avx512(src, dst, len);
+		break;
+	case(NI_SIMD_AVX2):
+		__ni_simd_u8_to_data_avx2(src, dst, len);
+		break;
+	case(NI_SIMD_SSE2):
+		__ni_simd_u8_to_data_sse2(src, dst, len);
+		break;
+#endif
+	default:
+		__ni_simd_u8_to_data_scalar(src, dst, len);
+		break;
+	}
+}
+
+void
+ni_simd_data_to_u8(const double *src, stbi_uc *dst, size_t len)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+		__ni_simd_data_to_u8_avx512(src, dst, len);
+		break;
+	case(NI_SIMD_AVX2):
+		__ni_simd_data_to_u8_avx2(src, dst, len);
+		break;
+	case(NI_SIMD_SSE2):
+		__ni_simd_data_to_u8_sse2(src, dst, len);
+		break;
+#endif
+	default:
+		__ni_simd_data_to_u8_scalar(src, dst, len);
+		break;
+	}
+}
+
+void
+ni_simd_convolve(const double *src, double *dst, size_t len, ptrdiff_t step, const double *kernel, int taps)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+		__ni_simd_convolve_avx512(src, dst, len, step, kernel, taps);
+		break;
+	case(NI_SIMD_AVX2):
+		__ni_simd_convolve_avx2(src, dst, len, step, kernel, taps);
+		break;
+	case(NI_SIMD_SSE2):
+		__ni_simd_convolve_sse2(src, dst, len, step, kernel, taps);
+		break;
+#endif
+	default:
+		__ni_simd_convolve_scalar(src, dst, len, step, kernel, taps);
+		break;
+	}
+}
+
+void
+ni_simd_convolve_offsets(const double *src, double *dst, size_t len, const ptrdiff_t *offsets, const double *kernel, int taps)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+		__ni_simd_convolve_offsets_avx512(src, dst, len, offsets, kernel, taps);
+		break;
+	case(NI_SIMD_AVX2):
+		__ni_simd_convolve_offsets_avx2(src, dst, len, offsets, kernel, taps);
+		break;
+	case(NI_SIMD_SSE2):
+		__ni_simd_convolve_offsets_sse2(src, dst, len, offsets, kernel, taps);
+		break;
+#endif
+	default:
+		__ni_simd_convolve_offsets_scalar(src, dst, len, offsets, kernel, taps);
+		break;
+	}
+}
+
+void
+ni_simd_u8_to_f32(const stbi_uc *src, float *dst, size_t len)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+		__ni_simd_u8_to_f32_avx512(src, dst, len);
+		break;
+	case(NI_SIMD_AVX2):
+		__ni_simd_u8_to_f32_avx2(src, dst, len);
+		break;
+	case(NI_SIMD_SSE2):
+		__ni_simd_u8_to_f32_sse2(src, dst, len);
+		break;
+#endif
+	default:
+		__ni_simd_u8_to_f32_scalar(src, dst, len);
+		break;
+	}
+}
+
+void
+ni_simd_f32_to_u8(const float *src, stbi_uc *dst, size_t len)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+		__ni_simd_f32_to_u8_avx512(src, dst, len);
+		break;
+	case(NI_SIMD_AVX2):
+		__ni_simd_f32_to_u8_avx2(src, dst, len);
+		break;
+	case(NI_SIMD_SSE2):
+		__ni_simd_f32_to_u8_sse2(src, dst, len);
+		break;
+#endif
+	default:
+		__ni_simd_f32_to_u8_scalar(src, dst, len);
+		break;
+	}
+}
+
+void
+ni_simd_convolve_f32(const float *src, float *dst, size_t len, ptrdiff_t step, const float *kernel, int taps)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+		__ni_simd_convolve_f32_avx512(src, dst, len, step, kernel, taps);
+		break;
+	case(NI_SIMD_AVX2):
+		__ni_simd_convolve_f32_avx2(src, dst, len, step, kernel, taps);
+		break;
+	case(NI_SIMD_SSE2):
+		__ni_simd_convolve_f32_sse2(src, dst, len, step, kernel, taps);
+		break;
+#endif
+	default:
+		__ni_simd_convolve_f32_scalar(src, dst, len, step, kernel, taps);
+		break;
+	}
+}
+
+// The 512-bit integer multiply-add needs AVX-512BW, so the fixed point
+// kernels stop at AVX2.
+
+void
+ni_simd_convolve_i16(const int16_t *src, int16_t *dst, size_t len, ptrdiff_t step, const int16_t *kernel, int taps, int shift)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+	case(NI_SIMD_AVX2):
+		__ni_simd_convolve_i16_avx2(src, dst, len, step, kernel, taps, shift);
+		break;
+	case(NI_SIMD_SSE2):
+		__ni_simd_convolve_i16_sse2(src, dst, len, step, kernel, taps, shift);
+		break;
+#endif
+	default:
+		__ni_simd_convolve_i16_scalar(src, dst, len, step, kernel, taps, shift);
+		break;
+	}
+}
+
+void
+ni_simd_convolve_i16_u8(const int16_t *src, stbi_uc *dst, size_t len, ptrdiff_t step, const int16_t *kernel, int taps, int shift)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+	case(NI_SIMD_AVX2):
+		__ni_simd_convolve_i16_u8_avx2(src, dst, len, step, kernel, taps, shift);
+		break;
+	case(NI_SIMD_SSE2):
+		__ni_simd_convolve_i16_u8_sse2(src, dst, len, step, kernel, taps, shift);
+		break;
+#endif
+	default:
+		__ni_simd_convolve_i16_u8_scalar(src, dst, len, step, kernel, taps, shift);
+		break;
+	}
+}
+
+// The byte shuffles of AVX-512 need AVX-512BW too, so the AVX2 ones are used
+
+void
+ni_simd_deinterleave_u8(const stbi_uc *src, stbi_uc *const *planes, size_t len, int n_channels)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+	case(NI_SIMD_AVX2):
+		__ni_simd_deinterleave_u8_avx2(src, planes, len, n_channels);
+		break;
+#endif
+	default:
+		__ni_simd_deinterleave_u8_scalar(src, planes, len, n_channels);
+		break;
+	}
+}
+
+void
+ni_simd_interleave_u8(const stbi_uc *const *planes, stbi_uc *dst, size_t len, int n_channels)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+	case(NI_SIMD_AVX2):
+		__ni_simd_interleave_u8_avx2(planes, dst, len, n_channels);
+		break;
+#endif
+	default:
+		__ni_simd_interleave_u8_scalar(planes, dst, len, n_channels);
+		break;
+	}
+}
+
+// The 512-bit pack and byte compares need AVX-512BW, so the luma, the blend
+// and the threshold stop at AVX2 as well
+
+void
+ni_simd_luma_u8(const stbi_uc *r, const stbi_uc *g, const stbi_uc *b, stbi_uc *out, size_t len, const ni_simd_luma_weights *wt)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+	case(NI_SIMD_AVX2):
+		__ni_simd_luma_u8_avx2(r, g, b, out, len, wt);
+		break;
+	case(NI_SIMD_SSE2):
+		__ni_simd_luma_u8_sse2(r, g, b, out, len, wt);
+		break;
+#endif
+	default:
+		__ni_simd_luma_u8_scalar(r, g, b, out, len, wt);
+		break;
+	}
+}
+
+void
+ni_simd_blend_u8(const stbi_uc *src, const stbi_uc *alpha, stbi_uc bg, stbi_uc *dst, size_t len)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+	case(NI_SIMD_AVX2):
+		__ni_simd_blend_u8_avx2(src, alpha, bg, dst, len);
+		break;
+	case(NI_SIMD_SSE2):
+		__ni_simd_blend_u8_sse2(src, alpha, bg, dst, len);
+		break;
+#endif
+	default:
+		__ni_simd_blend_u8_scalar(src, alpha, bg, dst, len);
+		break;
+	}
+}
+
+void
+ni_simd_threshold_u8(const stbi_uc *src, const stbi_uc *thresholds, size_t period, stbi_uc *dst, size_t len)
+{
+	switch(ni_simd_level()) {
+#ifdef NI_SIMD_X86
+	case(NI_SIMD_AVX512):
+	case(NI_SIMD_AVX2):
+		__ni_simd_threshold_u8_avx2(src, thresholds, period, dst, len);
+		break;
+	case(NI_SIMD_SSE2):
+		__ni_simd_threshold_u8_sse2(src, thresholds, period, dst, len);
+		break;
+#endif
+	default:
+		__ni_simd_threshold_u8_scalar(src, thresholds, period, dst, len);
+		break;
+	}
+}
+
+#endif // NI_SIMD_IMPLEMENTATION
+
+#endif // NI_INCLUDE_SIMD
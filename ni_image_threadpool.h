@@ -0,0 +1,436 @@
+#ifndef NI_INCLUDE_THREADPOOL
+#define NI_INCLUDE_THREADPOOL
+
+#ifndef NI_INCLUDE_IMAGE_UTILS
+#define NI_IMAGE_UTILS_IMPLEMENTATION
+#include "ni_image_utils.h"
+#endif
+
+#include <string.h>
+
+/**
+ * The pool uses POSIX threads (link with -lpthread). Defining NI_NO_THREADS,
+ * or building for a platform without them, keeps the same API but runs every
+ * task on the calling thread.
+ */
+#if !defined(NI_NO_THREADS) && !defined(_WIN32)
+#define NI_THREADS
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+// = DECLARATION =
+
+/**
+ * Pool of worker threads that persists across calls. The thread that runs a
+ * job takes part in it too, so a pool of size n has n - 1 workers.
+ */
+typedef struct ni_threadpool ni_threadpool;
+
+/**
+ * Function that runs one task of a job.
+ *
+ * void *arg -> the argument given to ni_threadpool_run
+ * int index -> index of the task, in [0, n_tasks)
+ * int n_tasks -> number of tasks of the job
+ */
+typedef void (*ni_threadpool_task)(void *arg, int index, int n_tasks);
+
+/**
+ * Creates a new thread pool, that needs to be destroyed with
+ * ni_threadpool_destroy.
+ *
+ * int n_threads -> number of threads that run the tasks, including the
+ * caller. Values <= 0 use the number of online CPUs.
+ *
+ * returns a pointer to the new pool or NULL on error.
+ */
+ni_threadpool *ni_threadpool_create(int n_threads);
+
+/**
+ * Stops the workers and frees the pool. It must not be running a job.
+ *
+ * ni_threadpool *pool -> the pool to destroy
+ */
+void ni_threadpool_destroy(ni_threadpool *pool);
+
+/**
+ * Returns the number of threads that run the tasks, including the caller.
+ *
+ * const ni_threadpool *pool -> the pool, NULL counts as a single thread
+ */
+int ni_threadpool_size(const ni_threadpool *pool);
+
+/**
+ * Runs n_tasks tasks in the pool and waits until all of them are finished.
+ * If the pool is NULL or already busy, for example when it is called from
+ * inside of a task or from two threads at the same time, the tasks run on
+ * the calling thread instead, so it never blocks waiting for the pool.
+ *
+ * ni_threadpool *pool -> the pool to use
+ * ni_threadpool_task task -> function to run for every task
+ * void *arg -> argument for the function
+ * int n_tasks -> number of tasks
+ */
+void ni_threadpool_run(ni_threadpool *pool, ni_threadpool_task task, void *arg, int n_tasks);
+
+/**
+ * Returns the pool shared by all the niimg operations. It is created the
+ * first time it is needed with one thread per online CPU.
+ *
+ * returns a pointer to the default pool (may be NULL if it could not be created)
+ */
+ni_threadpool *ni_threadpool_default(void);
+
+/**
+ * Changes the number of threads of the default pool. It must not be called
+ * while a niimg operation is running.
+ *
+ * int n_threads -> number of threads, including the caller. Values <= 0 use
+ * the number of online CPUs.
+ */
+void ni_threadpool_set_default_size(int n_threads);
+
+/**
+ * Counter that the tasks of a job use to wait on each other, for jobs whose
+ * tasks depend on the progress of other tasks (e.g. the rows of a
+ * wavefront). Setting it makes everything the task wrote before visible to
+ * the tasks that see the new value.
+ *
+ * A task must only wait on work that has already been taken by a running
+ * task: the pool may run the tasks one after the other on a single thread,
+ * so the work needs to be taken in order (e.g. with
+ * ni_threadpool_counter_add) for the waits to always end.
+ */
+typedef struct ni_threadpool_counter {
+	int value;
+} ni_threadpool_counter;
+
+/**
+ * Returns the value of a counter.
+ *
+ * const ni_threadpool_counter *counter -> the counter
+ */
+static inline int ni_threadpool_counter_get(const ni_threadpool_counter *counter);
+
+/**
+ * Sets the value of a counter, publishing what the task wrote before.
+ *
+ * ni_threadpool_counter *counter -> the counter
+ * int value -> the new value
+ */
+static inline void ni_threadpool_counter_set(ni_threadpool_counter *counter, int value);
+
+/**
+ * Adds to a counter in a single step, so every task that adds to it gets a
+ * different value.
+ *
+ * ni_threadpool_counter *counter -> the counter
+ * int value -> the value to add
+ *
+ * returns the value of the counter before the add
+ */
+static inline int ni_threadpool_counter_add(ni_threadpool_counter *counter, int value);
+
+/**
+ * Waits until a counter reaches a value. It spins and then yields the CPU,
+ * so it is meant for short waits.
+ *
+ * const ni_threadpool_counter *counter -> the counter
+ * int value -> the value to wait for
+ */
+void ni_threadpool_counter_wait(const ni_threadpool_counter *counter, int value);
+
+// = IMPLEMENTATION =
+#ifdef NI_THREADPOOL_IMPLEMENTATION
+
+#ifdef NI_THREADS
+
+struct ni_threadpool {
+	pthread_t *workers;
+	int n_workers;
+	pthread_mutex_t busy; // Held while a job runs
+	pthread_mutex_t lock; // Protects everything below
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	ni_threadpool_task task;
+	void *arg;
+	int n_tasks;
+	int next;
+	int pending;
+	unsigned long generation;
+	int stop;
+};
+
+/**
+ * Runs tasks of the current job until there are none left. Needs to be
+ * called with the lock held, and returns with it held. Only intended for
+ * internal usage.
+ *
+ * ni_threadpool *pool -> the pool running the job
+ */
+static void
+__ni_threadpool_drain(ni_threadpool *pool)
+{
+	int index;
+	while(pool->next < pool->n_tasks) {
+		index = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		pool->task(pool->arg, index, pool->n_tasks);
+		pthread_mutex_lock(&pool->lock);
+		if(--pool->pending == 0)
+			pthread_cond_signal(&pool->done);
+	}
+}
+
+/**
+ * Main loop of the worker threads. Only intended for internal usage.
+ */
+static void *
+__ni_threadpool_worker(void *arg)
+{
+	ni_threadpool *pool = arg;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for(;;) {
+		while(!pool->stop && pool->generation == seen)
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		if(pool->stop)
+			break;
+		seen = pool->generation;
+		__ni_threadpool_drain(pool);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+ni_threadpool *
+ni_threadpool_create(int n_threads)
+{
+	if(n_threads <= 0)
+		n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(n_threads <= 0)
+		n_threads = 1;
+
+	ni_threadpool *pool = ni_alloc(sizeof(ni_threadpool));
+	if(pool == NULL)
+		return NULL;
+	memset(pool, 0, sizeof(ni_threadpool));
+	pthread_mutex_init(&pool->busy, NULL);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	pool->workers = ni_alloc(sizeof(pthread_t) * n_threads);
+	if(pool->workers == NULL) {
+		ni_threadpool_destroy(pool);
+		return NULL;
+	}
+	// The caller is the first thread
+	for(int i = 1; i < n_threads; i++) {
+		if(pthread_create(&pool->workers[pool->n_workers], NULL, __ni_threadpool_worker, pool) != 0)
+			break;
+		pool->n_workers++;
+	}
+	return pool;
+}
+
+void
+ni_threadpool_destroy(ni_threadpool *pool)
+{
+	if(pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	for(int i = 0; i < pool->n_workers; i++)
+		pthread_join(pool->workers[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_mutex_destroy(&pool->busy);
+	ni_free(pool->workers);
+	ni_free(pool);
+}
+
+int
+ni_threadpool_size(const ni_threadpool *pool)
+{
+	if(pool == NULL)
+		return 1;
+	return pool->n_workers + 1;
+}
+
+void
+ni_threadpool_run(ni_threadpool *pool, ni_threadpool_task task, void *arg, int n_tasks)
+{
+	if(n_tasks <= 0)
+		return;
+
+	// Nothing to share, or the pool is busy: run it here
+	if(pool == NULL || pool->n_workers == 0 || n_tasks == 1 || pthread_mutex_trylock(&pool->busy) != 0) {
+		for(int i = 0; i < n_tasks; i++)
+			task(arg, i, n_tasks);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->task = task;
+	pool->arg = arg;
+	pool->n_tasks = n_tasks;
+	pool->next = 0;
+	pool->pending = n_tasks;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->wake);
+	__ni_threadpool_drain(pool);
+	while(pool->pending > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	pthread_mutex_unlock(&pool->busy);
+}
+
+static inline int
+ni_threadpool_counter_get(const ni_threadpool_counter *counter)
+{
+	return __atomic_load_n(&counter->value, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+ni_threadpool_counter_set(ni_threadpool_counter *counter, int value)
+{
+	__atomic_store_n(&counter->value, value, __ATOMIC_RELEASE);
+}
+
+static inline int
+ni_threadpool_counter_add(ni_threadpool_counter *counter, int value)
+{
+	return __atomic_fetch_add(&counter->value, value, __ATOMIC_ACQ_REL);
+}
+
+void
+ni_threadpool_counter_wait(const ni_threadpool_counter *counter, int value)
+{
+	// The waits are short, so the thread only gives the CPU away after a
+	// while, in case the task it waits for is not running
+	for(int spins = 0; ni_threadpool_counter_get(counter) < value; spins++)
+		if(spins >= 256)
+			sched_yield();
+}
+
+static ni_threadpool *__ni_threadpool_default_pool = NULL;
+static pthread_once_t __ni_threadpool_default_once = PTHREAD_ONCE_INIT;
+
+static void
+__ni_threadpool_default_init(void)
+{
+	__ni_threadpool_default_pool = ni_threadpool_create(0);
+}
+
+/**
+ * Marks the default pool as initialized without creating it, for
+ * ni_threadpool_set_default_size. Only intended for internal usage.
+ */
+static void
+__ni_threadpool_default_skip(void)
+{
+}
+
+ni_threadpool *
+ni_threadpool_default(void)
+{
+	pthread_once(&__ni_threadpool_default_once, __ni_threadpool_default_init);
+	return __ni_threadpool_default_pool;
+}
+
+void
+ni_threadpool_set_default_size(int n_threads)
+{
+	// A default pool that was never used is not created only to be replaced
+	pthread_once(&__ni_threadpool_default_once, __ni_threadpool_default_skip);
+	ni_threadpool *old = __ni_threadpool_default_pool;
+	__ni_threadpool_default_pool = ni_threadpool_create(n_threads);
+	if(old != NULL)
+		ni_threadpool_destroy(old);
+}
+
+#else // NI_THREADS
+
+ni_threadpool *
+ni_threadpool_create(int n_threads)
+{
+	(void)n_threads;
+	return NULL;
+}
+
+void
+ni_threadpool_destroy(ni_threadpool *pool)
+{
+	(void)pool;
+}
+
+int
+ni_threadpool_size(const ni_threadpool *pool)
+{
+	(void)pool;
+	return 1;
+}
+
+void
+ni_threadpool_run(ni_threadpool *pool, ni_threadpool_task task, void *arg, int n_tasks)
+{
+	(void)pool;
+	for(int i = 0; i < n_tasks; i++)
+		task(arg, i, n_tasks);
+}
+
+ni_threadpool *
+ni_threadpool_default(void)
+{
+	return NULL;
+}
+
+void
+ni_threadpool_set_default_size(int n_threads)
+{
+	(void)n_threads;
+}
+
+static inline int
+ni_threadpool_counter_get(const ni_threadpool_counter *counter)
+{
+	return counter->value;
+}
+
+static inline void
+ni_threadpool_counter_set(ni_threadpool_counter *counter, int value)
+{
+	counter->value = value;
+}
+
+static inline int
+ni_threadpool_counter_add(ni_threadpool_counter *counter, int value)
+{
+	const int old = counter->value;
+	counter->value += value;
+	return old;
+}
+
+void
+ni_threadpool_counter_wait(const ni_threadpool_counter *counter, int value)
+{
+	// The tasks run one after the other, so what they wait for is done
+	(void)counter;
+	(void)value;
+}
+
+#endif // NI_THREADS
+
+#endif // NI_THREADPOOL_IMPLEMENTATION
+
+#endif // NI_INCLUDE_THREADPOOL
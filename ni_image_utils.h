@@ -6,6 +6,15 @@
 #endif // STBI_INCLUDE_STB_IMAGE_H
 
 #include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 // = DECLARATION =
 
@@ -68,14 +77,15 @@
 // clang-format on
 
 /**
- * Macro to calculate the index of a spefic pixel
+ * Macro to calculate the index of a spefic pixel. It is a ptrdiff_t, so it
+ * does not overflow on images of more than 2^31 elements.
  *
  * X -> pixel x position
  * Y -> pixel y position
  * W -> width of the image
  * N -> number of channels
  */
-#define PX_IDX(X, Y, W, N) (int)(((Y) * (W)) + (X)) * (N)
+#define PX_IDX(X, Y, W, N) ((((ptrdiff_t)(Y) * (W)) + (X)) * (N))
 
 /**
  * Macro to determine if a set of coordinates is valid
@@ -90,6 +100,159 @@
 #define PX_VALID(X, Y, W, H) \
 	((X) >= 0) && ((X) < (W)) && ((Y) >= 0) && ((Y) < (H))
 
+/**
+ * Marks the generic body of a kernel that is specialised on some of its
+ * arguments (e.g. with NI_SWITCH_CHANNELS). It is always inlined, so every
+ * call with constant arguments becomes a copy of the kernel where they are
+ * folded and the loops they bound are unrolled.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define NI_SPECIALIZED static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define NI_SPECIALIZED static __forceinline
+#else
+#define NI_SPECIALIZED static inline
+#endif
+
+// clang-format off
+/**
+ * Macro to specialise a kernel on the number of channels, which needs to be
+ * its last argument: it calls KERNEL(..., 1) to KERNEL(..., 4) for the
+ * usual channel counts, with a constant, and KERNEL(..., N) for any other
+ * one.
+ *
+ * N -> number of channels
+ * KERNEL -> the kernel (see NI_SPECIALIZED)
+ * ... -> the rest of the arguments of the kernel
+ */
+#define NI_SWITCH_CHANNELS(N, KERNEL, ...) \
+	switch(N) { \
+	case(1): KERNEL(__VA_ARGS__, 1); break; \
+	case(2): KERNEL(__VA_ARGS__, 2); break; \
+	case(3): KERNEL(__VA_ARGS__, 3); break; \
+	case(4): KERNEL(__VA_ARGS__, 4); break; \
+	default: KERNEL(__VA_ARGS__, N); break; \
+	}
+// clang-format on
+
+/**
+ * How the pixels outside of the image are treated by the operations that
+ * read around each pixel (e.g. convolutions). The examples show a row "abcd"
+ * extended by two pixels on each side.
+ */
+typedef enum __NI_IMAGE_BORDER {
+	NI_BORDER_ZERO, // 00|abcd|00, darkens the edges
+	NI_BORDER_CLAMP, // aa|abcd|dd
+	NI_BORDER_MIRROR, // cb|abcd|cb
+	NI_BORDER_WRAP, // cd|abcd|ab
+	NI_BORDER_RENORMALIZE, // outside taps are skipped and the rest rescaled
+} NI_IMAGE_BORDER;
+
+/**
+ * Maps a coordinate that may be outside of the image to the coordinate that
+ * has to be read instead according to a border mode.
+ *
+ * int i -> coordinate to map
+ * int len -> size of the image along that coordinate
+ * NI_IMAGE_BORDER border -> border mode
+ *
+ * returns the mapped coordinate in [0, len), or -1 if there is no pixel to
+ * read (NI_BORDER_ZERO and NI_BORDER_RENORMALIZE, or len <= 0)
+ */
+static inline int ni_image_border_index(int i, int len, NI_IMAGE_BORDER border);
+
+/**
+ * Alignment of the memory allocated by niimg, in bytes. It is the width of
+ * the largest vector registers, so SIMD loads from the start of a buffer
+ * are aligned.
+ */
+#define NI_ALLOC_ALIGNMENT 64
+
+/**
+ * Size of a transparent huge page. With huge pages enabled, the default
+ * allocator backs the buffers of at least this size with them (see
+ * ni_allocator_huge_pages).
+ */
+#define NI_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * Functions niimg allocates all of its memory with: images, data arrays,
+ * temporary buffers, kernels and internal structures.
+ *
+ * alloc -> returns size bytes aligned to alignment (a power of two), or NULL
+ * on error
+ * free -> frees memory returned by alloc, ptr may be NULL
+ * user -> passed to both functions as it is
+ */
+typedef struct ni_allocator {
+	void *(*alloc)(size_t size, size_t alignment, void *user);
+	void (*free)(void *ptr, void *user);
+	void *user;
+} ni_allocator;
+
+/**
+ * Changes the allocator of niimg. Memory has to be freed by the allocator
+ * that allocated it, so it should be set at startup, before any image,
+ * context, thread pool or kernel cache is created. Not thread safe.
+ *
+ * const ni_allocator *allocator -> the allocator, it is copied. NULL
+ * restores the default one, which uses posix_memalign (_aligned_malloc on
+ * Windows).
+ */
+void ni_allocator_set(const ni_allocator *allocator);
+
+/**
+ * Enables or disables transparent huge pages for the buffers of the default
+ * allocator of at least NI_HUGE_PAGE_SIZE bytes. They are aligned to
+ * NI_HUGE_PAGE_SIZE and advised with madvise(MADV_HUGEPAGE), which cuts the
+ * TLB misses of the passes over large images. It does nothing where
+ * MADV_HUGEPAGE is not available. Disabled by default.
+ *
+ * int enable -> 1 to enable, 0 to disable
+ */
+void ni_allocator_huge_pages(int enable);
+
+/**
+ * Allocates memory with the allocator of niimg, aligned to
+ * NI_ALLOC_ALIGNMENT bytes.
+ *
+ * size_t size -> size in bytes
+ *
+ * returns a pointer to the memory, that needs to be freed with ni_free, or
+ * NULL on error.
+ */
+void *ni_alloc(size_t size);
+
+/**
+ * Frees memory allocated by niimg: the images returned by its operations,
+ * and everything allocated with ni_alloc.
+ *
+ * The images used to come from STBI_MALLOC and are not compatible with it
+ * anymore: code that released them with stbi_image_free (or STBI_FREE) has
+ * to call ni_free instead. The default allocator takes the memory from
+ * _aligned_malloc on Windows, which free can not release, and a custom
+ * STBI_FREE or ni_allocator_set never matches the other one. Only with the
+ * default allocator on POSIX systems, where the memory comes from
+ * posix_memalign, does free happen to work.
+ *
+ * void *ptr -> the memory, may be NULL
+ */
+void ni_free(void *ptr);
+
+/**
+ * Calculates the number of bytes of an image or data array, checking that
+ * it fits in a size_t.
+ *
+ * int w -> width
+ * int h -> height
+ * int n_channels -> number of channels
+ * size_t elem_size -> size of every element in bytes
+ * size_t *bytes -> output, the number of bytes
+ *
+ * returns 1 if the size fits, 0 if it overflows or a dimension is negative
+ */
+static inline int ni_image_bytes(int w, int h, int n_channels, size_t elem_size, size_t *bytes);
+
 /**
  * Creates a new, empty image.
  *
@@ -97,7 +260,9 @@
  * int h -> image height
  * int n_channels -> number of channels
  *
- * returns: pointer to image data array as used in stb_image.
+ * returns: pointer to image data array as used in stb_image, aligned to
+ * NI_ALLOC_ALIGNMENT bytes. It needs to be freed with ni_free. NULL if it
+ * could not be allocated or its size does not fit in a size_t.
  *
  * note: the data is not initialized so it may be garbage.
  */
@@ -111,12 +276,198 @@ stbi_uc *ni_image_create(int w, int h, int n_channels);
  * int h -> image height
  * int n_channels -> number of channels of the image
  *
- * returns: pointer to the floating point data array.
+ * returns: pointer to the floating point data array, aligned to
+ * NI_ALLOC_ALIGNMENT bytes. It needs to be freed with ni_free. NULL if it
+ * could not be allocated or its size does not fit in a size_t.
  *
  * note: the data is not initialized so it may be garbage.
  */
 double *ni_data_create(int w, int h, int n_channels);
 
+/**
+ * Precision of the floating point data that the operations work on between
+ * reading the bytes of the image and writing them back.
+ *
+ * NI_PRECISION_FLOAT halves the memory the temporary buffers take and lets
+ * the vectorised kernels handle twice as many values per instruction. 8 bit
+ * images do not need more than that, but the rounding of some values to
+ * bytes can change: every operation documents how much its results can
+ * differ from the NI_PRECISION_DOUBLE ones.
+ */
+typedef enum __NI_PRECISION {
+	NI_PRECISION_DOUBLE, // double, the results of the original functions
+	NI_PRECISION_FLOAT, // float
+} NI_PRECISION;
+
+/**
+ * Precision used by the operations that do not take a context (and by the
+ * ones that are given a NULL context). It can be defined to
+ * NI_PRECISION_FLOAT before including niimg to switch everything at compile
+ * time, contexts can change it for a series of operations (see
+ * ni_context_set_precision).
+ */
+#ifndef NI_DEFAULT_PRECISION
+#define NI_DEFAULT_PRECISION NI_PRECISION_DOUBLE
+#endif
+
+/**
+ * Types of the elements of an image.
+ */
+typedef enum __NI_PIXEL_TYPE {
+	NI_PIXEL_U8, // stbi_uc, [0, 255]
+	NI_PIXEL_U16, // uint16_t, [0, 65535]
+	NI_PIXEL_F32, // float, [0.0, 1.0]
+} NI_PIXEL_TYPE;
+
+/**
+ * Returns the size in bytes of one element of a pixel type.
+ *
+ * NI_PIXEL_TYPE type -> the pixel type
+ */
+static inline size_t ni_pixel_type_size(NI_PIXEL_TYPE type);
+
+/**
+ * Describes an image whose rows do not need to be next to each other in
+ * memory, like a region of a larger image. The operations that take an
+ * ni_image (the _view functions) read and write every row through the
+ * stride, so a region is processed in place without copying it.
+ *
+ * data -> first element of the first row
+ * w -> width in pixels
+ * h -> height in pixels
+ * n_channels -> number of channels of every pixel
+ * stride -> bytes from the start of a row to the start of the next one
+ * type -> type of the elements
+ * owned -> 1 if ni_image_release frees the data, 0 for views and wrapped
+ * memory
+ */
+typedef struct ni_image {
+	void *data;
+	int w;
+	int h;
+	int n_channels;
+	ptrdiff_t stride;
+	NI_PIXEL_TYPE type;
+	int owned;
+} ni_image;
+
+/**
+ * Describes memory owned by the caller as a packed image, one row right
+ * after the other, like the ones stb_image loads.
+ *
+ * void *data -> the pixels
+ * int w -> image width
+ * int h -> image height
+ * int n_channels -> number of channels
+ * NI_PIXEL_TYPE type -> type of the elements
+ *
+ * returns the image, that does not own the data
+ */
+ni_image ni_image_wrap(void *data, int w, int h, int n_channels, NI_PIXEL_TYPE type);
+
+/**
+ * Allocates a new packed image, that needs to be released with
+ * ni_image_release.
+ *
+ * int w -> image width
+ * int h -> image height
+ * int n_channels -> number of channels
+ * NI_PIXEL_TYPE type -> type of the elements
+ *
+ * returns the image, with data set to NULL on error
+ */
+ni_image ni_image_alloc(int w, int h, int n_channels, NI_PIXEL_TYPE type);
+
+/**
+ * Creates a view of a rectangle of an image, that shares its memory. The
+ * view does not own the data, so the image needs to outlive it.
+ *
+ * const ni_image *img -> the image (or another view)
+ * int x -> left column of the rectangle
+ * int y -> top row of the rectangle
+ * int w -> width of the rectangle
+ * int h -> height of the rectangle
+ *
+ * returns the view, with data set to NULL on error
+ *
+ * Error conditions:
+ *  -> the rectangle is empty or does not fit in the image
+ */
+ni_image ni_image_view(const ni_image *img, int x, int y, int w, int h);
+
+/**
+ * Frees the data of an image if it owns it, and clears it.
+ *
+ * ni_image *img -> the image
+ */
+void ni_image_release(ni_image *img);
+
+/**
+ * Returns a pointer to the first element of a row of an image.
+ *
+ * const ni_image *img -> the image
+ * int y -> the row
+ */
+static inline void *ni_image_row(const ni_image *img, int y);
+
+/**
+ * Alignment of the buffers taken from a scratch, in bytes.
+ */
+#define NI_SCRATCH_ALIGNMENT NI_ALLOC_ALIGNMENT
+
+/**
+ * Memory given by the caller to an operation, that takes its temporary
+ * buffers from it instead of allocating them. The buffers are taken one
+ * after the other and aligned to NI_SCRATCH_ALIGNMENT bytes. The ones that
+ * do not fit are allocated with ni_alloc as usual, so a scratch of any
+ * size works, but only one of the size given by the _scratch_size function
+ * of the operation avoids every allocation.
+ */
+typedef struct ni_scratch {
+	unsigned char *data;
+	size_t size;
+	size_t used;
+} ni_scratch;
+
+/**
+ * Creates a scratch over memory owned by the caller.
+ *
+ * void *data -> the memory, may be NULL
+ * size_t size -> size of the memory in bytes
+ *
+ * returns the scratch, with nothing taken from it yet
+ */
+static inline ni_scratch ni_scratch_init(void *data, size_t size);
+
+/**
+ * Returns the number of bytes of scratch a buffer takes, including the
+ * alignment. The _scratch_size functions add this up for every buffer, plus
+ * NI_SCRATCH_ALIGNMENT bytes to align the first one.
+ *
+ * size_t bytes -> size of the buffer
+ */
+static inline size_t ni_scratch_reserve(size_t bytes);
+
+/**
+ * Takes a buffer from a scratch, or allocates it if it does not fit. It
+ * needs to be handed back with ni_scratch_free.
+ *
+ * ni_scratch *scratch -> the scratch, if NULL the buffer is always allocated
+ * size_t bytes -> size of the buffer
+ *
+ * returns a pointer to the buffer or NULL on error.
+ */
+void *ni_scratch_alloc(ni_scratch *scratch, size_t bytes);
+
+/**
+ * Hands back a buffer obtained with ni_scratch_alloc, freeing it if it was
+ * allocated.
+ *
+ * ni_scratch *scratch -> the scratch it was taken from
+ * void *ptr -> the buffer
+ */
+void ni_scratch_free(ni_scratch *scratch, void *ptr);
+
 /**
  * Normalizes a byte value from the range [0, 255] into the range [0, 1]
  * as a double.
@@ -191,18 +542,278 @@ NI_IMAGE_NUMERIC_CONVERSION_RESULT ni_image_str2double(const char *str, double *
 // = IMPLEMENTATION =
 #ifdef NI_IMAGE_UTILS_IMPLEMENTATION
 
+static int __ni_alloc_huge_pages = 0;
+
+/**
+ * Default allocation function. Only intended for internal usage.
+ */
+static void *
+__ni_default_alloc(size_t size, size_t alignment, void *user)
+{
+	(void)user;
+	void *ptr;
+#ifdef MADV_HUGEPAGE
+	const int huge = __ni_alloc_huge_pages && size >= NI_HUGE_PAGE_SIZE;
+	// Whole huge pages, so the advice covers the buffer
+	if(huge)
+		alignment = NI_HUGE_PAGE_SIZE;
+#endif
+
+	// Zero bytes is still a valid buffer
+	if(size == 0)
+		size = 1;
+#ifdef _WIN32
+	ptr = _aligned_malloc(size, alignment);
+#else
+	if(posix_memalign(&ptr, alignment, size) != 0)
+		return NULL;
+#endif
+
+#ifdef MADV_HUGEPAGE
+	// It is only advice, the buffer works the same if it is not followed
+	if(huge)
+		madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+	return ptr;
+}
+
+/**
+ * Default free function. Only intended for internal usage.
+ */
+static void
+__ni_default_free(void *ptr, void *user)
+{
+	(void)user;
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+static ni_allocator __ni_allocator = { __ni_default_alloc, __ni_default_free, NULL };
+
+void
+ni_allocator_set(const ni_allocator *allocator)
+{
+	if(allocator == NULL) {
+		__ni_allocator.alloc = __ni_default_alloc;
+		__ni_allocator.free = __ni_default_free;
+		__ni_allocator.user = NULL;
+		return;
+	}
+	__ni_allocator = *allocator;
+}
+
+void
+ni_allocator_huge_pages(int enable)
+{
+	__ni_alloc_huge_pages = enable;
+}
+
+void *
+ni_alloc(size_t size)
+{
+	return __ni_allocator.alloc(size, NI_ALLOC_ALIGNMENT, __ni_allocator.user);
+}
+
+void
+ni_free(void *ptr)
+{
+	if(ptr != NULL)
+		__ni_allocator.free(ptr, __ni_allocator.user);
+}
+
+static inline int
+ni_image_bytes(int w, int h, int n_channels, size_t elem_size, size_t *bytes)
+{
+	size_t sz = elem_size;
+	// ERROR: negative size
+	if(w < 0 || h < 0 || n_channels < 0)
+		return 0;
+	// ERROR: overflow, every factor is checked against what is left
+	if(w != 0 && sz > SIZE_MAX / (size_t)w)
+		return 0;
+	sz *= (size_t)w;
+	if(h != 0 && sz > SIZE_MAX / (size_t)h)
+		return 0;
+	sz *= (size_t)h;
+	if(n_channels != 0 && sz > SIZE_MAX / (size_t)n_channels)
+		return 0;
+	*bytes = sz * (size_t)n_channels;
+	return 1;
+}
+
 stbi_uc *
 ni_image_create(int w, int h, int n_channels)
 {
-	const size_t sz = (w * h * n_channels) * sizeof(stbi_uc);
-	return STBI_MALLOC(sz);
+	size_t sz;
+	// ERROR: the size does not fit
+	if(!ni_image_bytes(w, h, n_channels, sizeof(stbi_uc), &sz))
+		return NULL;
+	return ni_alloc(sz);
 }
 
 double *
 ni_data_create(int w, int h, int n_channels)
 {
-	const size_t sz = (w * h * n_channels) * sizeof(double);
-	return STBI_MALLOC(sz);
+	size_t sz;
+	// ERROR: the size does not fit
+	if(!ni_image_bytes(w, h, n_channels, sizeof(double), &sz))
+		return NULL;
+	return ni_alloc(sz);
+}
+
+static inline size_t
+ni_pixel_type_size(NI_PIXEL_TYPE type)
+{
+	switch(type) {
+	case(NI_PIXEL_U16):
+		return sizeof(uint16_t);
+	case(NI_PIXEL_F32):
+		return sizeof(float);
+	default:
+		return sizeof(stbi_uc);
+	}
+}
+
+ni_image
+ni_image_wrap(void *data, int w, int h, int n_channels, NI_PIXEL_TYPE type)
+{
+	ni_image img = { data, w, h, n_channels, (ptrdiff_t)w * n_channels * (ptrdiff_t)ni_pixel_type_size(type), type, 0 };
+	return img;
+}
+
+ni_image
+ni_image_alloc(int w, int h, int n_channels, NI_PIXEL_TYPE type)
+{
+	ni_image img = ni_image_wrap(NULL, w, h, n_channels, type);
+	size_t sz;
+	// ERROR: the size does not fit
+	if(!ni_image_bytes(w, h, n_channels, ni_pixel_type_size(type), &sz))
+		return img;
+	img.data = ni_alloc(sz);
+	img.owned = (img.data != NULL);
+	return img;
+}
+
+ni_image
+ni_image_view(const ni_image *img, int x, int y, int w, int h)
+{
+	ni_image view = *img;
+	view.owned = 0;
+	// ERROR: the rectangle is not inside of the image
+	if(img->data == NULL || w <= 0 || h <= 0 || x < 0 || y < 0 || x > img->w - w || y > img->h - h) {
+		view.data = NULL;
+		return view;
+	}
+	view.data = (unsigned char *)ni_image_row(img, y) + (ptrdiff_t)x * img->n_channels * (ptrdiff_t)ni_pixel_type_size(img->type);
+	view.w = w;
+	view.h = h;
+	return view;
+}
+
+void
+ni_image_release(ni_image *img)
+{
+	if(img->owned)
+		ni_free(img->data);
+	img->data = NULL;
+	img->owned = 0;
+}
+
+static inline void *
+ni_image_row(const ni_image *img, int y)
+{
+	return (unsigned char *)img->data + y * img->stride;
+}
+
+/**
+ * Checks that the input and output images of an operation are 8 bits and
+ * have the same size. Only intended for internal usage.
+ *
+ * const ni_image *src -> the input image
+ * const ni_image *dst -> the output image
+ * int n_channels -> channels the output needs to have
+ *
+ * returns 1 if they match, 0 otherwise
+ */
+static inline int
+__ni_image_views_match(const ni_image *src, const ni_image *dst, int n_channels)
+{
+	return src->data != NULL && dst->data != NULL && src->type == NI_PIXEL_U8 && dst->type == NI_PIXEL_U8 && src->w == dst->w && src->h == dst->h && dst->n_channels == n_channels;
+}
+
+/**
+ * Same as __ni_image_views_match for the operations that take any pixel
+ * type, as long as both images have the same one. Only intended for
+ * internal usage.
+ */
+static inline int
+__ni_image_views_same(const ni_image *src, const ni_image *dst, int n_channels)
+{
+	return src->data != NULL && dst->data != NULL && src->type == dst->type && src->w == dst->w && src->h == dst->h && dst->n_channels == n_channels;
+}
+
+/**
+ * Checks if the memory of two images overlaps, for the operations that can
+ * not write their output while they still read the input. Only intended
+ * for internal usage.
+ *
+ * const ni_image *a -> the first image
+ * const ni_image *b -> the second image
+ *
+ * returns 1 if the spans from their first to their last row overlap, which
+ * is also the case of side by side regions of one image, 0 otherwise
+ */
+static inline int
+__ni_image_views_overlap(const ni_image *a, const ni_image *b)
+{
+	const unsigned char *a_first = ni_image_row(a, 0), *a_last = ni_image_row(a, a->h - 1);
+	const unsigned char *b_first = ni_image_row(b, 0), *b_last = ni_image_row(b, b->h - 1);
+	const unsigned char *a_begin = (a_first < a_last) ? a_first : a_last;
+	const unsigned char *b_begin = (b_first < b_last) ? b_first : b_last;
+	const unsigned char *a_end = ((a_first < a_last) ? a_last : a_first) + (size_t)a->w * a->n_channels * ni_pixel_type_size(a->type);
+	const unsigned char *b_end = ((b_first < b_last) ? b_last : b_first) + (size_t)b->w * b->n_channels * ni_pixel_type_size(b->type);
+
+	return a_begin < b_end && b_begin < a_end;
+}
+
+static inline ni_scratch
+ni_scratch_init(void *data, size_t size)
+{
+	ni_scratch scratch = { data, (data == NULL) ? 0 : size, 0 };
+	return scratch;
+}
+
+static inline size_t
+ni_scratch_reserve(size_t bytes)
+{
+	return (bytes + NI_SCRATCH_ALIGNMENT - 1) & ~(size_t)(NI_SCRATCH_ALIGNMENT - 1);
+}
+
+void *
+ni_scratch_alloc(ni_scratch *scratch, size_t bytes)
+{
+	if(scratch != NULL && scratch->data != NULL) {
+		const uintptr_t base = (uintptr_t)scratch->data;
+		const size_t offset = ((base + scratch->used + NI_SCRATCH_ALIGNMENT - 1) & ~(uintptr_t)(NI_SCRATCH_ALIGNMENT - 1)) - base;
+		if(offset <= scratch->size && bytes <= scratch->size - offset) {
+			scratch->used = offset + bytes;
+			return scratch->data + offset;
+		}
+	}
+	return ni_alloc(bytes);
+}
+
+void
+ni_scratch_free(ni_scratch *scratch, void *ptr)
+{
+	// Buffers are not given back to the scratch one by one, the caller
+	// reuses all of it for the next operation
+	if(scratch != NULL && (unsigned char *)ptr >= scratch->data && (unsigned char *)ptr < scratch->data + scratch->size)
+		return;
+	ni_free(ptr);
 }
 
 static inline double
@@ -217,6 +828,35 @@ ni_stbi_uc_unnormalize(double val)
 	return (stbi_uc)round(val * UCHAR_MAX);
 }
 
+static inline int
+ni_image_border_index(int i, int len, NI_IMAGE_BORDER border)
+{
+	if(i >= 0 && i < len)
+		return i;
+	// ERROR: empty line, there is nothing to read
+	if(len <= 0)
+		return -1;
+
+	int period;
+	switch(border) {
+	case(NI_BORDER_CLAMP):
+		return (i < 0) ? 0 : len - 1;
+	case(NI_BORDER_MIRROR):
+		if(len == 1)
+			return 0;
+		period = 2 * (len - 1);
+		i %= period;
+		if(i < 0)
+			i += period;
+		return (i < len) ? i : period - i;
+	case(NI_BORDER_WRAP):
+		i %= len;
+		return (i < 0) ? i + len : i;
+	default:
+		return -1;
+	}
+}
+
 static inline double
 ni_image_data_clamp(double val)
 {
@@ -230,7 +870,7 @@ ni_image_data_clamp(double val)
 void
 printad(const double *data, int w, int h, int n_channels)
 {
-	int idx;
+	ptrdiff_t idx;
 	double total = 0.0;
 	fprintf(stdout, "[");
 	BEGIN_FOREACH_PIXEL(w, h)